@@ -370,3 +370,76 @@ void hashtable_iter_set(hashtable_t *hashtable, void *iter, void *value)
 
     pair->value = value;
 }
+
+size_t hashtable_order_work_size(size_t n)
+{
+    size_t i = 0;
+
+    while(primes[i] < n && i < sizeof(primes) / sizeof(primes[0]) - 1)
+        i++;
+
+    return 2 * (n + 1) + 2 * primes[i];
+}
+
+/* Mirrors insert_to_bucket() and hashtable_do_rehash() on list indexes;
+   index n is the list head. */
+static void order_insert(size_t *next, size_t *prev, size_t *first,
+                         size_t *last, size_t n, size_t bucket, size_t node)
+{
+    size_t at;
+
+    if(first[bucket] == n && last[bucket] == n)
+    {
+        at = n;
+        last[bucket] = node;
+    }
+    else
+        at = first[bucket];
+
+    next[node] = at;
+    prev[node] = prev[at];
+    next[prev[at]] = node;
+    prev[at] = node;
+    first[bucket] = node;
+}
+
+void hashtable_order(const size_t *hashes, size_t n, size_t *order,
+                     size_t *work)
+{
+    size_t *next = work, *prev = work + n + 1, *first, *last;
+    size_t i, j, node, num, index = 0;
+
+    first = prev + n + 1;
+    num = primes[index];
+    last = first + num;
+    for(j = 0; j < num; j++)
+        first[j] = last[j] = n;
+    next[n] = prev[n] = n;
+
+    for(i = 0; i < n; i++)
+    {
+        /* rehash if the load ratio exceeds 1 */
+        if(i >= num)
+        {
+            num = primes[++index];
+            last = first + num;
+            for(j = 0; j < num; j++)
+                first[j] = last[j] = n;
+
+            node = next[n];
+            next[n] = prev[n] = n;
+            while(node != n)
+            {
+                size_t following = next[node];
+                order_insert(next, prev, first, last, n,
+                             hashes[node] % num, node);
+                node = following;
+            }
+        }
+
+        order_insert(next, prev, first, last, n, hashes[i] % num, i);
+    }
+
+    for(i = 0, node = next[n]; node != n; node = next[node])
+        order[i++] = node;
+}
@@ -207,4 +207,28 @@ void *hashtable_iter_value(void *iter);
  */
 void hashtable_iter_set(hashtable_t *hashtable, void *iter, void *value);
 
+/**
+ * hashtable_order_work_size - Size of the work area for hashtable_order
+ *
+ * @n: The number of keys
+ *
+ * Returns the number of size_t elements hashtable_order needs as work
+ * area for n keys.
+ */
+size_t hashtable_order_work_size(size_t n);
+
+/**
+ * hashtable_order - Compute an iteration order without a hashtable
+ *
+ * @hashes: The hashes of n distinct keys, in order of insertion
+ * @n: The number of keys
+ * @order: Receives the indexes of the keys, in the order in which
+ *     iterating over a hashtable containing them would visit them
+ * @work: A work area of hashtable_order_work_size(n) elements
+ *
+ * This does not allocate any memory.
+ */
+void hashtable_order(const size_t *hashes, size_t n, size_t *order,
+                     size_t *work);
+
 #endif
@@ -235,6 +235,22 @@ jansson_json_t_p EXPORT(json_loadb) (const char *buffer, size_t buflen, size_t f
 jansson_json_t_p EXPORT(json_loadf) (FILE *input, size_t flags, json_error_t *error);
 jansson_json_t_p EXPORT(json_load_file) (const char *path, size_t flags, json_error_t *error);
 
+/* arena decoding
+
+   json_loads_arena() works like json_loads(), but every value is allocated
+   from the given arena instead of individually. The values belong to the
+   arena: json_incref() and json_decref() have no effect on them, they must
+   not be modified, and they stay valid until the arena is reset or freed,
+   which releases them all at once. */
+
+typedef struct json_arena json_arena_t;
+typedef json_arena_t *jansson_json_arena_t_p;
+
+jansson_json_arena_t_p EXPORT(json_arena_new) (void);
+void EXPORT(json_arena_reset) (json_arena_t *arena);
+void EXPORT(json_arena_free) (json_arena_t *arena);
+jansson_json_t_p EXPORT(json_loads_arena) (json_arena_t *arena, const char *input, size_t flags, json_error_t *error);
+
 
 /* encoding */
 
@@ -252,6 +268,38 @@ int EXPORT(json_dumpf) (const json_t *json, FILE *output, size_t flags);
 int EXPORT(json_dump_file) (const json_t *json, const char *path, size_t flags);
 int EXPORT(json_dump_callback) (const json_t *json, json_dump_callback_t callback, void *data, size_t flags);
 
+/* streaming encoding
+
+   A writer produces the same text as json_dumps() with JSON_COMPACT would
+   for the equivalent tree, without building the tree: values are appended
+   to a buffer as they are written. Object members come out in the order
+   json_dumps() would use, which is only the order they were written in
+   with JSON_PRESERVE_ORDER; so the keys of an object must be distinct.
+   JSON_ENSURE_ASCII and JSON_PRESERVE_ORDER are the flags that matter. The
+   buffer is kept when the writer is cleared, so a writer can be reused
+   without allocating. */
+
+typedef struct json_writer json_writer_t;
+typedef json_writer_t *jansson_json_writer_t_p;
+
+jansson_json_writer_t_p EXPORT(json_writer_new) (size_t flags);
+void EXPORT(json_writer_free) (json_writer_t *writer);
+void EXPORT(json_writer_clear) (json_writer_t *writer);
+jansson_cchar_p EXPORT(json_writer_text) (const json_writer_t *writer);
+size_t EXPORT(json_writer_length) (const json_writer_t *writer);
+
+int EXPORT(json_writer_object_begin) (json_writer_t *writer);
+int EXPORT(json_writer_object_end) (json_writer_t *writer);
+int EXPORT(json_writer_array_begin) (json_writer_t *writer);
+int EXPORT(json_writer_array_end) (json_writer_t *writer);
+int EXPORT(json_writer_key) (json_writer_t *writer, const char *key);
+int EXPORT(json_writer_string) (json_writer_t *writer, const char *value);
+int EXPORT(json_writer_integer) (json_writer_t *writer, json_int_t value);
+int EXPORT(json_writer_boolean) (json_writer_t *writer, int value);
+int EXPORT(json_writer_null) (json_writer_t *writer);
+int EXPORT(json_writer_value) (json_writer_t *writer, const json_t *json);
+int EXPORT(json_writer_raw) (json_writer_t *writer, const char *text, size_t length);
+
 /* custom memory allocation */
 
 typedef void *(*json_malloc_t)(size_t);
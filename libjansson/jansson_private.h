@@ -86,6 +86,10 @@ void jsonp_error_set(json_error_t *error, int line, int column,
 void jsonp_error_vset(json_error_t *error, int line, int column,
                       size_t position, const char *msg, va_list ap);
 
+/* Serializes a string, including quotes; shared by the encoder and writer */
+int jsonp_dump_string(const char *str, int ascii, json_dump_callback_t dump,
+                      void *data);
+
 /* Locale independent string<->double conversions */
 int jsonp_strtod(strbuffer_t *strbuffer, double *out);
 int jsonp_dtostr(char *buffer, size_t size, double value);
@@ -95,4 +99,9 @@ void* jsonp_malloc(size_t size);
 void jsonp_free(void *ptr);
 char *jsonp_strdup(const char *str);
 
+/* While an arena is set, jsonp_malloc() allocates from it, jsonp_free() does
+   nothing, and new values are never freed. Returns the previous arena. */
+json_arena_t *jsonp_set_arena(json_arena_t *arena);
+int jsonp_in_arena(void);
+
 #endif
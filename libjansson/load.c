@@ -880,6 +880,19 @@ json_t *json_loads(const char *string, size_t flags, json_error_t *error)
     return result;
 }
 
+json_t *json_loads_arena(json_arena_t *arena, const char *string,
+                         size_t flags, json_error_t *error)
+{
+    json_arena_t *previous;
+    json_t *result;
+
+    previous = jsonp_set_arena(arena);
+    result = json_loads(string, flags, error);
+    jsonp_set_arena(previous);
+
+    return result;
+}
+
 typedef struct
 {
     const char *data;
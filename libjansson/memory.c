@@ -16,17 +16,73 @@
 static json_malloc_t do_malloc = malloc;
 static json_free_t do_free = free;
 
+/* Arenas hand out memory from a list of chunks, newest first. Nothing is
+   freed on its own; a reset keeps only the newest (and largest) chunk, so an
+   arena that is reused for messages of similar size stops allocating. */
+
+#define ARENA_ALIGNMENT   16
+#define ARENA_CHUNK_SIZE  4096
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+};
+
+#define ARENA_HEADER_SIZE \
+    ((sizeof(struct arena_chunk) + ARENA_ALIGNMENT - 1) & \
+     ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct json_arena {
+    struct arena_chunk *chunks;
+    char *next, *end;
+};
+
+/* the arena that jsonp_malloc() currently allocates from, if any */
+static json_arena_t *current_arena = NULL;
+
+static void *arena_alloc(json_arena_t *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+    size_t chunk_size;
+    void *ptr;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if(size > (size_t)(arena->end - arena->next))
+    {
+        chunk_size = arena->chunks ? arena->chunks->size * 2 : ARENA_CHUNK_SIZE;
+        chunk_size = max(chunk_size, size + ARENA_HEADER_SIZE);
+
+        chunk = (*do_malloc)(chunk_size);
+        if(!chunk)
+            return NULL;
+
+        chunk->size = chunk_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = (char *)chunk + ARENA_HEADER_SIZE;
+        arena->end = (char *)chunk + chunk_size;
+    }
+
+    ptr = arena->next;
+    arena->next += size;
+    return ptr;
+}
+
 void *jsonp_malloc(size_t size)
 {
     if(!size)
         return NULL;
 
+    if(current_arena)
+        return arena_alloc(current_arena, size);
+
     return (*do_malloc)(size);
 }
 
 void jsonp_free(void *ptr)
 {
-    if(!ptr)
+    /* memory in an arena is only freed when the arena is reset */
+    if(!ptr || current_arena)
         return;
 
     (*do_free)(ptr);
@@ -44,6 +100,56 @@ char *jsonp_strdup(const char *str)
     return new_str;
 }
 
+json_arena_t *jsonp_set_arena(json_arena_t *arena)
+{
+    json_arena_t *previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+int jsonp_in_arena(void)
+{
+    return current_arena != NULL;
+}
+
+json_arena_t *json_arena_new(void)
+{
+    json_arena_t *arena = (*do_malloc)(sizeof(json_arena_t));
+    if(!arena)
+        return NULL;
+
+    arena->chunks = NULL;
+    arena->next = arena->end = NULL;
+    return arena;
+}
+
+void json_arena_reset(json_arena_t *arena)
+{
+    struct arena_chunk *chunk, *next;
+
+    if(!arena->chunks)
+        return;
+
+    for(chunk = arena->chunks->next; chunk; chunk = next)
+    {
+        next = chunk->next;
+        (*do_free)(chunk);
+    }
+    arena->chunks->next = NULL;
+    arena->next = (char *)arena->chunks + ARENA_HEADER_SIZE;
+}
+
+void json_arena_free(json_arena_t *arena)
+{
+    if(!arena)
+        return;
+
+    json_arena_reset(arena);
+    if(arena->chunks)
+        (*do_free)(arena->chunks);
+    (*do_free)(arena);
+}
+
 void json_set_alloc_funcs(json_malloc_t malloc_fn, json_free_t free_fn)
 {
     do_malloc = malloc_fn;
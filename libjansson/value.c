@@ -20,7 +20,7 @@
 static JSON_INLINE void json_init(json_t *json, json_type type)
 {
     json->type = type;
-    json->refcount = 1;
+    json->refcount = jsonp_in_arena() ? (size_t)-1 : 1;
 }
 
 
@@ -0,0 +1,379 @@
+/*
+ * Jansson is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See copyright for details.
+ */
+
+#include <string.h>
+
+#include "jansson_private.h"
+#include "strbuffer.h"
+
+#define MAX_INTEGER_STR_LENGTH  100
+
+struct writer_level {
+    int is_object;
+    size_t count;           /* values or members written so far */
+    size_t first_member;    /* index into members, for objects */
+};
+
+/* An object member as it was written: key, ':' and value, without the
+   separating commas, which are only added once the order is known. */
+struct writer_member {
+    size_t start, end;
+    size_t hash;
+};
+
+struct json_writer {
+    strbuffer_t buffer;
+    size_t flags;
+    int key_written;        /* the next value belongs to this key */
+
+    struct writer_level *levels;
+    size_t depth, levels_size;
+
+    struct writer_member *members;
+    size_t num_members, members_size;
+
+    /* for sorting members */
+    strbuffer_t scratch;
+    size_t *hashes, *order, *work;
+    size_t hashes_size, work_size;
+};
+
+static int dump_to_strbuffer(const char *buffer, size_t size, void *data)
+{
+    return strbuffer_append_bytes((strbuffer_t *)data, buffer, size);
+}
+
+/* Makes room for count elements of size bytes each in *array. */
+static int grow_array(void **array, size_t *allocated, size_t count,
+                      size_t size)
+{
+    size_t new_size;
+    void *new_array;
+
+    if(count <= *allocated)
+        return 0;
+
+    new_size = max(*allocated * 2, max(count, 8));
+    new_array = jsonp_malloc(new_size * size);
+    if(!new_array)
+        return -1;
+
+    if(*array)
+        memcpy(new_array, *array, *allocated * size);
+    jsonp_free(*array);
+    *array = new_array;
+    *allocated = new_size;
+    return 0;
+}
+
+json_writer_t *json_writer_new(size_t flags)
+{
+    json_writer_t *writer = jsonp_malloc(sizeof(json_writer_t));
+    if(!writer)
+        return NULL;
+
+    memset(writer, 0, sizeof(json_writer_t));
+    writer->flags = flags;
+    if(strbuffer_init(&writer->buffer))
+    {
+        jsonp_free(writer);
+        return NULL;
+    }
+    if(strbuffer_init(&writer->scratch))
+    {
+        strbuffer_close(&writer->buffer);
+        jsonp_free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+void json_writer_free(json_writer_t *writer)
+{
+    if(!writer)
+        return;
+
+    strbuffer_close(&writer->buffer);
+    strbuffer_close(&writer->scratch);
+    jsonp_free(writer->levels);
+    jsonp_free(writer->members);
+    jsonp_free(writer->hashes);
+    jsonp_free(writer->order);
+    jsonp_free(writer->work);
+    jsonp_free(writer);
+}
+
+void json_writer_clear(json_writer_t *writer)
+{
+    strbuffer_clear(&writer->buffer);
+    writer->key_written = 0;
+    writer->depth = 0;
+    writer->num_members = 0;
+}
+
+const char *json_writer_text(const json_writer_t *writer)
+{
+    return strbuffer_value(&writer->buffer);
+}
+
+size_t json_writer_length(const json_writer_t *writer)
+{
+    return writer->buffer.length;
+}
+
+/* Called before every value: adds the separator in arrays, and checks that
+   values in objects have a key. */
+static int begin_value(json_writer_t *writer)
+{
+    struct writer_level *level;
+
+    if(!writer->depth)
+        return 0;
+
+    level = &writer->levels[writer->depth - 1];
+    if(level->is_object)
+    {
+        if(!writer->key_written)
+            return -1;
+        writer->key_written = 0;
+        return 0;
+    }
+
+    if(level->count++ && strbuffer_append_byte(&writer->buffer, ','))
+        return -1;
+    return 0;
+}
+
+static int begin_container(json_writer_t *writer, int is_object)
+{
+    struct writer_level *level;
+
+    if(begin_value(writer) ||
+       grow_array((void **)&writer->levels, &writer->levels_size,
+                  writer->depth + 1, sizeof(struct writer_level)))
+        return -1;
+
+    level = &writer->levels[writer->depth++];
+    level->is_object = is_object;
+    level->count = 0;
+    level->first_member = writer->num_members;
+
+    return strbuffer_append_byte(&writer->buffer, is_object ? '{' : '[');
+}
+
+int json_writer_object_begin(json_writer_t *writer)
+{
+    return begin_container(writer, 1);
+}
+
+int json_writer_array_begin(json_writer_t *writer)
+{
+    return begin_container(writer, 0);
+}
+
+int json_writer_array_end(json_writer_t *writer)
+{
+    if(!writer->depth || writer->levels[writer->depth - 1].is_object)
+        return -1;
+
+    writer->depth--;
+    return strbuffer_append_byte(&writer->buffer, ']');
+}
+
+/* Rewrites the members of an object in the order json_dumps() would have
+   used for a json_t object with the same members. */
+static int order_members(json_writer_t *writer, struct writer_member *members,
+                         size_t count)
+{
+    strbuffer_t *buffer = &writer->buffer;
+    size_t i, start = members[0].start, work_size;
+
+    if(count > writer->hashes_size)
+    {
+        size_t size = max(count, writer->hashes_size * 2);
+
+        jsonp_free(writer->hashes);
+        jsonp_free(writer->order);
+        writer->hashes = jsonp_malloc(size * sizeof(size_t));
+        writer->order = jsonp_malloc(size * sizeof(size_t));
+        writer->hashes_size = size;
+        if(!writer->hashes || !writer->order)
+        {
+            writer->hashes_size = 0;
+            return -1;
+        }
+    }
+
+    work_size = hashtable_order_work_size(count);
+    if(work_size > writer->work_size)
+    {
+        jsonp_free(writer->work);
+        writer->work = jsonp_malloc(work_size * sizeof(size_t));
+        writer->work_size = work_size;
+        if(!writer->work)
+        {
+            writer->work_size = 0;
+            return -1;
+        }
+    }
+
+    if(writer->flags & JSON_PRESERVE_ORDER)
+    {
+        for(i = 0; i < count; i++)
+            writer->order[i] = i;
+    }
+    else
+    {
+        for(i = 0; i < count; i++)
+            writer->hashes[i] = members[i].hash;
+        hashtable_order(writer->hashes, count, writer->order, writer->work);
+    }
+
+    strbuffer_clear(&writer->scratch);
+    if(strbuffer_append_bytes(&writer->scratch, buffer->value + start,
+                              buffer->length - start))
+        return -1;
+
+    buffer->length = start;
+    for(i = 0; i < count; i++)
+    {
+        struct writer_member *member = &members[writer->order[i]];
+
+        if(i && strbuffer_append_byte(buffer, ','))
+            return -1;
+        if(strbuffer_append_bytes(buffer,
+                                  writer->scratch.value + member->start - start,
+                                  member->end - member->start))
+            return -1;
+    }
+
+    return 0;
+}
+
+int json_writer_object_end(json_writer_t *writer)
+{
+    struct writer_level *level;
+    struct writer_member *members;
+
+    if(!writer->depth || writer->key_written)
+        return -1;
+    level = &writer->levels[writer->depth - 1];
+    if(!level->is_object)
+        return -1;
+
+    members = writer->members + level->first_member;
+    if(level->count > 1)
+    {
+        members[level->count - 1].end = writer->buffer.length;
+        if(order_members(writer, members, level->count))
+            return -1;
+    }
+
+    writer->num_members = level->first_member;
+    writer->depth--;
+    return strbuffer_append_byte(&writer->buffer, '}');
+}
+
+int json_writer_key(json_writer_t *writer, const char *key)
+{
+    struct writer_level *level;
+    struct writer_member *member;
+    int ascii = writer->flags & JSON_ENSURE_ASCII ? 1 : 0;
+
+    if(!writer->depth || writer->key_written)
+        return -1;
+    level = &writer->levels[writer->depth - 1];
+    if(!level->is_object)
+        return -1;
+
+    if(grow_array((void **)&writer->members, &writer->members_size,
+                  writer->num_members + 1, sizeof(struct writer_member)))
+        return -1;
+
+    if(level->count)
+        writer->members[writer->num_members - 1].end = writer->buffer.length;
+
+    member = &writer->members[writer->num_members++];
+    member->start = writer->buffer.length;
+    member->hash = jsonp_hash_str(key);
+    level->count++;
+    writer->key_written = 1;
+
+    if(jsonp_dump_string(key, ascii, dump_to_strbuffer, &writer->buffer))
+        return -1;
+    return strbuffer_append_byte(&writer->buffer, ':');
+}
+
+int json_writer_string(json_writer_t *writer, const char *value)
+{
+    int ascii = writer->flags & JSON_ENSURE_ASCII ? 1 : 0;
+
+    if(!value || begin_value(writer))
+        return -1;
+
+    return jsonp_dump_string(value, ascii, dump_to_strbuffer,
+                             &writer->buffer);
+}
+
+int json_writer_integer(json_writer_t *writer, json_int_t value)
+{
+    char buffer[MAX_INTEGER_STR_LENGTH], *pos;
+    json_int_t rest = value;
+
+    if(begin_value(writer))
+        return -1;
+
+    /* The same digits "%" JSON_INTEGER_FORMAT would give, but this is by
+       far the most common kind of value, and much faster than snprintf. */
+    pos = buffer + MAX_INTEGER_STR_LENGTH;
+    do {
+        int digit = rest % 10;
+        *--pos = '0' + (digit < 0 ? -digit : digit);
+        rest /= 10;
+    } while(rest);
+    if(value < 0)
+        *--pos = '-';
+
+    return strbuffer_append_bytes(&writer->buffer, pos,
+                                  buffer + MAX_INTEGER_STR_LENGTH - pos);
+}
+
+int json_writer_boolean(json_writer_t *writer, int value)
+{
+    if(begin_value(writer))
+        return -1;
+
+    if(value)
+        return strbuffer_append_bytes(&writer->buffer, "true", 4);
+    return strbuffer_append_bytes(&writer->buffer, "false", 5);
+}
+
+int json_writer_null(json_writer_t *writer)
+{
+    if(begin_value(writer))
+        return -1;
+
+    return strbuffer_append_bytes(&writer->buffer, "null", 4);
+}
+
+int json_writer_value(json_writer_t *writer, const json_t *json)
+{
+    size_t flags = JSON_COMPACT | JSON_ENCODE_ANY;
+
+    if(!json || begin_value(writer))
+        return -1;
+
+    flags |= writer->flags & (JSON_ENSURE_ASCII | JSON_PRESERVE_ORDER);
+    return json_dump_callback(json, dump_to_strbuffer, &writer->buffer, flags);
+}
+
+int json_writer_raw(json_writer_t *writer, const char *text, size_t length)
+{
+    if(begin_value(writer))
+        return -1;
+
+    return strbuffer_append_bytes(&writer->buffer, text, length);
+}
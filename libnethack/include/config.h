@@ -26,6 +26,11 @@
 
 # define PANICLOG "paniclog"    /* log of panic and impossible events */
 
+/* Read the whole data library (nhdat) into memory when it's first opened, so
+ * that level creation, rumors, and so on don't need to do any file I/O.
+ * Comment this out to read the library via stdio as needed instead. */
+# define DLB_PRELOAD
+
 # include "global.h"    /* Define everything else according to choices above */
 
 #endif /* CONFIG_H */
@@ -350,6 +350,13 @@ enum target_location_units {
     TLU_EOF
 };
 
+/* An entry in the index of save backups that log_sync() uses while replaying;
+   turn is -1 if it hasn't been read from the save backup yet. */
+struct log_backup {
+    long location;                          /* bytes from start of file */
+    int turn;
+};
+
 extern struct sinfo {
     int game_running;   /* ok to call nh_do_move */
     int viewing;        /* replaying or watching a game */
@@ -389,6 +396,16 @@ extern struct sinfo {
      * target_location, but nothing forces you to do this.
      */
     int logfile;                                      /* file descriptor */
+
+    /* A read-only mapping of the first logmap_len bytes of the logfile, or
+       NULL; see log_mapped_at(). It's only made while logmap_allowed, i.e.
+       between log_init() and log_uninit(). logmap_seen is the size the
+       logfile had when we last looked. */
+    const char *logmap;
+    long logmap_len;
+    long logmap_seen;
+    boolean logmap_allowed;
+
     struct memfile binary_save;
     boolean binary_save_allocated;
     int expected_recovery_count;
@@ -401,6 +418,16 @@ extern struct sinfo {
     enum target_location_units target_location_units;
     boolean input_was_just_replayed;
     boolean ok_to_diff;
+
+    /* Lengths in the file of the save backup at save_backup_location, and of
+       the save diffs since then, for deciding when to write the next. */
+    long save_backup_bytes;
+    long save_diff_bytes;
+    int save_diff_count;
+
+    /* While viewing, every save backup in the log, in file order. */
+    struct log_backup *backup_index;
+    int backup_index_count;
 } program_state;
 
 #endif /* DECL_H */
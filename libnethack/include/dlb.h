@@ -26,6 +26,10 @@ typedef struct dlb_library {
     long nentries;      /* # of files in directory */
     long rev;   /* dlb file revision */
     long strsize;       /* dlb file string size */
+    long *hashtab;      /* directory indices by name hash, -1 if unused */
+    long hashsize;      /* # of slots in hashtab (a power of 2) */
+    const char *fmem;   /* entire library file, if preloaded */
+    long fmapsize;      /* if nonzero, fmem is mapped rather than malloc'd */
 } library;
 
 /* library definitions */
@@ -59,6 +63,7 @@ int dlb_fseek(DLB_P, long, int);
 char *dlb_fgets(void *, int, DLB_P);
 int dlb_fgetc(DLB_P);
 long dlb_ftell(DLB_P);
+const char *dlb_fmem(DLB_P);
 
 #endif /* DLB_H */
 
@@ -595,6 +595,9 @@ extern int open_bonesfile(char *bonesid);
 extern int delete_bonesfile(char *bonesid);
 extern void paniclog(const char *, const char *);
 extern boolean change_fd_lock(int fd, enum locktype type, int timeout);
+extern void startup_trace_begin(const char *what);
+extern void startup_trace(const char *phase);
+extern void startup_trace_end(void);
 
 /* ### fountain.c ### */
 
@@ -802,6 +805,15 @@ extern void log_init(int fd);
 extern void log_uninit(void);
 extern void log_game_over(const char *death);
 
+extern int base64size(int n);
+extern void base64_encode_binary(const unsigned char *in, char *out, int len);
+extern const char *base64_decode_data(const char *in, char *out, int outlen);
+extern const char *decode_save_line(const char *s, const struct memfile *base,
+                                    struct memfile *mf);
+extern enum nh_log_status parse_log_header(char *const *lines,
+                                           struct nh_game_info *si,
+                                           int *recovery_count);
+
 /* ### makemon.c ### */
 
 extern struct monst *newmonst(int extyp, int namelen);
@@ -853,6 +865,9 @@ extern void store_mf(int fd, struct memfile *mf);
 extern void mtag(struct memfile *mf, long tagdata,
                  enum memfile_tagtype tagtype);
 extern void mdiffflush(struct memfile *mf);
+extern void mwrite_matching(struct memfile *mf, const void *buf, int len);
+extern const char *mdiffapply(struct memfile *mf, const char *diff,
+                              int difflen, const struct memfile *base);
 extern void mread(struct memfile *mf, void *, unsigned int);
 extern int8_t mread8(struct memfile *mf);
 extern int16_t mread16(struct memfile *mf);
@@ -1406,7 +1421,6 @@ extern void finish_quest(struct obj *);
 
 /* ### questpgr.c ### */
 
-extern void load_qtlist(void);
 extern void unload_qtlist(void);
 extern short quest_info(int);
 extern boolean is_quest_artifact(struct obj *);
@@ -1479,7 +1493,10 @@ extern const char *Goodbye(void);
 
 /* ### rumors.c ### */
 
+extern boolean load_rumors(void);
+extern const char *rumor_at(int, int);
 extern const char *getrumor(int, boolean, int *);
+extern char *const *oracle_at(int, int *);
 extern void outrumor(int, int);
 extern void save_oracles(struct memfile *mf);
 extern void free_oracles(void);
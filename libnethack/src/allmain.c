@@ -30,6 +30,10 @@ static void command_input(int cmdidx, struct nh_cmd_arg *arg);
 
 static void decrement_helplessness(void);
 
+static void redraw_loaded_game(void);
+
+static noreturn void replay_main_loop(void);
+
 const char *const *
 nh_get_copyright_banner(void)
 {
@@ -71,6 +75,16 @@ nh_lib_exit(void)
 }
 
 
+/* For benchmarks: the totals for libnethack's own xmalloc chains. Safe to call
+   at any time, including before nh_lib_init. */
+void
+nh_get_xmalloc_stats(unsigned long long *allocations,
+                     unsigned long long *bytes, unsigned long long *chunks)
+{
+    xmalloc_get_stats(allocations, bytes, chunks);
+}
+
+
 boolean
 nh_exit_game(int exit_type)
 {
@@ -86,6 +100,10 @@ nh_exit_game(int exit_type)
 
     if (program_state.game_running) {
 
+        /* There's nothing to save or quit when replaying a finished game. */
+        if (program_state.viewing)
+            terminate(GAME_ALREADY_OVER);
+
         switch (exit_type) {
         case EXIT_REQUEST_SAVE:
             dosave(&(struct nh_cmd_arg){.argtype = 0});
@@ -132,16 +150,20 @@ startup_common(boolean including_program_state)
     /* (re)init all global data */
     init_data(including_program_state);
     reset_encumber_msg();
+    startup_trace("init_data");
 
     /* create mutable copies of object and artifact liss */
     init_objlist();
     init_artilist();
     reset_rndmonst(NON_PM);
     free_dungeon();     /* clean up stray dungeon data */
+    startup_trace("init_objlist");
 
     initoptions();
+    startup_trace("initoptions");
 
     dlb_init(); /* must be before newgame() */
+    startup_trace("dlb_init");
 
     /* 
      *  Initialize the vision system.  This must be before mklev() on a
@@ -151,6 +173,7 @@ startup_common(boolean including_program_state)
     if (including_program_state) {
         vision_init();
         cls();
+        startup_trace("vision_init");
     }
 
     initrack();
@@ -238,6 +261,8 @@ nh_create_game(int fd, struct nh_option_desc *opts)
 {
     unsigned int seed = 0;
     microseconds birthday;
+    const char *fixed;
+    boolean fixed_games = FALSE;
     int i;
 
     API_ENTRY_CHECKPOINT() {
@@ -256,6 +281,18 @@ nh_create_game(int fd, struct nh_option_desc *opts)
     program_state.suppress_screen_updates = TRUE;
     birthday = utc_time();
 
+#ifdef DEBUG_FIXED_GAMES
+    /* Benchmarks and tests need to be able to create the same game over and
+       over again, in any game mode. Builds made for them can fix the birthday
+       (NH4BIRTHDAY, in seconds since the epoch), and with it everything that
+       depends on the real time, such as the phase of the moon. This is
+       compiled out of normal builds, because it would let anyone who can set
+       the environment pick their game. */
+    fixed_games = TRUE;
+    if ((fixed = nh_getenv("NH4BIRTHDAY")))
+        birthday = (microseconds)strtoll(fixed, NULL, 10) * 1000000LL;
+#endif
+
     /* Initialize the random number generator. This can use any algorithm we
        like, and is not constrained by timing rules; but the birthday is a
        sensible input to use. The low-order decimal digits may potentially be
@@ -265,6 +302,7 @@ nh_create_game(int fd, struct nh_option_desc *opts)
     seed = (unsigned)(birthday / 1000000LL) ^ (unsigned)(birthday % 1000000LL);
     mt_srand(seed);
 
+    startup_trace_begin("create");
     startup_common(TRUE);
     /* Set defaults in case list of options from client was incomplete. */
     struct nh_option_desc *defaults = default_options();
@@ -273,10 +311,19 @@ nh_create_game(int fd, struct nh_option_desc *opts)
     nhlib_free_optlist(defaults);
     for (i = 0; opts[i].name; i++)
         nh_set_option(opts[i].name, opts[i].value);
+    startup_trace("set options");
 
     if (wizard)
         strcpy(u.uplname, "wizard");
 
+    /* NH4SEED in the environment fixes the seed of the random number
+       generator, for debugging; it only works in debug mode (or in builds
+       that allow fixed games), and leaves the birthday alone. */
+    if ((wizard || fixed_games) && (fixed = nh_getenv("NH4SEED"))) {
+        seed = (unsigned)strtoul(fixed, NULL, 10);
+        mt_srand(seed);
+    }
+
     if (!validrole(u.initrole) || !validrace(u.initrole, u.initrace) ||
         !validgend(u.initrole, u.initrace, u.initgend) ||
         !validalign(u.initrole, u.initrace, u.initalign) ||
@@ -289,6 +336,7 @@ nh_create_game(int fd, struct nh_option_desc *opts)
        newgame() is called. */
     log_init(fd);
     log_newgame(birthday, seed);
+    startup_trace("log_newgame");
 
     newgame(birthday);
 
@@ -296,6 +344,8 @@ nh_create_game(int fd, struct nh_option_desc *opts)
        don't have anything to diff against. */
     log_backup_save();
     log_uninit();
+    startup_trace("log_backup_save");
+    startup_trace_end();
 
     program_state.suppress_screen_updates = FALSE;
 
@@ -306,6 +356,7 @@ enum nh_play_status
 nh_play_game(int fd)
 {
     volatile int ret;
+    volatile boolean replaying = FALSE;
 
     if (fd < 0)
         return ERR_BAD_ARGS;
@@ -314,8 +365,8 @@ nh_play_game(int fd)
     case LS_INVALID:
         return ERR_BAD_FILE;
     case LS_DONE:
-        /* TODO: Load in replay mode. */
-        return GAME_ALREADY_OVER;
+        replaying = TRUE;
+        break;
     case LS_CRASHED:
         return ERR_RESTORE_FAILED;
     case LS_IN_PROGRESS:
@@ -377,8 +428,12 @@ nh_play_game(int fd)
         goto normal_exit;
     }
     
+    startup_trace_begin("play");
     startup_common(TRUE);
 
+    /* A completed game is loaded read-only, in replay mode. */
+    program_state.viewing = replaying;
+
     /* Load the save file. log_sync() needs to be called at least once because
        we no longer try to rerun the new game sequence, and thus must start by
        loading a binary save. (In addition, using log_sync() is /much/ faster
@@ -386,19 +441,15 @@ nh_play_game(int fd)
     log_init(fd);
     program_state.target_location_units = TLU_EOF;
     log_sync();
+    startup_trace("log_sync");
 
     program_state.game_running = TRUE;
-    post_init_tasks();
-
-    /* While loading a save file, we don't do rendering, and we don't run
-       the vision system. Do all that stuff now. */
-    vision_reset();
-    doredraw();
-    notify_levelchange(NULL);
-    bot();
-    flush_screen();
+    redraw_loaded_game();
+    startup_trace("redraw_loaded_game");
+    startup_trace_end();
 
-    update_inventory();
+    if (program_state.viewing)
+        replay_main_loop();
 
     /* The main loop. */
     while (1) {
@@ -489,12 +540,156 @@ nh_play_game(int fd)
 
 normal_exit:
     program_state.game_running = FALSE;
+    program_state.viewing = FALSE;
     log_uninit();
 
     return ret;
 }
 
 
+/* Called whenever log_sync() has replaced the gamestate. */
+static void
+redraw_loaded_game(void)
+{
+    post_init_tasks();
+
+    /* While loading a save file, we don't do rendering, and we don't run
+       the vision system. Do all that stuff now. */
+    vision_reset();
+    doredraw();
+    notify_levelchange(NULL);
+    bot();
+    flush_screen();
+
+    update_inventory();
+}
+
+
+/* Moves a replay to the given turn (or as close as the save file allows) and
+   shows the resulting gamestate. This never runs any commands: log_sync()
+   reconstructs the gamestate from the save backups and diffs alone. */
+static void
+replay_seek(long turn, long final_turn)
+{
+    if (turn < 1)
+        turn = 1;
+    if (turn > final_turn)
+        turn = final_turn;
+
+    program_state.target_location_units = TLU_TURNS;
+    program_state.target_location = turn;
+    log_sync();
+
+    redraw_loaded_game();
+}
+
+/* The main loop for replaying a completed game. Movement commands move through
+   the game: west and east step back and forward by a turn (or by the count, if
+   one is given), running moves 100 turns at a time, and < and > jump to the
+   start and end of the game, or to the turn given as a count. Commands that
+   don't take time work as usual; the replay ends upon saving. This function
+   only returns via terminate(). */
+static noreturn void
+replay_main_loop(void)
+{
+    long final_turn = moves;
+    long turn, step, start;
+
+    replay_seek(1, final_turn);
+
+    while (1) {
+        struct nh_cmd_and_arg cmd;
+        int cmdidx;
+
+        (*windowprocs.win_request_command)
+            (wizard, TRUE, FALSE, &cmd, msg_request_command_callback);
+
+        cmdidx = get_command_idx(cmd.cmd);
+
+        if (cmdidx < 0) {
+            pline("Unrecognised command '%s'", cmd.cmd);
+            continue;
+        }
+
+        cmd.arg.argtype &= cmdlist[cmdidx].flags;
+
+        if (!strcmp(cmd.cmd, "welcome")) {
+            pline("Replaying %s's game, turn %ld of %ld.", u.uplname,
+                  (long)moves, final_turn);
+            pline("Move left or right to step through it, < or > to jump to "
+                  "the start or end, and save to stop watching.");
+
+        } else if (!strcmp(cmd.cmd, "save")) {
+            terminate(GAME_ALREADY_OVER);
+
+        } else if (cmdlist[cmdidx].flags & CMD_MOVE &&
+                   cmd.arg.argtype & CMD_ARG_DIR) {
+            step = !strcmp(cmd.cmd, "move") ? 1 : 100;
+            if (cmd.arg.argtype & CMD_ARG_LIMIT && cmd.arg.limit > 0)
+                step = cmd.arg.limit;
+
+            switch (cmd.arg.dir) {
+            case DIR_W:
+            case DIR_NW:
+            case DIR_SW:
+                replay_seek(moves - step, final_turn);
+                break;
+
+            case DIR_E:
+            case DIR_NE:
+            case DIR_SE:
+                /* A turn can be missing from the save file if the hero didn't
+                   get to act on it, so keep going until we reach a later one.
+                   The forwards seeks involved are cheap, because they start at
+                   the current location. */
+                start = moves;
+                for (turn = min(start + step, final_turn);
+                     moves <= start && turn <= final_turn; turn++)
+                    replay_seek(turn, final_turn);
+                break;
+
+            case DIR_UP:
+            case DIR_DOWN:
+                if (cmd.arg.argtype & CMD_ARG_LIMIT && cmd.arg.limit > 0)
+                    replay_seek(cmd.arg.limit, final_turn);
+                else
+                    replay_seek(cmd.arg.dir == DIR_UP ? 1 : final_turn,
+                                final_turn);
+                break;
+
+            default:
+                break;
+            }
+
+            pline("Turn %ld of %ld.", (long)moves, final_turn);
+
+        } else if (!(cmdlist[cmdidx].flags & CMD_NOTIME)) {
+            pline("Command '%s' unavailable while watching/replaying a game.",
+                  cmd.cmd);
+
+        } else {
+            /* As in nh_play_game, interrupt any multi-turn action first. This
+               makes the gamestate differ from the binary save, but that's
+               harmless here; nothing is recorded, and every seek reloads the
+               gamestate from the binary save anyway. */
+            if (flags.incomplete || !flags.interrupted || flags.occupation) {
+                flags.incomplete = FALSE;
+                flags.interrupted = FALSE;
+                command_input(get_command_idx("interrupt"),
+                              &(struct nh_cmd_arg){.argtype = 0});
+            }
+
+            program_state.in_zero_time_command = TRUE;
+            command_input(cmdidx, &(cmd.arg));
+            program_state.in_zero_time_command = FALSE;
+        }
+
+        /* There are no turn boundaries to free messages at while replaying. */
+        xmalloc_cleanup(&turnstate.message_chain);
+    }
+}
+
+
 static void
 you_moved(void)
 {
@@ -826,8 +1021,9 @@ pre_move_tasks(boolean didmove)
         clear_travel_direction();    
 
     /* Handle realtime change now. If we just loaded a save, always print the
-       messages. Otherwise, print them only on change. */
-    if (!program_state.in_zero_time_command)
+       messages. Otherwise, print them only on change. A replay keeps the moon
+       phase it was played under. */
+    if (!program_state.in_zero_time_command && !program_state.viewing)
         realtime_tasks(last_command_was("welcome"));
 
     update_inventory();
@@ -1167,6 +1363,7 @@ newgame(microseconds birthday)
     flags.turntime = birthday;       /* get realtime right for level gen */
 
     init_objects();     /* must be before u_init() */
+    startup_trace("init_objects");
 
     role_init();        /* must be before init_dungeons(), u_init(), and
                            init_artifacts() */
@@ -1174,14 +1371,17 @@ newgame(microseconds birthday)
     init_dungeons();    /* must be before u_init() to avoid rndmonst() creating 
                            odd monsters for any tins and eggs in hero's initial 
                            inventory */
+    startup_trace("init_dungeons");
     init_artifacts();
     u_init(birthday);   /* struct you must have some basic data for mklev to
                            work right */
     pantheon_init(TRUE);
+    startup_trace("u_init");
 
-    load_qtlist();      /* load up the quest text info */
+    /* The quest text is loaded when it's first needed (see questpgr.c). */
 
     level = mklev(&u.uz);
+    startup_trace("mklev");
 
     u_init_inv_skills();        /* level must be valid to create items */
     u_on_upstairs();
@@ -1206,6 +1406,7 @@ newgame(microseconds birthday)
 
     youmonst.movement = NORMAL_SPEED;   /* give the hero some movement points */
     post_init_tasks();
+    startup_trace("post_init_tasks");
 }
 
 /*allmain.c*/
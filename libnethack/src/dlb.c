@@ -7,6 +7,12 @@
 #include "config.h"
 #include "dlb.h"
 
+#include <ctype.h>
+#ifdef UNIX
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
 /* without extern.h via hack.h, these haven't been declared for us */
 extern FILE *fopen_datafile(const char *, const char *, int);
 
@@ -43,12 +49,20 @@ typedef struct dlb_procs {
  * only in the Amiga port (the second library holds the sound files).
  * For Unix, the idea would be to split the NetHack library
  * into text and binary parts, where the text version could be shared.
+ *
+ * With DLB_PRELOAD, the libraries are additionally brought into memory in
+ * their entirety at initialization, and files within them are read from
+ * there (see the mem_dlb_* functions), so that nothing but dlb_init has
+ * to touch the filesystem.  Where possible, the library is mapped rather
+ * than read, so that all the game processes on a server share one copy.
  */
 
 #define MAX_LIBS 4
 static library dlb_libs[MAX_LIBS];
 
 static boolean readlibdir(library * lp);
+static unsigned long hash_filename(const char *name);
+static void hashlibdir(library * lp);
 static boolean find_file(const char *name, library ** lib, long *startp,
                          long *sizep);
 static boolean lib_dlb_init(void);
@@ -60,6 +74,13 @@ static int lib_dlb_fseek(dlb *, long, int);
 static char *lib_dlb_fgets(char *, int, dlb *);
 static int lib_dlb_fgetc(dlb *);
 static long lib_dlb_ftell(dlb *);
+#ifdef DLB_PRELOAD
+static boolean preload_library(library * lp);
+static boolean mem_dlb_init(void);
+static int mem_dlb_fread(char *, int, int, dlb *);
+static char *mem_dlb_fgets(char *, int, dlb *);
+static int mem_dlb_fgetc(dlb *);
+#endif
 
 /* not static because shared with dlb_main.c */
 boolean open_library(const char *lib_name, library * lp);
@@ -152,9 +173,56 @@ readlibdir(library * lp)
     fseek(lp->fdata, 0L, SEEK_SET);     /* reset back to zero */
     lp->fmark = 0;
 
+    hashlibdir(lp);
+
     return TRUE;
 }
 
+/*
+ * Hash a file name.  This ignores case, so that names that FILENAME_CMP
+ * considers equal hash the same whether or not it's case sensitive.
+ */
+static unsigned long
+hash_filename(const char *name)
+{
+    unsigned long h = 5381;
+
+    while (*name)
+        h = h * 33 + tolower((unsigned char)*name++);
+    return h;
+}
+
+/*
+ * Build an open-addressed hash table of the directory, so that find_file
+ * doesn't have to compare the name against every entry.  Entries are
+ * inserted in directory order, so if a name appears twice, the first
+ * entry is the one found, as with a linear search.
+ */
+static void
+hashlibdir(library * lp)
+{
+    long i, slot;
+
+    for (lp->hashsize = 16; lp->hashsize < lp->nentries * 2;
+         lp->hashsize *= 2) {}
+
+    lp->hashtab = malloc(lp->hashsize * sizeof (long));
+    if (!lp->hashtab) {
+        /* find_file falls back to searching the directory in order */
+        lp->hashsize = 0;
+        return;
+    }
+    for (i = 0; i < lp->hashsize; i++)
+        lp->hashtab[i] = -1;
+
+    for (i = 0; i < lp->nentries; i++) {
+        slot = hash_filename(lp->dir[i].fname) & (lp->hashsize - 1);
+        while (lp->hashtab[slot] >= 0)
+            slot = (slot + 1) & (lp->hashsize - 1);
+        lp->hashtab[slot] = i;
+    }
+}
+
 /*
  * Look for the file in our directory structure.  Return 1 if successful,
  * 0 if not found.  Fill in the size and starting position.
@@ -162,12 +230,26 @@ readlibdir(library * lp)
 static boolean
 find_file(const char *name, library ** lib, long *startp, long *sizep)
 {
-    int i, j;
+    int i;
+    long j, slot;
     library *lp;
 
     for (i = 0; i < MAX_LIBS && dlb_libs[i].fdata; i++) {
         lp = &dlb_libs[i];
-        for (j = 0; j < lp->nentries; j++) {
+        if (!lp->hashtab) {
+            for (j = 0; j < lp->nentries; j++) {
+                if (FILENAME_CMP(name, lp->dir[j].fname) == 0) {
+                    *lib = lp;
+                    *startp = lp->dir[j].foffset;
+                    *sizep = lp->dir[j].fsize;
+                    return TRUE;
+                }
+            }
+            continue;
+        }
+        for (slot = hash_filename(name) & (lp->hashsize - 1);
+             (j = lp->hashtab[slot]) >= 0;
+             slot = (slot + 1) & (lp->hashsize - 1)) {
             if (FILENAME_CMP(name, lp->dir[j].fname) == 0) {
                 *lib = lp;
                 *startp = lp->dir[j].foffset;
@@ -190,6 +272,9 @@ open_library(const char *lib_name, library * lp)
 {
     boolean status = FALSE;
 
+    lp->hashtab = NULL;
+    lp->fmem = NULL;
+    lp->fmapsize = 0;
     lp->fdata = fopen_datafile(lib_name, RDBMODE, DATAPREFIX);
     if (lp->fdata) {
         if (readlibdir(lp)) {
@@ -208,6 +293,13 @@ close_library(library * lp)
     fclose(lp->fdata);
     free(lp->dir);
     free(lp->sspace);
+    free(lp->hashtab);
+#ifdef UNIX
+    if (lp->fmapsize)
+        munmap((void *)lp->fmem, lp->fmapsize);
+    else
+#endif
+        free((void *)lp->fmem);
 
     memset((char *)lp, 0, sizeof (library));
 }
@@ -382,6 +474,153 @@ const dlb_procs_t lib_dlb_procs = {
     lib_dlb_ftell
 };
 
+#ifdef DLB_PRELOAD
+/*
+ * Map or read the whole of a library into memory.  Return TRUE if
+ * successful, FALSE otherwise (in which case the library is left as it
+ * was).
+ */
+static boolean
+preload_library(library * lp)
+{
+    const libdir *last;
+    long size;
+    char *buf;
+
+    /* An empty library has nothing that could be read from it. */
+    if (lp->nentries <= 0)
+        return TRUE;
+    last = &lp->dir[lp->nentries - 1];
+    size = last->foffset + last->fsize;
+
+#ifdef UNIX
+    {
+        struct stat st;
+        void *map;
+
+        /* A mapping past the end of the file would fault when read, so
+           check the file is as long as its directory says. */
+        if (fstat(fileno(lp->fdata), &st) == 0 && st.st_size >= size &&
+            (map = mmap(NULL, size, PROT_READ, MAP_PRIVATE,
+                        fileno(lp->fdata), 0)) != MAP_FAILED) {
+            lp->fmem = map;
+            lp->fmapsize = size;
+            return TRUE;
+        }
+    }
+#endif
+
+    buf = malloc(size);
+    if (!buf)
+        return FALSE;
+
+    if (fseek(lp->fdata, 0L, SEEK_SET) != 0 ||
+        fread(buf, 1, size, lp->fdata) != (size_t)size) {
+        free(buf);
+        return FALSE;
+    }
+    lp->fmem = buf;
+
+    fseek(lp->fdata, 0L, SEEK_SET);
+    lp->fmark = 0;
+    return TRUE;
+}
+
+static boolean
+mem_dlb_init(void)
+{
+    int i;
+
+    if (!lib_dlb_init())
+        return FALSE;
+
+    for (i = 0; i < MAX_LIBS && dlb_libs[i].fdata; i++) {
+        if (!preload_library(&dlb_libs[i])) {
+            lib_dlb_cleanup();
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * The in-memory readers.  Opening, closing, seeking and telling only ever
+ * deal with the handle, so those are shared with the stdio implementation.
+ */
+static int
+mem_dlb_fread(char *buf, int size, int quan, dlb * dp)
+{
+    /* make sure we don't read into the next file */
+    if ((dp->size - dp->mark) < (size * quan))
+        quan = (dp->size - dp->mark) / size;
+    if (quan == 0)
+        return 0;
+
+    memcpy(buf, dp->lib->fmem + dp->start + dp->mark, size * quan);
+    dp->mark += size * quan;
+
+    return quan;
+}
+
+static char *
+mem_dlb_fgets(char *buf, int len, dlb * dp)
+{
+    const char *p, *nl;
+    long n;
+
+    if (len <= 0)
+        return buf;     /* sanity check */
+
+    /* return NULL on EOF */
+    if (dp->mark >= dp->size)
+        return NULL;
+
+    p = dp->lib->fmem + dp->start + dp->mark;
+    n = dp->size - dp->mark;
+    if (n > len - 1)
+        n = len - 1;    /* save room for null */
+    if ((nl = memchr(p, '\n', n)) != 0)
+        n = nl - p + 1;
+
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    dp->mark += n;
+
+#if defined(WIN32)
+    {
+        char *bp;
+
+        if ((bp = strchr(buf, '\r')) != 0) {
+            *bp++ = '\n';
+            *bp = '\0';
+        }
+    }
+#endif
+
+    return buf;
+}
+
+static int
+mem_dlb_fgetc(dlb * dp)
+{
+    if (dp->mark >= dp->size)
+        return EOF;
+    return (int)dp->lib->fmem[dp->start + dp->mark++];
+}
+
+const dlb_procs_t mem_dlb_procs = {
+    mem_dlb_init,
+    lib_dlb_cleanup,
+    lib_dlb_fopen,
+    lib_dlb_fclose,
+    mem_dlb_fread,
+    lib_dlb_fseek,
+    mem_dlb_fgets,
+    mem_dlb_fgetc,
+    lib_dlb_ftell
+};
+#endif
+
 /* Global wrapper functions ------------------------------------------------ */
 
 #define do_dlb_init (*dlb_procs->dlb_init_proc)
@@ -401,6 +640,14 @@ boolean
 dlb_init(void)
 {
     if (!dlb_initialized) {
+#ifdef DLB_PRELOAD
+        /* If the library can't be preloaded (e.g. we're out of memory), it
+           can still be read as needed. */
+        dlb_procs = &mem_dlb_procs;
+        dlb_initialized = do_dlb_init();
+        if (dlb_initialized)
+            return TRUE;
+#endif
         dlb_procs = &lib_dlb_procs;
         if (dlb_procs)
             dlb_initialized = do_dlb_init();
@@ -507,5 +754,18 @@ dlb_ftell(dlb * dp)
     return do_dlb_ftell(dp);
 }
 
+/*
+ * Return a pointer to the whole contents of an open file, if they're
+ * already in memory (i.e. it's in a preloaded library), so that callers
+ * can parse it without copying it; or NULL if it would have to be read.
+ */
+const char *
+dlb_fmem(dlb * dp)
+{
+    if (!dlb_initialized || dp->fp || !dp->lib->fmem)
+        return NULL;
+    return dp->lib->fmem + dp->start;
+}
+
 /*dlb.c*/
 
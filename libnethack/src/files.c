@@ -346,5 +346,71 @@ paniclog(const char *type,      /* panic, impossible, trickery */
 
 /* ----------  END PANIC/IMPOSSIBLE LOG ----------- */
 
+/* ----------  BEGIN STARTUP TRACE ----------- */
+
+/* If NH4STARTUPTRACE names a file, creating or loading a game appends a line
+   to it for each phase of startup, giving the time taken by that phase and
+   the time since startup began. Game processes started by the server inherit
+   its environment, so this works for server games too; each line starts with
+   the process ID to tell concurrent games apart. */
+static FILE *trace_file;
+static microseconds trace_start, trace_last;
+
+static int
+trace_pid(void)
+{
+#if defined(WIN32)
+    return (int)GetCurrentProcessId();
+#else
+    return (int)getpid();
+#endif
+}
+
+void
+startup_trace_begin(const char *what)
+{
+    const char *fname;
+
+    startup_trace_end();
+
+    fname = nh_getenv("NH4STARTUPTRACE");
+    if (!fname || !*fname)
+        return;
+    trace_file = fopen(fname, "a");
+    if (!trace_file)
+        return;
+
+    trace_start = trace_last = utc_time();
+    fprintf(trace_file, "%d %s: begin\n", trace_pid(), what);
+}
+
+void
+startup_trace(const char *phase)
+{
+    microseconds now;
+
+    if (!trace_file)
+        return;
+
+    now = utc_time();
+    fprintf(trace_file, "%d   %-20s %8lld us %8lld us\n", trace_pid(), phase,
+            (long long)(now - trace_last), (long long)(now - trace_start));
+    trace_last = now;
+}
+
+void
+startup_trace_end(void)
+{
+    if (!trace_file)
+        return;
+
+    fprintf(trace_file, "%d end: %lld us\n", trace_pid(),
+            (long long)(utc_time() - trace_start));
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+/* ----------  END STARTUP TRACE ----------- */
+
 /*files.c*/
 
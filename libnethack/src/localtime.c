@@ -64,6 +64,12 @@ utc_time(void)
 microseconds
 time_for_time_line(void)
 {
+#ifdef DEBUG_FIXED_GAMES
+    /* When nh_create_game fixed the birthday, the in-game clock stands still
+       at it, so that games don't depend on when or how fast they're played. */
+    if (nh_getenv("NH4BIRTHDAY"))
+        return flags.turntime;
+#endif
     return utc_time() + ((microseconds)flags.timezone * 1000000LL);
 }
 
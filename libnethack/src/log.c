@@ -13,16 +13,32 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <errno.h>
+#include <ctype.h>
+
+#ifdef UNIX
+# include <sys/mman.h>
+#endif
 
 /* #define DEBUG */
 
 #define MENU_ID_OFFSET 4
 
+/* The defaults for the save backup cadence; see nh_set_backup_cadence(). */
+#define DEFAULT_BACKUP_DIFF_PERCENT 400
+#define DEFAULT_BACKUP_MAX_DIFFS    250
+
+static int backup_diff_percent = DEFAULT_BACKUP_DIFF_PERCENT;
+static int backup_max_diffs = DEFAULT_BACKUP_MAX_DIFFS;
+
 static void log_reset(void);
+static void log_unmap(void);
 static void log_binary(const char *buf, int buflen);
 static long get_log_offset(void);
 static long get_log_last_newline(void);
 static void load_gamestate_from_binary_save(boolean maybe_old_version);
+static const char *decode_save_span(const char *s, long len,
+                                    const struct memfile *base,
+                                    struct memfile *mf);
 
 static boolean full_read(int fd, void *buffer, int len);
 static boolean full_write(int fd, const void *buffer, int len);
@@ -152,7 +168,9 @@ log_recover(long offset)
             terminate(ERR_RESTORE_FAILED);
         }
 
-        /* Truncate the file. */
+        /* Truncate the file. The mapping has to go first, because it would
+           otherwise extend past the end of the file. */
+        log_unmap();
         if (ftruncate(program_state.logfile, offset) < 0) {
             raw_printf("Could not truncate save file during recovery!\n");
             terminate(ERR_RESTORE_FAILED);
@@ -214,20 +232,26 @@ static const char b64d[256] = {
     41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51
 };
 
-static int
+/* The base 64 functions don't need a game to be loaded, so offline tools that
+   read or write save files can use them too. */
+int
 base64size(int n)
 {
     return compressBound(n) * 4 / 3 + 4 + 12;   /* 12 for $4294967296$ */
 }
 
-static void
+void
 base64_encode_binary(const unsigned char *in, char *out, int len)
 {
     int i, pos, rem;
     unsigned long olen = compressBound(len);
     unsigned char *o = malloc(olen);
 
-    if (compress2(o, &olen, in, len, Z_BEST_COMPRESSION) != Z_OK) {
+    /* The fastest level makes save logs about 3% larger than the best one
+       does, but it is five times faster at compressing the initial save
+       backup, which otherwise takes most of the time needed to create a
+       game. */
+    if (compress2(o, &olen, in, len, Z_BEST_SPEED) != Z_OK) {
         panic("Could not compress input data!");
     }
 
@@ -270,23 +294,39 @@ base64_encode(const char *in, char *out)
     base64_encode_binary((const unsigned char *)in, out, strlen(in));
 }
 
+/* Returns the decoded size of the len bytes of base 64 data at in. */
 static int
-base64_strlen(const char *in)
+base64_strlen(const char *in, int len)
 {
     /* If the input is uncompressed, just return its size. If it's compressed,
        read the size from the header. */
-    if (*in != '$')
-        return strlen(in);
+    if (!len || *in != '$')
+        return len;
     return atoi(in + 1);
 }
 
-/* TODO: This should be communicating the end position of the base 64 data. */
-static void
-base64_decode(const char *in, char *out, int outlen)
+/* Decodes the len bytes of base 64 data (which may be compressed) at in into
+   out, which has room for outlen bytes. The data needn't be NUL-terminated, so
+   it can be decoded straight out of the mapped log; nothing past in[len - 1]
+   is read. Returns NULL on success, or a description of the problem if the
+   data was malformed.
+
+   TODO: This should be communicating the end position of the base 64 data. */
+static const char *
+base64_decode_span(const char *in, int len, char *out, int outlen)
 {
-    int i, len = strlen(in), pos = 0, olen;
+    int i, pos = 0, olen;
     char *o = out;
 
+    /* The characters of in, with NULs after the end. */
+#define IN(n) ((n) < len ? in[(n)] : '\0')
+
+    if (!len) {
+        if (outlen > 0)
+            *out = 0;
+        return NULL;
+    }
+
     olen = outlen;
     if (*in == '$') {
         o = malloc(len);
@@ -298,52 +338,74 @@ base64_decode(const char *in, char *out, int outlen)
         /* skip data between $ signs, it's used for the header for compressed
            binary data */
         if (in[i] == '$')
-            for (i += 2; in[i - 1] != '$' && in[i]; i++) {}
+            for (i += 2; IN(i - 1) != '$' && IN(i); i++) {}
 
         /* decode blocks; padding '=' are converted to 0 in the decoding table
            */
         if (pos < olen)
-            o[pos] = b64d[(int)in[i]] << 2 | b64d[(int)in[i + 1]] >> 4;
+            o[pos] = b64d[(int)IN(i)] << 2 | b64d[(int)IN(i + 1)] >> 4;
         if (pos + 1 < olen)
-            o[pos + 1] = b64d[(int)in[i + 1]] << 4 | b64d[(int)in[i + 2]] >> 2;
+            o[pos + 1] = b64d[(int)IN(i + 1)] << 4 | b64d[(int)IN(i + 2)] >> 2;
         if (pos + 2 < olen)
             o[pos + 2] =
-                ((b64d[(int)in[i + 2]] << 6) & 0xc0) | b64d[(int)in[i + 3]];
+                ((b64d[(int)IN(i + 2)] << 6) & 0xc0) | b64d[(int)IN(i + 3)];
         pos += 3;
 
     }
 
     i -= 4;
-    if ((in[i + 2] == '=' || !in[i + 2]) && (in[i + 3] == '=' || !in[i + 3]))
+    if ((IN(i + 2) == '=' || !IN(i + 2)) && (IN(i + 3) == '=' || !IN(i + 3)))
         pos--;
-    if ((in[i + 1] == '=' || !in[i + 2]) && (in[i + 2] == '=' || !in[i + 3]))
+    if ((IN(i + 1) == '=' || !IN(i + 2)) && (IN(i + 2) == '=' || !IN(i + 3)))
         pos--;
+#undef IN
 
     if (pos < olen)
         o[pos] = 0;
-    else
-        error_reading_save("Uncompressed base64 data was too long at %ld\n");
+    else {
+        if (o != out)
+            free(o);
+        return "Uncompressed base64 data was too long";
+    }
 
     if (*in == '$') {
 
-        unsigned long blen = base64_strlen(in);
+        unsigned long blen = base64_strlen(in, len);
         if (blen > outlen) {
             free(o);
-            error_reading_save("Compressed base64 data was too long at %ld\n");
+            return "Compressed base64 data was too long";
         }
         int errcode = uncompress((unsigned char *)out, &blen,
                                  (unsigned char *)o, pos);
 
         free(o);
-        if (errcode != Z_OK) {
-            raw_printf("Decompressing save file failed at %ld: %s\n",
-                       get_log_offset(),
-                       errcode == Z_MEM_ERROR ? "Out of memory" : errcode ==
-                       Z_BUF_ERROR ? "Invalid size" : errcode ==
-                       Z_DATA_ERROR ? "Corrupted file" : "(unknown error)");
-            error_reading_save("");
-        }
+        if (errcode != Z_OK)
+            return errcode == Z_MEM_ERROR ?
+                "Decompressing save file failed (out of memory)" :
+                errcode == Z_BUF_ERROR ?
+                "Decompressing save file failed (invalid size)" :
+                errcode == Z_DATA_ERROR ?
+                "Decompressing save file failed (corrupted file)" :
+                "Decompressing save file failed (unknown error)";
     }
+
+    return NULL;
+}
+
+/* Decodes NUL-terminated base 64 data; see base64_decode_span. */
+const char *
+base64_decode_data(const char *in, char *out, int outlen)
+{
+    return base64_decode_span(in, strlen(in), out, outlen);
+}
+
+static void
+base64_decode(const char *in, char *out, int outlen)
+{
+    const char *err = base64_decode_data(in, out, outlen);
+
+    if (err)
+        error_reading_save(msgprintf("%s at %%ld\n", err));
 }
 
 /***** Log I/O *****/
@@ -443,12 +505,106 @@ log_binary(const char *buf, int buflen)
     free(b64buf);
 }
 
-/* Reads a line starting from the current file pointer. Returns NULL if the line
-   is incomplete or spos is past EOF, otherwise mallocs enough space for the
-   line and returns it. The file pointer is left at the newline, or in an
-   unpredictable location in case of error. */
+/* Reading the log a line at a time via read() means several system calls per
+   line (we don't know how long the line is in advance), which adds up when
+   loading a long game has to skip past thousands of input lines to get from
+   one save diff to the next. So where the OS allows it, we also map the log
+   into memory, and read lines from there when they lie entirely within the
+   mapping.
+
+   The log is append-only apart from the header fields, which we only ever
+   change via write() (and a shared mapping sees such changes), and truncation,
+   which needs a write lock and thus can't happen while we hold our read lock
+   other than in log_recover() (which unmaps first). So the mapping stays valid
+   for as long as the file is open. Anything appended after the mapping was
+   made, whether by this process or another, is read via read() instead; we
+   remap once there's enough of that to be worth it. The file's size is only
+   checked again once we read past the end it had last time, so reading lines
+   that aren't worth remapping for costs no extra system calls. */
+#define LOG_REMAP_THRESHOLD 65536
+
+static void
+log_unmap(void)
+{
+#ifdef UNIX
+    if (program_state.logmap)
+        munmap((void *)program_state.logmap, program_state.logmap_len);
+#endif
+    program_state.logmap = NULL;
+    program_state.logmap_len = 0;
+    program_state.logmap_seen = 0;
+}
+
+/* Returns a pointer to the mapped copy of the log at the given offset, and sets
+   *avail to the number of bytes that can be read from there; or returns NULL
+   if that part of the log isn't mapped. */
+static const char *
+log_mapped_at(long offset, long *avail)
+{
+#ifdef UNIX
+    struct stat st;
+    void *map;
+
+    if (program_state.logmap_allowed &&
+        offset >= program_state.logmap_seen &&
+        fstat(program_state.logfile, &st) == 0) {
+
+        program_state.logmap_seen = st.st_size;
+
+        /* The first mapping is made whatever the size of the log. */
+        if (st.st_size > program_state.logmap_len &&
+            (!program_state.logmap ||
+             st.st_size - program_state.logmap_len >= LOG_REMAP_THRESHOLD)) {
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+                       program_state.logfile, 0);
+            if (map != MAP_FAILED) {
+                log_unmap();
+                program_state.logmap = map;
+                program_state.logmap_len = st.st_size;
+                program_state.logmap_seen = st.st_size;
+            }
+        }
+    }
+#endif
+
+    if (offset < 0 || offset >= program_state.logmap_len)
+        return NULL;
+
+    *avail = program_state.logmap_len - offset;
+    return program_state.logmap + offset;
+}
+
+/* Finds the line starting at the current file pointer in the mapped log, and
+   if it's there in its entirety, moves the file pointer past it and returns its
+   start, setting *len to its length (excluding the newline). Otherwise, returns
+   NULL, leaving the file pointer alone. */
+static const char *
+lmapline(int fd, long *len)
+{
+    long o, avail;
+    const char *line, *nl;
+
+    if (!program_state.logmap_allowed || fd != program_state.logfile)
+        return NULL;
+
+    o = lseek(fd, 0, SEEK_CUR);
+    line = log_mapped_at(o, &avail);
+    if (!line)
+        return NULL;
+
+    nl = memchr(line, '\n', avail);
+    if (!nl)
+        return NULL;
+
+    *len = nl - line;
+    lseek(fd, o + *len + 1, SEEK_SET);
+    return line;
+}
+
+/* Reads a line starting from the current file pointer with read(), for
+   lgetline_malloc and lgetline_span. */
 static char *
-lgetline_malloc(int fd)
+lreadline_malloc(int fd)
 {
     char *inbuf = NULL;
     long inbuflen = 0;  /* number of bytes read */
@@ -519,6 +675,72 @@ lgetline_malloc(int fd)
     return inbuf;
 }
 
+/* Reads a line starting from the current file pointer. Returns NULL if the line
+   is incomplete or spos is past EOF, otherwise mallocs enough space for the
+   line and returns it. The file pointer is left at the newline, or in an
+   unpredictable location in case of error. */
+static char *
+lgetline_malloc(int fd)
+{
+    char *inbuf;
+    long inbuflen;
+    const char *mapped;
+
+    mapped = lmapline(fd, &inbuflen);
+    if (!mapped)
+        return lreadline_malloc(fd);
+
+    inbuf = malloc(inbuflen + 1);
+    if (!inbuf)
+        panic("Out of memory in lgetline_malloc");
+    memcpy(inbuf, mapped, inbuflen);
+    inbuf[inbuflen] = '\0';
+    return inbuf;
+}
+
+/* Like lgetline_malloc, but the line is only copied if it isn't mapped: this
+   returns the line's start and sets *len to its length, and the line isn't
+   NUL-terminated. *copy is set to the memory the caller has to free once it's
+   done with the line (NULL if the line was mapped). Use this for save backups
+   and save diffs, which are long, and are decoded straight from the line. */
+static const char *
+lgetline_span(int fd, long *len, char **copy)
+{
+    const char *mapped = lmapline(fd, len);
+
+    *copy = NULL;
+    if (mapped)
+        return mapped;
+
+    *copy = lreadline_malloc(fd);
+    if (*copy)
+        *len = strlen(*copy);
+    return *copy;
+}
+
+
+/* Moves the file pointer past the line that starts at it, returning the line's
+   first character (or '\0' if it's empty), or EOF if lgetline_malloc would
+   have returned NULL. This avoids copying the line if it's mapped, so use it
+   for lines that only need skipping or classifying. */
+static int
+lskipline(int fd)
+{
+    long len;
+    const char *mapped = lmapline(fd, &len);
+    char *line;
+    int rv;
+
+    if (mapped)
+        return len ? (unsigned char)*mapped : '\0';
+
+    line = lreadline_malloc(fd);
+    if (!line)
+        return EOF;
+    rv = (unsigned char)*line;
+    free(line);
+    return rv;
+}
 
 /* Returns the offset to the current file pointer in the log. */
 static long
@@ -572,7 +794,6 @@ get_log_start_of_turn_offset(void)
 {
     long o = get_log_offset();
     long rv;
-    void *save_diff_line;
 
     lseek(program_state.logfile, program_state.binary_save_location, SEEK_SET);
 
@@ -581,13 +802,9 @@ get_log_start_of_turn_offset(void)
        may as well handle it just in case it isn't), we treat it the same way as
        an incomplete line. */
 
-    save_diff_line = lgetline_malloc(program_state.logfile);
-
-    if (!save_diff_line)
+    if (lskipline(program_state.logfile) == EOF)
         log_recover(get_log_last_newline());
 
-    free(save_diff_line);
-
     /* Now return the offset we found, taking care to restore the file
        pointer. */
     rv = get_log_offset();
@@ -778,6 +995,10 @@ log_backup_save(void)
     log_binary(program_state.binary_save.buf, program_state.binary_save.pos);
     lprintf("\x0a");
 
+    program_state.save_backup_bytes = get_log_offset() - o;
+    program_state.save_diff_bytes = 0;
+    program_state.save_diff_count = 0;
+
     /* Record the location of this save backup in the appropriate place. */
     lseek(program_state.logfile, is_newgame ? o + 1 :
           program_state.last_save_backup_location_location, SEEK_SET);
@@ -797,11 +1018,16 @@ log_neutral_turnstate(void)
     if (program_state.logfile == -1)
         panic("log_neutral_turnstate called with no logfile");
 
-    /* A heuristic to work out whether to use a save diff or save backup
-       line. */
-    if (program_state.binary_save.pos <
-        (program_state.gamestate_location -
-         program_state.save_backup_location) / 2 || !program_state.ok_to_diff)
+    /* Save diffs are small, but loading the game means applying every diff
+       since the last save backup, each of which costs about as much as copying
+       the binary save. So we write a save backup instead once the diffs since
+       the last one are large compared to it (bounding the proportion of the
+       file made of save backups), or numerous (bounding the time log_sync()
+       spends applying them). */
+    if (!program_state.ok_to_diff ||
+        program_state.save_diff_count >= backup_max_diffs ||
+        program_state.save_diff_bytes * 100 >=
+        program_state.save_backup_bytes * backup_diff_percent)
 
         log_backup_save();
 
@@ -831,6 +1057,10 @@ log_neutral_turnstate(void)
                    program_state.binary_save.diffpos);
         lprintf("\x0a");
 
+        program_state.save_diff_bytes +=
+            get_log_offset() - program_state.binary_save_location;
+        program_state.save_diff_count++;
+
         /* Make the new binary save absolute rather than relative, so that
            we can free the old one. */
         program_state.binary_save.relativeto = NULL;
@@ -1124,7 +1354,7 @@ log_replay_bones(struct memfile *mf)
     if (!logline)
         return FALSE;
 
-    mf->len = base64_strlen(logline + 1);
+    mf->len = base64_strlen(logline + 1, strlen(logline + 1));
     mf->buf = malloc(mf->len);
     base64_decode(logline + 1, mf->buf, mf->len);
 
@@ -1405,77 +1635,89 @@ log_replay_no_more_options(void)
 }
 
 
-/* Code common to nh_get_savegame_status and log loading */
-static enum nh_log_status
-read_log_header(int fd, struct nh_game_info *si,
-                int *recovery_count, boolean do_locking)
+/* Parses the three header lines at the start of a log (without their
+   newlines). Like decode_save_line, this doesn't need a game to be loaded. */
+enum nh_log_status
+parse_log_header(char *const *lines, struct nh_game_info *si,
+                 int *recovery_count)
 {
-    char *logline, *p;
+    const char *p;
     char namebuf[65]; /* matches %64s later */
     char statusbuf[STATUS_LEN + 1];
     int playmode, version_major, version_minor, version_patchlevel;
     enum nh_log_status result;
 
-    if (do_locking && !change_fd_lock(fd, LT_READ, 1))
-        return LS_IN_PROGRESS;
-
-    lseek(fd, 0, SEEK_SET);
-    logline = lgetline_malloc(fd);
-    if (!logline)
-        goto invalid_log;
-
-    if (sscanf(logline, "NHGAME %" STATUS_LEN_STR "s %8x %d.%3d.%3d", statusbuf,
-               recovery_count, &version_major, &version_minor,
+    if (sscanf(lines[0], "NHGAME %" STATUS_LEN_STR "s %8x %d.%3d.%3d",
+               statusbuf, recovery_count, &version_major, &version_minor,
                &version_patchlevel) != 5)
-        goto invalid_logline;
-
-    free(logline);
+        return LS_INVALID;
 
     if ((result = status_from_string(statusbuf)) == LS_INVALID)
-        goto invalid_log;
-
-    logline = lgetline_malloc(fd);
-    if (!logline)
-        goto invalid_log;
+        return LS_INVALID;
 
-    if (strlen(logline) != SECOND_LOGLINE_LEN)
-        goto invalid_logline;
+    if (strlen(lines[1]) != SECOND_LOGLINE_LEN)
+        return LS_INVALID;
 
-    p = logline;
+    p = lines[1];
     while (*p == ' ')
         p++;
     strcpy(si->game_state, p);
 
-    free(logline);
-
-    logline = lgetline_malloc(fd);
-    if (!logline)
-        goto invalid_log;
-
     /* The numbers here are chosen to avoid overflow and underflow; the intended
        max lengths are (32 * 4 / 3) and 3, and the buffers that are eventually
        stored into are 32 and 16. Thus the temporary buffer in the case of
        namebuf. */
-    if (sscanf(logline, "%*x %*x %d %64s %6s %6s %6s %6s",
+    if (sscanf(lines[2], "%*x %*x %d %64s %6s %6s %6s %6s",
                &playmode, namebuf, si->plrole, si->plrace,
                si->plgend, si->plalign) != 6)
-        goto invalid_logline;
-
-    free(logline);
+        return LS_INVALID;
 
     si->playmode = playmode;
-    base64_decode(namebuf, si->name, sizeof (si->name));
+    if (base64_decode_data(namebuf, si->name, sizeof (si->name)))
+        return LS_INVALID;
 
-    if (do_locking)
-        change_fd_lock(fd, LT_NONE, 0);
     return result;
+}
+
+/* Code common to nh_get_savegame_status and log loading */
+static enum nh_log_status
+read_log_header(int fd, struct nh_game_info *si,
+                int *recovery_count, boolean do_locking)
+{
+    char *lines[3];
+    int i, n;
+    enum nh_log_status result = LS_INVALID;
+
+    if (do_locking && !change_fd_lock(fd, LT_READ, 1))
+        return LS_IN_PROGRESS;
+
+    lseek(fd, 0, SEEK_SET);
+    for (n = 0; n < 3; n++)
+        if (!(lines[n] = lgetline_malloc(fd)))
+            break;
+
+    if (n == 3)
+        result = parse_log_header(lines, si, recovery_count);
+
+    for (i = 0; i < n; i++)
+        free(lines[i]);
 
-invalid_logline:
-    free(logline);
-invalid_log:
     if (do_locking)
         change_fd_lock(fd, LT_NONE, 0);
-    return LS_INVALID;
+    return result;
+}
+
+/* Sets how often save backups are written in place of save diffs: whenever
+   the save diffs since the last save backup add up to more than diff_percent
+   percent of its size, or there are max_diffs of them. A value of 0 restores
+   the default for that setting. Applies to games played afterwards in this
+   process. */
+void
+nh_set_backup_cadence(int diff_percent, int max_diffs)
+{
+    backup_diff_percent = diff_percent > 0 ? diff_percent :
+        DEFAULT_BACKUP_DIFF_PERCENT;
+    backup_max_diffs = max_diffs > 0 ? max_diffs : DEFAULT_BACKUP_MAX_DIFFS;
 }
 
 enum nh_log_status
@@ -1513,7 +1755,7 @@ load_gamestate_from_binary_save(boolean maybe_old_version)
     program_state.gamestate_location = program_state.binary_save_location;
     lseek(program_state.logfile, program_state.binary_save_location,
           SEEK_SET);
-    free(lgetline_malloc(program_state.logfile));
+    lskipline(program_state.logfile);
     program_state.end_of_gamestate_location = get_log_offset();
 
     freedynamicdata();
@@ -1540,20 +1782,72 @@ load_gamestate_from_binary_save(boolean maybe_old_version)
     program_state.ok_to_diff = TRUE;
 }
 
+/* Decodes a save backup or save diff line into mf, a newly created memfile
+   that isn't relative to anything; a save diff is applied to base (which is
+   ignored for a save backup). Returns NULL on success, or a description of the
+   problem if the line was malformed; either way, the caller must free mf
+   afterwards. This doesn't need a game to be loaded, so offline tools that read
+   save files can use it too. */
+const char *
+decode_save_line(const char *s, const struct memfile *base, struct memfile *mf)
+{
+    return decode_save_span(s, strlen(s), base, mf);
+}
+
+/* Like decode_save_line, for a line of len bytes that needn't be
+   NUL-terminated. */
+static const char *
+decode_save_span(const char *s, long len, const struct memfile *base,
+                 struct memfile *mf)
+{
+    const char *err;
+    char *buf;
+    int i, buflen;
+
+    if (len && *s == '*') {
+        /* The header is '*', an 8 digit hex number, and ' ', = 10 bytes. */
+        if (len < 10)
+            return "save backup has a malformed location";
+        for (i = 1; i < 9; i++)
+            if (!isxdigit((unsigned char)s[i]))
+                return "save backup has a malformed location";
+        if (s[9] != ' ')
+            return "save backup has a malformed location";
+        s += 10;
+        len -= 10;
+
+        buflen = base64_strlen(s, len);
+        buf = mmmap(mf, buflen, 0);
+        return base64_decode_span(s, len, buf, buflen);
+    }
+
+    if (!len || *s != '~')
+        return "not a save backup or save diff";
+
+    /* The header of a save diff is one byte, '~'. */
+    s++;
+    len--;
+
+    /* The decoded diff can be shorter than buflen; the zeroes after it act as
+       an EOF marker. */
+    buflen = base64_strlen(s, len);
+    buf = calloc(buflen + 2, 1);
+    err = base64_decode_span(s, len, buf, buflen);
+    if (!err)
+        err = mdiffapply(mf, buf, buflen, base);
+
+    free(buf);
+    return err;
+}
+
 /* Decodes the given save diff into program_state.binary_save. The caller should
    check that the string actually is a representation of a save diff, is
    responsible for fixing the invariants on program_state, and must move the
-   binary save out of the way for safekeeping first.
-
-   TODO: Perhaps this function would make more sense in memfile.c (with a
-   slightly different calling convention), in case we need to apply diffs to
-   anything else. It's here because this is the only file that needs to be able
-   to apply diffs, for the time being. */
+   binary save out of the way for safekeeping first. */
 static void
-apply_save_diff(char *s, struct memfile *diff_base)
+apply_save_diff(const char *s, long len, struct memfile *diff_base)
 {
-    char *buf, *bufp, *mfp;
-    long buflen, dbpos = 0;
+    const char *err;
 
     if (program_state.binary_save_allocated)
         panic("The caller of apply_save_diff must back up and deallocate "
@@ -1562,104 +1856,40 @@ apply_save_diff(char *s, struct memfile *diff_base)
     mnew(&program_state.binary_save, NULL);
     program_state.binary_save_allocated = TRUE;
 
-    /* The header of a save diff is one byte, '~'. */
-    s++;
-
-    buflen = base64_strlen(s);
-    buf = malloc(buflen + 2);
-    memset(buf, 0, buflen + 2);
-    base64_decode(s, buf, buflen);
-
-    bufp = buf;
-    while (bufp[0] || bufp[1]) {
-        /* 0x0000 means "seek 0", which is never generated, and thus works as an
-           EOF marker */
-
-        signed short n = (unsigned char)(bufp[1]) & 0x3F;
-        n *= 256;
-        n += (unsigned char)(bufp[0]);
-
-        bufp += 2;
-
-        switch ((unsigned char)(bufp[-1]) >> 6) {
-        case MDIFF_SEEK:
-
-            if (n >= 0x2000)
-                n -= 0x4000;
-
-            if (dbpos < n) {
-                free(buf);
-                mfree(&program_state.binary_save);
-                error_reading_save("binary diff seeks past start of file\n");
-            }
-
-            dbpos -= n;
-
-            break;
-
-        case MDIFF_COPY:
-
-            mfp = mmmap(&program_state.binary_save, n,
-                        program_state.binary_save.pos);
-
-            if (dbpos + n > diff_base->pos) {
-                free(buf);
-                mfree(&program_state.binary_save);
-                error_reading_save("binary diff reads past EOF\n");
-            }
-
-            memcpy(mfp, diff_base->buf + dbpos, n);
-            dbpos += n;
-
-            break;
-
-        case MDIFF_EDIT:
-
-            mfp = mmmap(&program_state.binary_save, n,
-                        program_state.binary_save.pos);
-
-            if (bufp - buf + n > buflen) {
-                free(buf);
-                mfree(&program_state.binary_save);
-                error_reading_save("binary diff ends unexpectedly\n");
-            }
-
-            memcpy(mfp, bufp, n);
-            dbpos += n;     /* can legally go past the end of diff_base! */
-            bufp += n;
+    err = decode_save_span(s, len, diff_base, &program_state.binary_save);
+    if (err) {
+        mfree(&program_state.binary_save);
+        error_reading_save(msgprintf("%s\n", err));
+    }
+}
 
-            break;
+/* Decodes the save backup in the given string into a newly allocated memfile.
+   The caller should check that the string actually is a representation of a
+   save backup. */
+static void
+decode_save_backup(const char *s, long len, struct memfile *mf)
+{
+    const char *err;
 
-        default:
-            free(buf);
-            mfree(&program_state.binary_save);
-            error_reading_save("unknown command in binary diff\n");
-        }
+    mnew(mf, NULL);
+    err = decode_save_span(s, len, NULL, mf);
+    if (err) {
+        mfree(mf);
+        error_reading_save(msgprintf("%s\n", err));
     }
-
-    free(buf);
 }
 
 /* Decodes the given string into program_state.binary_save. The caller should
    check that the string actually is a representation of a save backup, and is
    responsible for fixing the invariants on program_state. */
 static void
-load_save_backup_from_string(char *s)
+load_save_backup_from_string(const char *s, long len)
 {
-    void *mp;
-    long len;
-
     if (program_state.binary_save_allocated)
         mfree(&program_state.binary_save);
-    mnew(&program_state.binary_save, NULL);
     program_state.binary_save_allocated = TRUE;
 
-    /* The header is '*', an 8 digit hex number, and ' ', = 10 bytes. */
-    s += 10;
-    len = base64_strlen(s);
-
-    mp = mmmap(&program_state.binary_save, len, 0);
-    base64_decode(s, mp, len);
+    decode_save_backup(s, len, &program_state.binary_save);
 }
 
 /* Sets the binary save and save backup locations from the argument (which
@@ -1670,18 +1900,25 @@ load_save_backup_from_string(char *s)
 static void
 load_save_backup_from_offset(long offset)
 {
-    char *logline;
+    const char *logline;
+    char *copy;
+    long len;
 
     program_state.binary_save_location = offset;
     program_state.save_backup_location = offset;
     lseek(program_state.logfile, offset, SEEK_SET);
 
-    logline = lgetline_malloc(program_state.logfile);
+    logline = lgetline_span(program_state.logfile, &len, &copy);
     if (!logline)
         error_reading_save("EOF when reading save backup\n");
 
-    load_save_backup_from_string(logline);
-    free(logline);
+    load_save_backup_from_string(logline, len);
+
+    program_state.save_backup_bytes = len + 1;
+    program_state.save_diff_bytes = 0;
+    program_state.save_diff_count = 0;
+
+    free(copy);
 }
 
 /* Checks to see if a save backup exists at a given file location. Returns -1 if
@@ -1691,16 +1928,18 @@ static long
 get_save_backup_offset(long offset)
 {
     long oldoffset = get_log_offset();
-    long rv = -1;
+    long rv = -1, avail;
     char sbbuf[11];
     long sbloc;
     char *sbptr;
-
-    if (lseek(program_state.logfile, offset, SEEK_SET) < 0)
-        goto cleanup;
+    const char *mapped;
 
     /* Read the save backup header. */
-    if (!full_read(program_state.logfile, sbbuf, 10))
+    mapped = log_mapped_at(offset, &avail);
+    if (mapped && avail >= 10)
+        memcpy(sbbuf, mapped, 10);
+    else if (lseek(program_state.logfile, offset, SEEK_SET) < 0 ||
+             !full_read(program_state.logfile, sbbuf, 10))
         goto cleanup;
     sbbuf[10] = '\0';
 
@@ -1764,6 +2003,138 @@ relative_to_target(long bsl)
     }
 }
 
+/* Builds program_state.backup_index by following the chain of save backups
+   backwards from the one at the given location, which should be the last save
+   backup in the file. If the chain turns out to be broken, the index contains
+   only the first save backup; log_sync() still works, just more slowly.
+   Returns FALSE, leaving no index, if memory runs out; the caller then has to
+   replay from a save backup in the usual way. */
+static boolean
+build_backup_index(long last)
+{
+    long first = program_state.last_save_backup_location_location - 1;
+    long loc, prev;
+    int count = 0, size = 16, i;
+    struct log_backup *index = malloc(size * sizeof *index), *newindex, temp;
+
+    free(program_state.backup_index);
+    program_state.backup_index = NULL;
+    program_state.backup_index_count = 0;
+    if (!index)
+        return FALSE;
+
+    for (loc = last; loc != first; loc = prev) {
+        prev = get_save_backup_offset(loc);
+        if (prev < first || prev >= loc) {
+            count = 0;
+            break;
+        }
+
+        if (count == size - 1) {
+            size *= 2;
+            newindex = realloc(index, size * sizeof *index);
+            if (!newindex) {
+                free(index);
+                return FALSE;
+            }
+            index = newindex;
+        }
+        index[count].location = loc;
+        index[count].turn = -1;
+        count++;
+    }
+
+    index[count].location = first;
+    index[count].turn = -1;
+    count++;
+
+    /* We found the backups in reverse order. */
+    for (i = 0; i < count / 2; i++) {
+        temp = index[i];
+        index[i] = index[count - 1 - i];
+        index[count - 1 - i] = temp;
+    }
+
+    program_state.backup_index = index;
+    program_state.backup_index_count = count;
+    return TRUE;
+}
+
+/* Returns the turn counter of the given entry of the backup index, reading it
+   from the save backup the first time it's needed. Leaves the log file pointer
+   in an unpredictable location. */
+static int
+backup_index_turn(int i)
+{
+    struct log_backup *b = program_state.backup_index + i;
+    struct memfile mf;
+    const char *logline;
+    char *copy;
+    long len;
+
+    if (b->turn >= 0)
+        return b->turn;
+
+    lseek(program_state.logfile, b->location, SEEK_SET);
+    logline = lgetline_span(program_state.logfile, &len, &copy);
+    if (!logline)
+        error_reading_save("EOF when reading save backup\n");
+
+    decode_save_backup(logline, len, &mf);
+    free(copy);
+
+    mf.pos = 0;
+    if (!uptodate(&mf, NULL)) {
+        mfree(&mf);
+        error_reading_save(
+            "binary save is from the wrong version of NetHack\n");
+    }
+    b->turn = mread32(&mf);
+    mfree(&mf);
+
+    return b->turn;
+}
+
+/* Returns the location of the latest save backup in the index from which
+   log_sync() can move forwards to the target without passing it (or the first
+   save backup, if there are none). This has to be the save backup that
+   following the chain of save backups would find, so that a replay shows the
+   same thing with or without the index. When moving backwards, the chain is
+   followed until a backup no later than the target, so for turn targets, a
+   backup from the target turn itself counts (if it isn't the first save of
+   that turn, log_sync() stops there anyway). When moving forwards, log_sync()
+   would stop at the first save of the target turn, so only backups from
+   strictly earlier turns can be jumped to. This is a binary search, so only a
+   few save backups need to be decoded to find their turn counters. */
+static long
+nearest_backup_before_target(boolean backwards)
+{
+    struct log_backup *index = program_state.backup_index;
+    long targetpos = program_state.target_location;
+    int lo = 0, hi = program_state.backup_index_count - 1, mid;
+    boolean before;
+
+    if (program_state.target_location_units == TLU_EOF)
+        return index[hi].location;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+
+        if (program_state.target_location_units == TLU_TURNS)
+            before = backwards ? backup_index_turn(mid) <= targetpos :
+                backup_index_turn(mid) < targetpos;
+        else
+            before = index[mid].location <= targetpos;
+
+        if (before)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return index[lo].location;
+}
+
 /*
  * Fastforwards/rewinds the gamestate to the target location.
  *
@@ -1810,8 +2181,11 @@ log_sync(void)
 {
     struct nh_game_info si;
     struct memfile bsave;
-    long sloc, loglineloc;
-    char *logline;
+    long sloc, loglineloc, len;
+    const char *logline;
+    char *copy;
+    int c;
+    enum nh_log_status status;
 
     /* If the file is newly loaded, fill the locations with correct values
        rather than zeroes. TODO: Perhaps we should also do this when seeking to
@@ -1820,9 +2194,11 @@ log_sync(void)
     if (program_state.binary_save_location == 0) {
         /* Check it's a valid save file; simultaneously, move the file
            pointer to the start of line 4 (the first save backup). */
-        if (read_log_header(program_state.logfile, &si,
-                            &program_state.expected_recovery_count,
-                            FALSE) != LS_SAVED)
+        status = read_log_header(program_state.logfile, &si,
+                                 &program_state.expected_recovery_count,
+                                 FALSE);
+        if (status != LS_SAVED &&
+            !(status == LS_DONE && program_state.viewing))
             error_reading_save(
                 "logfile has a bad header (is it from an old version?)\n");
 
@@ -1851,34 +2227,60 @@ log_sync(void)
         if (get_save_backup_offset(sloc) >= 0)
             program_state.save_backup_location = sloc;
 
-        /* Set the binary save and gamestate locations, also the actual
-           gamestate itself. Now all the log-related but gamestate-unrelated
-           fields of program_state have sensible values (target_location is set
-           by the caller, we set the save backup locations earlier, and this
-           handles the binary save). This does not set the gamestate. */
-        load_save_backup_from_offset(program_state.save_backup_location);
+        /* When viewing, we're likely to seek around the file a lot, so we
+           index the save backups instead of loading one now; the code below
+           loads the appropriate one. If the index can't be built, we load a
+           backup and replay from it, as when playing. */
+        if (!program_state.viewing ||
+            !build_backup_index(program_state.save_backup_location))
+            /* Set the binary save and gamestate locations, also the actual
+               gamestate itself. Now all the log-related but
+               gamestate-unrelated fields of program_state have sensible values
+               (target_location is set by the caller, we set the save backup
+               locations earlier, and this handles the binary save). This does
+               not set the gamestate. */
+            load_save_backup_from_offset(program_state.save_backup_location);
 
     } else if (program_state.gamestate_location !=
                program_state.binary_save_location)
         panic("log_sync called mid-turn");
 
-    /* If we're ahead of the target, move back to the last save backup (because
-       we can't run save diffs backwards, our only choice is to move forwards
-       from the save backup location). */
-    if (program_state.binary_save_location != program_state.save_backup_location
-        && relative_to_target(program_state.binary_save_location) > 0) {
+    if (program_state.backup_index) {
+
+        /* We can jump straight to the nearest save backup before the target.
+           When moving forwards, we keep our current location instead if it's
+           between that backup and the target, because it's at least as close.
+           This means that the number of save diffs we need to apply is bounded
+           by the number between two consecutive save backups, no matter how far
+           we seek. */
+        if (program_state.binary_save_location == 0 ||
+            relative_to_target(program_state.binary_save_location) > 0)
+            load_save_backup_from_offset(nearest_backup_before_target(TRUE));
+        else if ((sloc = nearest_backup_before_target(FALSE)) >
+                 program_state.binary_save_location)
+            load_save_backup_from_offset(sloc);
 
-        load_save_backup_from_offset(program_state.save_backup_location);
-    }
+    } else {
 
-    /* While we're still ahead of the target, try progressively earlier
-       backups. */
-    while (relative_to_target(program_state.binary_save_location) > 0 &&
-           program_state.save_backup_location >
-           program_state.last_save_backup_location_location) {
+        /* If we're ahead of the target, move back to the last save backup
+           (because we can't run save diffs backwards, our only choice is to
+           move forwards from the save backup location). */
+        if (program_state.binary_save_location !=
+            program_state.save_backup_location &&
+            relative_to_target(program_state.binary_save_location) > 0) {
 
-        sloc = get_save_backup_offset(program_state.save_backup_location);
-        load_save_backup_from_offset(sloc);
+            load_save_backup_from_offset(program_state.save_backup_location);
+        }
+
+        /* While we're still ahead of the target, try progressively earlier
+           backups. */
+        while (relative_to_target(program_state.binary_save_location) > 0 &&
+               program_state.save_backup_location >
+               program_state.last_save_backup_location_location) {
+
+            sloc = get_save_backup_offset(program_state.save_backup_location);
+            load_save_backup_from_offset(sloc);
+        }
     }
 
     /* If we're behind the target, move forwards until we're at or ahead of the
@@ -1892,16 +2294,20 @@ log_sync(void)
     while (relative_to_target(program_state.binary_save_location) < 0) {
         lseek(program_state.logfile, sloc, SEEK_SET);
         /* Skip the save diff or backup itself. */
-        free(lgetline_malloc(program_state.logfile));
-
-        /* Look for the next save diff or backup line. */
-        for ((loglineloc = get_log_offset()),
-                 (logline = lgetline_malloc(program_state.logfile));
-             logline;
-             free(logline), (loglineloc = get_log_offset()),
-                 (logline = lgetline_malloc(program_state.logfile))) {
-            if (*logline == '*' || *logline == '~')
-                break;
+        lskipline(program_state.logfile);
+
+        /* Look for the next save diff or backup line. Most lines are input,
+           so we only classify lines until we find it, then go back and read
+           it properly. */
+        do {
+            loglineloc = get_log_offset();
+            c = lskipline(program_state.logfile);
+        } while (c != EOF && c != '*' && c != '~');
+
+        logline = NULL;
+        if (c != EOF) {
+            lseek(program_state.logfile, loglineloc, SEEK_SET);
+            logline = lgetline_span(program_state.logfile, &len, &copy);
         }
 
         if (!logline) {
@@ -1920,10 +2326,10 @@ log_sync(void)
 
         if (*logline == '*') {
             /* This is a save backup. */
-            load_save_backup_from_string(logline);
+            load_save_backup_from_string(logline, len);
         } else if (*logline == '~') {
             /* This is a save diff. */
-            apply_save_diff(logline, &bsave);
+            apply_save_diff(logline, len, &bsave);
         }
 
         if (relative_to_target(loglineloc) > 0) {
@@ -1934,7 +2340,7 @@ log_sync(void)
             if (!program_state.binary_save_allocated) /* should never happen */
                 panic("overshoot in log_sync but no binary save present");
 
-            free(logline);
+            free(copy);
             mfree(&program_state.binary_save);
             program_state.binary_save = bsave;
 
@@ -1943,15 +2349,24 @@ log_sync(void)
 
         } else {
 
-            /* We didn't overshoot: set the locations to match this new save. */
+            /* We didn't overshoot: set the locations to match this new save,
+               and keep track of the diffs since the last backup, so that
+               log_neutral_turnstate() knows when the next one is due. */
             sloc = program_state.binary_save_location = loglineloc;
-            if (*logline == '*')
+            if (*logline == '*') {
                 program_state.save_backup_location = loglineloc;
+                program_state.save_backup_bytes = len + 1;
+                program_state.save_diff_bytes = 0;
+                program_state.save_diff_count = 0;
+            } else {
+                program_state.save_diff_bytes += len + 1;
+                program_state.save_diff_count++;
+            }
 
             mfree(&bsave);
         }
 
-        free(logline);
+        free(copy);
     }
 
     /* Fix the invariant on the gamestate. */
@@ -1975,6 +2390,12 @@ log_reset(void)
     program_state.target_location = 0;
     program_state.target_location_units = TLU_EOF;
     program_state.last_save_backup_location_location = 0;
+
+    free(program_state.backup_index);
+    program_state.backup_index = NULL;
+    program_state.backup_index_count = 0;
+
+    log_unmap();
 }
 
 void
@@ -1987,11 +2408,16 @@ log_init(int logfd)
     log_reset();
 
     program_state.logfile = logfd;
+    program_state.logmap_allowed = TRUE;
 }
 
 void
 log_uninit(void)
 {
+    /* The mapping relies on our lock to stop the file being truncated. */
+    log_unmap();
+    program_state.logmap_allowed = FALSE;
+
     if (program_state.logfile > -1)
         change_fd_lock(program_state.logfile, LT_NONE, 0);
 
@@ -2005,5 +2431,9 @@ log_uninit(void)
         mfree(&program_state.binary_save);
         program_state.binary_save_allocated = 0;
     }
+
+    free(program_state.backup_index);
+    program_state.backup_index = NULL;
+    program_state.backup_index_count = 0;
 }
 
@@ -310,6 +310,35 @@ mdiffflush(struct memfile *mf)
     mf->curcmd = MDIFF_INVALID;
 }
 
+/* Adds a seek command to a diff memfile, so that the next byte written is
+   compared against the byte at relativepos in relativeto. */
+static void
+mdiffseek(struct memfile *mf, int relativepos)
+{
+    int offset = mf->relativepos - relativepos;
+
+    if (!offset)
+        return;
+
+    if (mf->curcmd != MDIFF_SEEK) {
+        mdiffflush(mf);
+        mf->curcount = 0;
+    }
+    while (offset + mf->curcount >= 1 << 13 ||
+           offset + mf->curcount <= -(1 << 13)) {
+        if (offset + mf->curcount < 0) {
+            mdiffwrite14(mf, MDIFF_SEEK, -0x1fff);
+            offset += 0x1fff;
+        } else {
+            mdiffwrite14(mf, MDIFF_SEEK, 0x1fff);
+            offset -= 0x1fff;
+        }
+    }
+    mf->curcount += offset;
+    mf->curcmd = (mf->curcount ? MDIFF_SEEK : MDIFF_INVALID);
+    mf->relativepos = relativepos;
+}
+
 /* Tagging memfiles. This remembers the correspondence between the tag
    and the file location. For a diff memfile, it also sets relativepos
    to the pos of the tag in relativeto, if it exists, and adds a seek
@@ -332,28 +361,169 @@ mtag(struct memfile *mf, long tagdata, enum memfile_tagtype tagtype)
             if (tag->tagtype == tagtype && tag->tagdata == tagdata)
                 break;
         }
-        if (tag && mf->relativepos != tag->pos) {
-            int offset = mf->relativepos - tag->pos;
+        if (tag)
+            mdiffseek(mf, tag->pos);
+    }
+}
 
-            if (mf->curcmd != MDIFF_SEEK) {
-                mdiffflush(mf);
-                mf->curcount = 0;
-            }
-            while (offset + mf->curcount >= 1 << 13 ||
-                   offset + mf->curcount <= -(1 << 13)) {
-                if (offset + mf->curcount < 0) {
-                    mdiffwrite14(mf, MDIFF_SEEK, -0x1fff);
-                    offset += 0x1fff;
-                } else {
-                    mdiffwrite14(mf, MDIFF_SEEK, 0x1fff);
-                    offset -= 0x1fff;
+/* Diffing memfiles that weren't written with tags (e.g. because they were
+   loaded from a save file). mwrite_matching writes to a diff memfile like
+   mwrite does, but rather than relying on tags to keep the two files aligned,
+   it looks up each run of data that doesn't match at the current position in
+   a hash of the MATCH_BLOCK-byte blocks of relativeto, and seeks there if it's
+   found. This is much slower than mwrite, so it's only used by tools that
+   rewrite save files. */
+#define MATCH_BLOCK 16
+
+static unsigned
+match_hash(const char *p)
+{
+    unsigned h = 2166136261U;   /* FNV-1a */
+    int i;
+
+    for (i = 0; i < MATCH_BLOCK; i++)
+        h = (h ^ (unsigned char)p[i]) * 16777619U;
+    return h;
+}
+
+/* The number of bytes at the start of p1 and p2 that are the same. */
+static int
+match_length(const char *p1, int len1, const char *p2, int len2)
+{
+    int i, len = min(len1, len2);
+
+    for (i = 0; i < len && p1[i] == p2[i]; i++) {}
+    return i;
+}
+
+void
+mwrite_matching(struct memfile *mf, const void *buf, int len)
+{
+    const char *in = buf;
+    const struct memfile *rel = mf->relativeto;
+    int nblocks = rel->pos / MATCH_BLOCK;
+    int hashmask, *blocks, i, run;
+
+    /* An open-addressed hash table of block offsets + 1 (so that 0 means an
+       empty slot), at most half full. Blocks with the same contents as an
+       earlier block aren't added, so runs of zeroes don't slow lookups. */
+    for (hashmask = 1; hashmask < nblocks * 2; hashmask *= 2) {}
+    blocks = calloc(hashmask, sizeof (int));
+    hashmask--;
+
+    for (i = 0; i < nblocks; i++) {
+        const char *block = rel->buf + i * MATCH_BLOCK;
+        unsigned h = match_hash(block) & hashmask;
+
+        while (blocks[h] &&
+               memcmp(rel->buf + blocks[h] - 1, block, MATCH_BLOCK) != 0)
+            h = (h + 1) & hashmask;
+        if (!blocks[h])
+            blocks[h] = i * MATCH_BLOCK + 1;
+    }
+
+    i = 0;
+    while (i < len) {
+        run = 0;
+        if (mf->relativepos < rel->pos)
+            run = match_length(in + i, len - i, rel->buf + mf->relativepos,
+                               rel->pos - mf->relativepos);
+
+        if (run < MATCH_BLOCK && len - i >= MATCH_BLOCK) {
+            unsigned h = match_hash(in + i) & hashmask;
+
+            while (blocks[h] && memcmp(rel->buf + blocks[h] - 1, in + i,
+                                       MATCH_BLOCK) != 0)
+                h = (h + 1) & hashmask;
+
+            /* A seek costs 2 bytes of diff, and typically another 2 to seek
+               back afterwards, so it has to buy more than that. */
+            if (blocks[h]) {
+                int pos = blocks[h] - 1;
+                int found = match_length(in + i, len - i, rel->buf + pos,
+                                         rel->pos - pos);
+
+                if (found > run + 4) {
+                    mdiffseek(mf, pos);
+                    run = found;
                 }
             }
-            mf->curcount += offset;
-            mf->curcmd = (mf->curcount ? MDIFF_SEEK : MDIFF_INVALID);
-            mf->relativepos = tag->pos;
         }
+
+        /* A run of 0 means an edit of the byte here. */
+        if (!run)
+            run = 1;
+        mwrite(mf, in + i, run);
+        i += run;
     }
+
+    free(blocks);
+}
+
+/* Applies a diff (in the format of diffbuf) to base, writing the result to mf,
+   which must be a newly created memfile that isn't relative to anything.
+   Returns NULL on success, or a description of the problem if the diff is
+   malformed. Either way, the caller must free mf afterwards. */
+const char *
+mdiffapply(struct memfile *mf, const char *diff, int difflen,
+           const struct memfile *base)
+{
+    const char *dp = diff;
+    char *mfp;
+    long dbpos = 0;
+
+    /* 0x0000 means "seek 0", which is never generated, and thus works as an
+       EOF marker, as well as the end of the diff itself */
+    while (diff + difflen - dp >= 2 && (dp[0] || dp[1])) {
+
+        signed short n = (unsigned char)(dp[1]) & 0x3F;
+        n *= 256;
+        n += (unsigned char)(dp[0]);
+
+        dp += 2;
+
+        switch ((unsigned char)(dp[-1]) >> 6) {
+        case MDIFF_SEEK:
+
+            if (n >= 0x2000)
+                n -= 0x4000;
+
+            if (dbpos < n)
+                return "binary diff seeks past start of file";
+
+            dbpos -= n;
+
+            break;
+
+        case MDIFF_COPY:
+
+            if (dbpos + n > base->pos)
+                return "binary diff reads past EOF";
+
+            mfp = mmmap(mf, n, mf->pos);
+            memcpy(mfp, base->buf + dbpos, n);
+            dbpos += n;
+
+            break;
+
+        case MDIFF_EDIT:
+
+            if (dp - diff + n > difflen)
+                return "binary diff ends unexpectedly";
+
+            mfp = mmmap(mf, n, mf->pos);
+            memcpy(mfp, dp, n);
+            dbpos += n;     /* can legally go past the end of base! */
+            dp += n;
+
+            break;
+
+        default:
+            return "unknown command in binary diff";
+        }
+    }
+
+    return NULL;
 }
 
 void
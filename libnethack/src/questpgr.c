@@ -14,6 +14,7 @@
 
 static void Fread(void *, int, int, dlb *);
 static struct qtmsg *construct_qtlist(long);
+static void load_qtlist(void);
 static struct qtmsg *msg_in(struct qtmsg *, int);
 static const char *convert_arg(char c);
 static const char *convert_line(const char *in_line);
@@ -22,6 +23,7 @@ static void deliver_by_window(struct qtmsg *);
 
 static struct qtlists qt_list;
 static dlb *msg_file;
+static boolean qt_load_tried;   /* load_qtlist() has run since unload */
 
 
 static void
@@ -55,13 +57,18 @@ construct_qtlist(long hdr_offset)
     return msg_list;
 }
 
-void
+/* Most games never see a quest message, so the quest text isn't loaded until
+   the first one is paged out; it stays loaded until unload_qtlist(). If it
+   can't be loaded, that's reported once, and the pagers stay quiet until then
+   rather than trying again for every message. */
+static void
 load_qtlist(void)
 {
     int n_classes, i;
     char qt_classes[N_HDR][LEN_HDR];
     long qt_offsets[N_HDR];
 
+    qt_load_tried = TRUE;
     msg_file = dlb_fopen(QTEXT_FILE, RDBMODE);
     if (!msg_file)
         panic("CANNOT OPEN QUEST TEXT FILE %s.", QTEXT_FILE);
@@ -103,6 +110,7 @@ unload_qtlist(void)
         free(qt_list.common), qt_list.common = 0;
     if (qt_list.chrole)
         free(qt_list.chrole), qt_list.chrole = 0;
+    qt_load_tried = FALSE;
     return;
 }
 
@@ -204,7 +212,6 @@ convert_line(const char *in_line)
 {
     /* xcrypt needs us to allocate a buffer for it */
     char decrypted_line[strlen(in_line)+1];
-    xcrypt(in_line, decrypted_line);
     const char *rv = "";
     char *c;
 
@@ -336,6 +343,11 @@ com_pager(int msgnum)
 {
     struct qtmsg *qt_msg;
 
+    if (!qt_load_tried)
+        load_qtlist();
+    if (!qt_list.common)
+        return;         /* load_qtlist() already complained */
+
     if (!(qt_msg = msg_in(qt_list.common, msgnum))) {
         impossible("com_pager: message %d not found.", msgnum);
         return;
@@ -354,6 +366,11 @@ qt_pager(int msgnum)
 {
     struct qtmsg *qt_msg;
 
+    if (!qt_load_tried)
+        load_qtlist();
+    if (!qt_list.chrole)
+        return;         /* load_qtlist() already complained */
+
     if (!(qt_msg = msg_in(qt_list.chrole, msgnum))) {
         impossible("qt_pager: message %d not found.", msgnum);
         return;
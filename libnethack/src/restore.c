@@ -875,8 +875,6 @@ dorecover(struct memfile *mf)
      *   available. */
     inven_inuse(FALSE);
 
-    load_qtlist();      /* re-load the quest text info */
-
     program_state.restoring_binary_save = FALSE;
 
     /* Note: dorecover() no longer calls run_timers() or doredraw(), because
@@ -27,10 +27,30 @@
  * and set of N+1 hexadecimal fseek offsets, followed by N multiple-line
  * records, separated by "---" lines.  The first oracle is a special case,
  * and placed there by 'makedefs'.
+ *
+ * Both files are read into memory and split into lines the first time
+ * they're needed (see struct textlines below), so choosing a rumor or
+ * oracle is a lookup rather than a seek and a scan through the file. The
+ * offsets used to choose them are still byte offsets into the file, so
+ * the choices (and the random numbers used to make them) are unchanged.
  */
 
-static void init_rumors(dlb *);
-static void init_oracles(dlb *);
+/* A data file split into lines. The files never change, so these are loaded
+   on first use and kept for the rest of the process, like the rumor offsets
+   below. */
+struct textlines {
+    boolean tried;      /* load_textlines() has been called */
+    int count;          /* number of lines */
+    long *offset;       /* file offset of each line, then of EOF */
+    char **line;        /* each line, without its newline */
+    char *text;         /* the file's contents, which line points into */
+};
+
+static boolean load_textlines(const char *, struct textlines *);
+static int line_after(const struct textlines *, long);
+static void init_rumors(void);
+static boolean load_oracle_lines(void);
+static void init_oracles(void);
 static void outoracle(boolean, boolean);
 
 static int true_rumor_start, true_rumor_size, true_rumor_end, false_rumor_start,
@@ -39,26 +59,145 @@ static int oracle_flg = 0;      /* -1=>don't use, 0=>need init, 1=>init done */
 static unsigned oracle_cnt = 0;
 static int *oracle_loc = 0;
 
+static struct textlines rumor_lines, oracle_lines;
+
+
+/* Reads the whole of a data file, and splits it into lines. This is only
+   attempted once (tl->tried records that), whether or not it works, so callers
+   check tl->tried first. Returns FALSE if the file couldn't be opened or there
+   wasn't enough memory, leaving tl empty. */
+static boolean
+load_textlines(const char *fname, struct textlines *tl)
+{
+    dlb *fp;
+    long size;
+    char *p, *nl, *end;
+    int n;
+
+    tl->tried = TRUE;
+    fp = dlb_fopen(fname, "r");
+    if (!fp)
+        return FALSE;
+
+    dlb_fseek(fp, 0L, SEEK_END);
+    size = dlb_ftell(fp);
+    dlb_fseek(fp, 0L, SEEK_SET);
+    tl->text = malloc(size + 1);
+    if (!tl->text) {
+        dlb_fclose(fp);
+        return FALSE;
+    }
+    size = dlb_fread(tl->text, 1, size, fp);
+    dlb_fclose(fp);
+    tl->text[size] = '\0';
+    end = tl->text + size;
+
+    for (n = 0, p = tl->text; p < end; n++) {
+        nl = memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+    }
+
+    tl->offset = malloc((n + 1) * sizeof (long));
+    tl->line = malloc((n + 1) * sizeof (char *));
+    if (!tl->offset || !tl->line) {
+        free(tl->text);
+        free(tl->offset);
+        free(tl->line);
+        tl->text = NULL;
+        tl->offset = NULL;
+        tl->line = NULL;
+        return FALSE;
+    }
+    tl->count = n;
+
+    for (n = 0, p = tl->text; p < end; n++) {
+        tl->offset[n] = p - tl->text;
+        tl->line[n] = p;
+        nl = memchr(p, '\n', end - p);
+        if (!nl)
+            break;
+        *nl = '\0';
+#if defined(WIN32)
+        if (nl > p && nl[-1] == '\r')
+            nl[-1] = '\0';
+#endif
+        p = nl + 1;
+    }
+    tl->offset[tl->count] = size;
+
+    return TRUE;
+}
+
+/* Returns the index of the first line that starts after the given file
+   offset, or tl->count if there is no such line. */
+static int
+line_after(const struct textlines *tl, long pos)
+{
+    int lo = 0, hi = tl->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (tl->offset[mid] > pos)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
 
 static void
-init_rumors(dlb * fp)
+init_rumors(void)
 {
-    char line[BUFSZ]; /* for fgets */
+    int i;
 
-    dlb_fgets(line, sizeof line, fp);   /* skip "don't edit" comment */
-    dlb_fgets(line, sizeof line, fp);
-    if (sscanf(line, "%6x\n", &true_rumor_size) == 1 && true_rumor_size > 0L) {
-        dlb_fseek(fp, 0L, SEEK_CUR);
-        true_rumor_start = dlb_ftell(fp);
+    /* line 0 is a "don't edit" comment */
+    if (rumor_lines.count >= 2 &&
+        sscanf(rumor_lines.line[1], "%6x", &true_rumor_size) == 1 &&
+        true_rumor_size > 0L) {
+        true_rumor_start = rumor_lines.offset[2];
         true_rumor_end = true_rumor_start + true_rumor_size;
-        dlb_fseek(fp, 0L, SEEK_END);
-        false_rumor_end = dlb_ftell(fp);
+        false_rumor_end = rumor_lines.offset[rumor_lines.count];
         false_rumor_start = true_rumor_end;     /* ok, so it's redundant... */
         false_rumor_size = false_rumor_end - false_rumor_start;
+
+        for (i = 2; i < rumor_lines.count; i++)
+            xcrypt(rumor_lines.line[i], rumor_lines.line[i]);
     } else
         true_rumor_size = -1L;  /* init failed */
 }
 
+/* Reads the rumors file, the first time it's needed. Returns FALSE if it
+   couldn't be loaded; if it could, but its header doesn't make sense,
+   true_rumor_size becomes negative. */
+boolean
+load_rumors(void)
+{
+    if (!rumor_lines.tried && load_textlines(RUMORFILE, &rumor_lines))
+        init_rumors();
+    return rumor_lines.text != NULL;
+}
+
+/* Returns the rumor chosen by the given byte offset into the true (adjtruth >
+   0) or false rumors. That's the line after the one containing the chosen
+   byte, as if we'd seeked there and skipped the partial line. Returns NULL if
+   the rumors haven't been loaded successfully. */
+const char *
+rumor_at(int adjtruth, int tidbit)
+{
+    int beginning = adjtruth > 0 ? true_rumor_start : false_rumor_start;
+    int i;
+
+    if (true_rumor_size <= 0L)
+        return NULL;
+
+    i = line_after(&rumor_lines, beginning + tidbit);
+    if (i >= rumor_lines.count ||
+        (adjtruth > 0 && rumor_lines.offset[i + 1] > true_rumor_end))
+        /* reached end of rumors -- go back to beginning */
+        i = line_after(&rumor_lines, beginning - 1);
+    return rumor_lines.line[i];
+}
+
 /* exclude_cookie is a hack used because we sometimes want to get rumors in a
  * context where messages such as "You swallowed the fortune!" that refer to
  * cookies should not appear.  This has no effect for true rumors since none
@@ -68,11 +207,8 @@ const char *
 getrumor(int truth,     /* 1=true, -1=false, 0=either */
          boolean exclude_cookie, int *truth_out)
 {
-    dlb *rumors;
-    int tidbit, beginning;
-    char *endp;
+    int tidbit;
     int ltruth = 0;
-    char line[BUFSZ]; /* for fgets */
     const char *rv = "";
 
     /* If this happens, we couldn't open the RUMORFILE. So synthesize a
@@ -80,18 +216,14 @@ getrumor(int truth,     /* 1=true, -1=false, 0=either */
     if (true_rumor_size < 0L)
         return "";
 
-    rumors = dlb_fopen(RUMORFILE, "r");
-
-    if (rumors) {
+    if (load_rumors()) {
         int count = 0;
         int adjtruth;
 
+        if (true_rumor_size < 0L)       /* init failed */
+            return msgprintf("Error reading \"%.80s\".", RUMORFILE);
+
         do {
-            if (true_rumor_size == 0L) {        /* if this is 1st outrumor() */
-                init_rumors(rumors);
-                if (true_rumor_size < 0L)       /* init failed */
-                    return msgprintf("Error reading \"%.80s\".", RUMORFILE);
-            }
             /* 
              *      input:      1    0   -1
              *       rn2 \ +1  2=T  1=T  0=F
@@ -100,34 +232,19 @@ getrumor(int truth,     /* 1=true, -1=false, 0=either */
             switch (adjtruth = truth + rn2(2)) {
             case 2:    /* (might let a bogus input arg sneak thru) */
             case 1:
-                beginning = true_rumor_start;
                 tidbit = mt_random() % true_rumor_size;
                 break;
             case 0:    /* once here, 0 => false rather than "either" */
             case -1:
-                beginning = false_rumor_start;
                 tidbit = mt_random() % false_rumor_size;
                 break;
             default:
                 impossible("strange truth value for rumor");
                 return "Oops...";
             }
-            dlb_fseek(rumors, beginning + tidbit, SEEK_SET);
-            dlb_fgets(line, sizeof line, rumors);
-            if (!dlb_fgets(line, sizeof line, rumors) ||
-                (adjtruth > 0 && dlb_ftell(rumors) > true_rumor_end)) {
-                /* reached end of rumors -- go back to beginning */
-                dlb_fseek(rumors, beginning, SEEK_SET);
-                dlb_fgets(line, sizeof line, rumors);
-            }
-            if ((endp = strchr(line, '\n')) != 0)
-                *endp = 0;
-            char decrypted_line[strlen(line) + 1];
-            xcrypt(line, decrypted_line);
-            rv = msg_from_string(decrypted_line);
+            rv = msg_from_string(rumor_at(adjtruth, tidbit));
         } while (count++ < 50 && exclude_cookie &&
                  (strstri(rv, "fortune") || strstri(rv, "pity")));
-        dlb_fclose(rumors);
         if (count >= 50)
             impossible("Can't find non-cookie rumor?");
         else
@@ -187,23 +304,66 @@ outrumor(int truth,     /* 1=true, -1=false, 0=either */
     pline("%s", line);
 }
 
+/* Loads the oracles file the first time it's needed, decrypting the oracles
+   themselves; the "---" lines that end each one are replaced by NULL. Returns
+   FALSE if it couldn't be loaded. */
+static boolean
+load_oracle_lines(void)
+{
+    int i;
+    unsigned int cnt = 0;
+
+    if (oracle_lines.tried)
+        return oracle_lines.text != NULL;
+    if (!load_textlines(ORACLEFILE, &oracle_lines))
+        return FALSE;
+
+    /* The text follows the "don't edit" comment, the count, and the cnt + 1
+       offsets. */
+    if (oracle_lines.count >= 2)
+        sscanf(oracle_lines.line[1], "%5d", &cnt);
+    for (i = cnt + 3; i < oracle_lines.count; i++) {
+        if (!strcmp(oracle_lines.line[i], "---"))
+            oracle_lines.line[i] = NULL;
+        else
+            xcrypt(oracle_lines.line[i], oracle_lines.line[i]);
+    }
+    return TRUE;
+}
+
+/* Returns the lines of the oracle that starts at the given offset into the
+   oracles file, and puts the number of lines in *nlines. Loads the file if
+   necessary; returns NULL if it can't be opened. */
+char *const *
+oracle_at(int loc, int *nlines)
+{
+    int i, n;
+
+    if (!load_oracle_lines())
+        return NULL;
+
+    i = line_after(&oracle_lines, loc - 1);
+    for (n = 0; i + n < oracle_lines.count && oracle_lines.line[i + n]; n++)
+        ;
+    *nlines = n;
+    return oracle_lines.line + i;
+}
+
 static void
-init_oracles(dlb * fp)
+init_oracles(void)
 {
     int i;
-    char line[BUFSZ]; /* for fgets */
     unsigned int cnt = 0;
 
     /* this assumes we're only called once */
-    dlb_fgets(line, sizeof line, fp);   /* skip "don't edit" comment */
-    dlb_fgets(line, sizeof line, fp);
-    if (sscanf(line, "%5d\n", &cnt) == 1 && cnt > 0) {
+    /* line 0 is a "don't edit" comment */
+    if (oracle_lines.count >= 2 &&
+        sscanf(oracle_lines.line[1], "%5d", &cnt) == 1 && cnt > 0 &&
+        oracle_lines.count >= cnt + 2) {
         oracle_cnt = cnt;
         oracle_loc = malloc(cnt * sizeof (int));
-        for (i = 0; i < cnt; i++) {
-            dlb_fgets(line, sizeof line, fp);
-            sscanf(line, "%5x\n", &oracle_loc[i]);
-        }
+        for (i = 0; i < cnt; i++)
+            sscanf(oracle_lines.line[i + 2], "%5x", &oracle_loc[i]);
     }
     return;
 }
@@ -250,22 +410,18 @@ restore_oracles(struct memfile *mf)
 void
 outoracle(boolean special, boolean delphi)
 {
-    char line[COLNO];
-    char *endp;
-    dlb *oracles;
-    int oracle_idx;
+    int oracle_idx, nlines, i;
+    char *const *text;
 
     if (oracle_flg < 0 ||       /* couldn't open ORACLEFILE */
         (oracle_flg > 0 && oracle_cnt == 0))    /* oracles already exhausted */
         return;
 
-    oracles = dlb_fopen(ORACLEFILE, "r");
-
-    if (oracles) {
+    if (load_oracle_lines()) {
         struct nh_menulist menu;
 
         if (oracle_flg == 0) {  /* if this is the first outoracle() */
-            init_oracles(oracles);
+            init_oracles();
             oracle_flg = 1;
             if (oracle_cnt == 0)
                 return;
@@ -275,7 +431,7 @@ outoracle(boolean special, boolean delphi)
         if (oracle_cnt <= 1 && !special)
             return;     /* (shouldn't happen) */
         oracle_idx = special ? 0 : rnd((int)oracle_cnt - 1);
-        dlb_fseek(oracles, oracle_loc[oracle_idx], SEEK_SET);
+        text = oracle_at(oracle_loc[oracle_idx], &nlines);
         if (!special)
             oracle_loc[oracle_idx] = oracle_loc[--oracle_cnt];
 
@@ -291,16 +447,11 @@ outoracle(boolean special, boolean delphi)
             add_menutext(&menu, "The message reads:");
         add_menutext(&menu, "");
 
-        while (dlb_fgets(line, COLNO, oracles) && strcmp(line, "---\n")) {
-            if ((endp = strchr(line, '\n')) != 0)
-                *endp = 0;
-            char decrypted_line[strlen(line) + 1];
-            add_menutext(&menu, xcrypt(line, decrypted_line));
-        }
+        for (i = 0; i < nlines; i++)
+            add_menutext(&menu, text[i]);
 
         display_menu(&menu, NULL, PICK_NONE, PLHINT_ANYWHERE,
                      NULL);
-        dlb_fclose(oracles);
     } else {
         pline("Can't open oracles file!");
         oracle_flg = -1;        /* don't try to open it again */
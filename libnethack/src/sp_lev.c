@@ -49,13 +49,25 @@ static boolean create_subroom(struct level *lev, struct mkroom *, xchar, xchar,
 #define XLIM    4
 #define YLIM    3
 
+/* A special level file is parsed straight out of memory: the data library's
+   copy of it if the library is preloaded, otherwise a buffer it has been read
+   into. Everything built while parsing it comes from sp_blocklist, and is
+   released in one go when load_special() is done with the level. */
+struct sp_file {
+    const char *pos;
+    const char *end;
+};
+
 #define Fread(ptr, size, count, stream) \
-    if (dlb_fread(ptr,size,count,stream) != count) goto err_out;
-#define Fgetc                            (schar)dlb_fgetc
-#define New(type)                        malloc(sizeof(type))
-#define NewTab(type, size)               malloc(sizeof(type *) * (unsigned)size)
+    if (!sp_fread(ptr,size,count,stream)) goto err_out;
+#define Fgetc                            sp_fgetc
+#define New(type)                        xmalloc(&sp_blocklist, sizeof(type))
+#define NewTab(type, size)               xmalloc(&sp_blocklist, \
+                                                 sizeof(type *) * (unsigned)size)
 #define Free(ptr)                        if (ptr) free((ptr))
 
+static struct xmalloc_block *sp_blocklist;
+
 static walk walklist[50];
 extern int min_rx, max_rx, min_ry, max_ry;      /* from mkmap.c */
 
@@ -75,15 +87,16 @@ static void get_location(struct level *lev, schar * x, schar * y, int humidity);
 static boolean is_ok_location(struct level *lev, schar, schar, int);
 static void sp_lev_shuffle(char *, char *, int);
 static void light_region(struct level *lev, region * tmpregion);
-static void load_common_data(struct level *lev, dlb *, int);
-static void load_one_monster(dlb *, monster *);
-static void load_one_object(dlb *, object *);
-static void load_one_engraving(dlb *, engraving *);
-static boolean load_rooms(struct level *lev, dlb *);
+static boolean sp_fread(void *, int, int, struct sp_file *);
+static schar sp_fgetc(struct sp_file *);
+static void load_common_data(struct level *lev, struct sp_file *, int);
+static void load_one_monster(struct sp_file *, monster *);
+static void load_one_object(struct sp_file *, object *);
+static void load_one_engraving(struct sp_file *, engraving *);
+static boolean load_rooms(struct level *lev, struct sp_file *);
 static void maze1xy(struct level *lev, coord * m, int humidity);
-static boolean load_maze(struct level *lev, dlb * fp);
+static boolean load_maze(struct level *lev, struct sp_file * fp);
 static void create_door(struct level *lev, room_door *, struct mkroom *);
-static void free_rooms(room **, int);
 static void build_room(struct level *lev, room *, room *);
 
 char *lev_message = 0;
@@ -888,8 +901,7 @@ create_monster(struct level *lev, monster * m, struct mkroom *croom)
 
     }   /* if (rn2(100) < m->chance) */
 m_done:
-    Free(m->name.str);
-    Free(m->appear_as.str);
+    return;
 }
 
 /*
@@ -1046,11 +1058,11 @@ create_object(struct level *lev, object * o, struct mkroom *croom)
 
     }   /* if (rn2(100) < o->chance) */
 o_done:
-    Free(o->name.str);
+    return;
 }
 
 /*
- * Randomly place a specific engraving, then release its memory.
+ * Randomly place a specific engraving.
  */
 static void
 create_engraving(struct level *lev, engraving * e, struct mkroom *croom)
@@ -1064,7 +1076,6 @@ create_engraving(struct level *lev, engraving * e, struct mkroom *croom)
         get_location(lev, &x, &y, DRY);
 
     make_engr_at(lev, x, y, e->engr.str, 0L, e->etype);
-    free(e->engr.str);
 }
 
 /*
@@ -1497,76 +1508,6 @@ fill_room(struct level *lev, struct mkroom *croom, boolean prefilled)
     }
 }
 
-static void
-free_rooms(room ** ro, int n)
-{
-    short j;
-    room *r;
-
-    while (n--) {
-        r = ro[n];
-        Free(r->name);
-        Free(r->parent);
-        if ((j = r->ndoor) != 0) {
-            while (j--)
-                Free(r->doors[j]);
-            Free(r->doors);
-        }
-        if ((j = r->nstair) != 0) {
-            while (j--)
-                Free(r->stairs[j]);
-            Free(r->stairs);
-        }
-        if ((j = r->naltar) != 0) {
-            while (j--)
-                Free(r->altars[j]);
-            Free(r->altars);
-        }
-        if ((j = r->nfountain) != 0) {
-            while (j--)
-                Free(r->fountains[j]);
-            Free(r->fountains);
-        }
-        if ((j = r->nsink) != 0) {
-            while (j--)
-                Free(r->sinks[j]);
-            Free(r->sinks);
-        }
-        if ((j = r->npool) != 0) {
-            while (j--)
-                Free(r->pools[j]);
-            Free(r->pools);
-        }
-        if ((j = r->ntrap) != 0) {
-            while (j--)
-                Free(r->traps[j]);
-            Free(r->traps);
-        }
-        if ((j = r->nmonster) != 0) {
-            while (j--)
-                Free(r->monsters[j]);
-            Free(r->monsters);
-        }
-        if ((j = r->nobject) != 0) {
-            while (j--)
-                Free(r->objects[j]);
-            Free(r->objects);
-        }
-        if ((j = r->ngold) != 0) {
-            while (j--)
-                Free(r->golds[j]);
-            Free(r->golds);
-        }
-        if ((j = r->nengraving) != 0) {
-            while (j--)
-                Free(r->engravings[j]);
-            Free(r->engravings);
-        }
-        Free(r);
-    }
-    Free(ro);
-}
-
 static void
 build_room(struct level *lev, room * r, room * pr)
 {
@@ -1671,9 +1612,29 @@ light_region(struct level *lev, region * tmpregion)
     }
 }
 
+static boolean
+sp_fread(void *ptr, int size, int count, struct sp_file *fd)
+{
+    long len = (long)size * count;
+
+    if (len < 0 || len > fd->end - fd->pos)
+        return FALSE;
+    memcpy(ptr, fd->pos, len);
+    fd->pos += len;
+    return TRUE;
+}
+
+static schar
+sp_fgetc(struct sp_file *fd)
+{
+    if (fd->pos >= fd->end)
+        return (schar)EOF;
+    return *fd->pos++;
+}
+
 /* initialization common to all special levels */
 static void
-load_common_data(struct level *lev, dlb * fd, int typ)
+load_common_data(struct level *lev, struct sp_file *fd, int typ)
 {
     uchar n;
     long lev_flags;
@@ -1735,8 +1696,10 @@ load_common_data(struct level *lev, dlb * fd, int typ)
             lev_message = realloc(lev_message, n + 1);
             Fread(lev_message, 1, (int)n, fd);
             lev_message[n] = 0;
+        } else if (n <= fd->end - fd->pos) {
+            fd->pos += n;
         } else {
-            dlb_fseek(fd, n, SEEK_CUR);
+            fd->pos = fd->end;
         }
     }
 
@@ -1746,19 +1709,19 @@ err_out:
 }
 
 static void
-load_one_monster(dlb * fd, monster * m)
+load_one_monster(struct sp_file *fd, monster * m)
 {
     int size;
 
     Fread(m, 1, sizeof *m, fd);
     if ((size = m->name.len) != 0) {
-        m->name.str = malloc((unsigned)size + 1);
+        m->name.str = xmalloc(&sp_blocklist, (unsigned)size + 1);
         Fread(m->name.str, 1, size, fd);
         m->name.str[size] = '\0';
     } else
         m->name.str = NULL;
     if ((size = m->appear_as.len) != 0) {
-        m->appear_as.str = malloc((unsigned)size + 1);
+        m->appear_as.str = xmalloc(&sp_blocklist, (unsigned)size + 1);
         Fread(m->appear_as.str, 1, size, fd);
         m->appear_as.str[size] = '\0';
     } else
@@ -1770,13 +1733,13 @@ err_out:
 }
 
 static void
-load_one_object(dlb * fd, object * o)
+load_one_object(struct sp_file *fd, object * o)
 {
     int size;
 
     Fread(o, 1, sizeof *o, fd);
     if ((size = o->name.len) != 0) {
-        o->name.str = malloc((unsigned)size + 1);
+        o->name.str = xmalloc(&sp_blocklist, (unsigned)size + 1);
         Fread(o->name.str, 1, size, fd);
         o->name.str[size] = '\0';
     } else
@@ -1788,13 +1751,13 @@ err_out:
 }
 
 static void
-load_one_engraving(dlb * fd, engraving * e)
+load_one_engraving(struct sp_file *fd, engraving * e)
 {
     int size;
 
     Fread(e, 1, sizeof *e, fd);
     size = e->engr.len;
-    e->engr.str = malloc((unsigned)size + 1);
+    e->engr.str = xmalloc(&sp_blocklist, (unsigned)size + 1);
     Fread(e->engr.str, 1, size, fd);
     e->engr.str[size] = '\0';
 
@@ -1804,7 +1767,7 @@ err_out:
 }
 
 static boolean
-load_rooms(struct level *lev, dlb * fd)
+load_rooms(struct level *lev, struct sp_file *fd)
 {
     xchar nrooms, ncorr;
     char n;
@@ -1838,7 +1801,7 @@ load_rooms(struct level *lev, dlb * fd)
         /* Let's see if this room has a name */
         Fread(&size, 1, sizeof (size), fd);
         if (size > 0) { /* Yup, it does! */
-            r->name = malloc((unsigned)size + 1);
+            r->name = xmalloc(&sp_blocklist, (unsigned)size + 1);
             Fread(r->name, 1, size, fd);
             r->name[size] = 0;
         } else
@@ -1847,7 +1810,7 @@ load_rooms(struct level *lev, dlb * fd)
         /* Let's see if this room has a parent */
         Fread(&size, 1, sizeof (size), fd);
         if (size > 0) { /* Yup, it does! */
-            r->parent = malloc((unsigned)size + 1);
+            r->parent = xmalloc(&sp_blocklist, (unsigned)size + 1);
             Fread(r->parent, 1, size, fd);
             r->parent[size] = 0;
         } else
@@ -2005,8 +1968,6 @@ load_rooms(struct level *lev, dlb * fd)
         if (!tmproom[i]->parent)
             build_room(lev, tmproom[i], NULL);
 
-    free_rooms(tmproom, nrooms);
-
     /* read the corridors */
 
     Fread(&ncorr, sizeof (ncorr), 1, fd);
@@ -2054,7 +2015,7 @@ maze1xy(struct level *lev, coord * m, int humidity)
  * Could be cleaner, but it works.
  */
 static boolean
-load_maze(struct level *lev, dlb * fd)
+load_maze(struct level *lev, struct sp_file *fd)
 {
     xchar x, y, typ;
     boolean prefilled, room_not_needed;
@@ -2650,15 +2611,29 @@ err_out:
 boolean
 load_special(struct level * lev, const char *name)
 {
-    dlb *fd;
+    dlb *dp;
+    struct sp_file file, *fd = &file;
+    char *buf = NULL;
+    long size;
     boolean result = FALSE;
     char c;
     struct version_info vers_info;
 
-    fd = dlb_fopen(name, RDBMODE);
-    if (!fd)
+    dp = dlb_fopen(name, RDBMODE);
+    if (!dp)
         return FALSE;
 
+    dlb_fseek(dp, 0L, SEEK_END);
+    size = dlb_ftell(dp);
+    dlb_fseek(dp, 0L, SEEK_SET);
+    if (!(file.pos = dlb_fmem(dp))) {
+        buf = malloc(size > 0 ? size : 1);
+        size = dlb_fread(buf, 1, size, dp);
+        file.pos = buf;
+    }
+    file.end = file.pos + size;
+    dlb_fclose(dp);
+
     Fread(&vers_info, sizeof vers_info, 1, fd);
     if (!check_version(&vers_info, name, TRUE))
         goto give_up;
@@ -2677,12 +2652,14 @@ load_special(struct level * lev, const char *name)
     }
 
 give_up:
-    dlb_fclose(fd);
+    xmalloc_cleanup(&sp_blocklist);
+    free(buf);
     return result;
 
 err_out:
     fprintf(stderr, "read error in load_special\n");
-    return FALSE;
+    result = FALSE;
+    goto give_up;
 }
 
 /*sp_lev.c*/
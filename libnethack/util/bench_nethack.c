@@ -0,0 +1,770 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+/* This is a benchmark for the game engine, with no interface attached. It
+   creates games with a fixed seed, and plays them with a simple bot that
+   mostly autoexplores, fights whatever is next to it, heads downstairs once a
+   level is explored, and searches or wanders about when stuck. Every so often
+   it saves the game and loads it again. At the end, it reports how fast all
+   that went, how much the save files grew per turn, how much allocation the
+   engine did per turn, and the peak memory use of the process.
+
+   Usage: bench_nethack [-t turns] [-s seed] [-S commands] [-r role]
+                        [-d datadir] [-k]
+
+   -t: stop once this many turns have been played in total (default 5000)
+   -s: the seed of the first game; later games (if the bot dies) use the
+       following seeds (default 42)
+   -S: save and reload the game every this many commands (default 200; 0 to
+       never do so)
+   -r: the role to play (default Valkyrie)
+   -d: the directory containing nhdat (default: NETHACKDIR from the
+       environment, or the install location)
+   -k: keep the save files of the games played, rather than deleting them
+
+   The engine only lets the benchmark fix the seed (NH4SEED) and the birthday
+   (NH4BIRTHDAY) of the games if it was built with -DDEBUG_FIXED_GAMES (for
+   instance via aimake.local), so that must be done to benchmark it; otherwise
+   the benchmark stops after creating the first game. The games are played in
+   normal mode, and the in-game clock stays at the fixed birthday, so they do
+   not depend on the date or time of day at which the benchmark is run.
+
+   All the other files that the engine writes (bones, record, dumps) go in a
+   temporary directory, along with the save files, so that runs don't affect
+   each other. The bot makes its own decisions with its own random number
+   generator, so a given set of options always leads to the same command
+   stream.
+
+   The allocation figures are for the time spent playing (including saving and
+   loading), not for starting up the engine. The xmalloc figures come from the
+   engine itself. Calls to malloc are only counted if the benchmark is run with
+   the counting library built from libnethack_common/src/bench_malloc.c
+   preloaded (see the instructions there); they include the benchmark's own
+   calls, which are few. */
+
+#ifdef AIMAKE_BUILDOS_MSWin32
+# error !AIMAKE_FAIL_SILENTLY! \
+    The engine benchmark does not currently work on Windows.
+#endif
+
+#define _GNU_SOURCE     /* for mkdtemp, setenv */
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nethack.h"
+#include "common_options.h"
+#include "menulist.h"
+
+#ifndef STRINGIFY_OPTION
+# define STRINGIFY_OPTION(x) STRINGIFY_OPTION_1(x)
+# define STRINGIFY_OPTION_1(x) #x
+#endif
+
+#ifdef AIMAKE_OPTION_gamesdatadir
+# define DEFAULT_DATADIR STRINGIFY_OPTION(AIMAKE_OPTION_gamesdatadir)
+#else
+# define DEFAULT_DATADIR "."
+#endif
+
+/* The birthday of every game: midday on Monday 2014-06-02 (UTC), when the moon
+   was neither new nor full. */
+#define BENCH_BIRTHDAY "1401710400"
+
+static const int xdir[] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+static const int ydir[] = { 0, -1, -1, -1, 0, 1, 1, 1 };
+
+/* Settings. */
+static long turn_limit = 5000;
+static unsigned long seed = 42;
+static long save_every = 200;
+static const char *role_name = "Valkyrie";
+static const char *datadir = NULL;
+static int keep_files = 0;
+
+/* What the bot knows about the current game. */
+static struct nh_dbuf_entry map[ROWNO][COLNO];
+static int hero_x = -1, hero_y = -1;
+static int hp, hpmax, moves;
+static int last_prayer = -1000;
+static int prev_x, prev_y, prev_moves;
+static const char *prev_cmd = "";
+static int say_yes;     /* answer the next yes/no question with 'y' */
+static int menu_answer; /* the answer to the next menu, or 0 for none */
+static int downstair_bg[3], num_downstair_bg;
+static int num_monsters;
+
+/* The bot's own random number generator (an LCG, so that it does not depend on
+   the platform's rand()). */
+static unsigned long bot_seed;
+
+/* What happened, and how long it took. */
+static struct {
+    long games, commands, turns, saves, restores, messages;
+    long long log_bytes;
+    double play_time, create_time, save_time, restore_time;
+} stats;
+
+/* Allocation counts, as of some point in time. */
+struct alloc_counts {
+    unsigned long long xallocs, xbytes, xchunks;
+    unsigned long long mallocs, reallocs, frees;
+};
+
+/* Found in a preloaded bench_malloc.preload, if there is one. */
+static void (*bench_malloc_counts)(unsigned long long *, unsigned long long *,
+                                   unsigned long long *);
+
+/* Tracking of the save/load cycle currently in progress. */
+static int saving, restoring, stopping;
+static double save_start, restore_start;
+
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+get_alloc_counts(struct alloc_counts *ac)
+{
+    nh_get_xmalloc_stats(&ac->xallocs, &ac->xbytes, &ac->xchunks);
+    if (bench_malloc_counts)
+        bench_malloc_counts(&ac->mallocs, &ac->reallocs, &ac->frees);
+    else
+        ac->mallocs = ac->reallocs = ac->frees = 0;
+}
+
+
+static int
+bot_rand(int n)
+{
+    bot_seed = bot_seed * 1103515245UL + 12345UL;
+    return (int)((bot_seed >> 16) & 0x7fff) % n;
+}
+
+
+/* Window procedures. Anything that asks a question gets a conservative answer;
+   the only interesting one is the request for a command, which is where the
+   bot lives. */
+static void
+bench_pause(enum nh_pause_reason reason)
+{
+    (void)reason;
+}
+
+static void
+bench_display_buffer(const char *buf, nh_bool trymove)
+{
+    (void)buf;
+    (void)trymove;
+}
+
+static void
+bench_update_status(struct nh_player_info *pi)
+{
+    hp = pi->hp;
+    hpmax = pi->hpmax;
+    moves = pi->moves;
+}
+
+static void
+bench_print_message(int turn, const char *msg)
+{
+    (void)turn;
+    (void)msg;
+    stats.messages++;
+}
+
+static void
+bench_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
+{
+    memcpy(map, dbuf, sizeof map);
+    hero_x = ux;
+    hero_y = uy;
+}
+
+static void
+bench_display_menu(struct nh_menulist *ml, const char *title, int how,
+                   int placement_hint, void *callbackarg,
+                   void (*callback)(const int *, int, void *))
+{
+    int answer = menu_answer;
+
+    (void)title;
+    (void)how;
+    (void)placement_hint;
+
+    dealloc_menulist(ml);
+    menu_answer = 0;
+    if (answer)
+        callback(&answer, 1, callbackarg);
+    else
+        callback(NULL, -1, callbackarg);
+}
+
+static void
+bench_display_objects(struct nh_objlist *objlist, const char *title, int how,
+                      int placement_hint, void *callbackarg,
+                      void (*callback)(const struct nh_objresult *, int,
+                                       void *))
+{
+    (void)title;
+    (void)how;
+    (void)placement_hint;
+
+    dealloc_objmenulist(objlist);
+    callback(NULL, -1, callbackarg);
+}
+
+static nh_bool
+bench_list_items(struct nh_objlist *objlist, nh_bool invent)
+{
+    (void)invent;
+
+    if (objlist)
+        dealloc_objmenulist(objlist);
+    return TRUE;
+}
+
+static void
+bench_raw_print(const char *str)
+{
+    (void)str;
+}
+
+static struct nh_query_key_result
+bench_query_key(const char *query, nh_bool count_allowed)
+{
+    (void)query;
+    (void)count_allowed;
+
+    return (struct nh_query_key_result){.key = '\033', .count = -1};
+}
+
+static struct nh_getpos_result
+bench_getpos(int origx, int origy, nh_bool force, const char *goal)
+{
+    (void)force;
+    (void)goal;
+
+    return (struct nh_getpos_result){.howclosed = NHCR_CLIENT_CANCEL,
+            .x = origx, .y = origy};
+}
+
+static enum nh_direction
+bench_getdir(const char *query, nh_bool restricted)
+{
+    (void)query;
+    (void)restricted;
+
+    return DIR_NONE;
+}
+
+static char
+bench_yn_function(const char *query, const char *rset, char defchoice)
+{
+    if (say_yes && strchr(rset, 'y')) {
+        say_yes = 0;
+        return 'y';
+    }
+    if (defchoice)
+        return defchoice;
+    if (strchr(rset, 'n'))
+        return 'n';
+    if (strchr(rset, 'q'))
+        return 'q';
+    return rset[0];
+}
+
+static void
+bench_getlin(const char *query, void *callbackarg,
+             void (*callback)(const char *, void *))
+{
+    (void)query;
+
+    callback("\033", callbackarg);
+}
+
+static void
+bench_delay(void)
+{
+}
+
+static void
+bench_level_changed(int displaymode)
+{
+    (void)displaymode;
+}
+
+static void
+bench_outrip(struct nh_menulist *ml, nh_bool tombstone, const char *name,
+             int gold, const char *killbuf, int end_how, int year)
+{
+    (void)tombstone;
+    (void)name;
+    (void)gold;
+    (void)killbuf;
+    (void)end_how;
+    (void)year;
+
+    dealloc_menulist(ml);
+}
+
+
+/* The bot. */
+static int
+on_downstairs(int x, int y)
+{
+    int i;
+
+    for (i = 0; i < num_downstair_bg; i++)
+        if (map[y][x].bg == downstair_bg[i])
+            return 1;
+    return 0;
+}
+
+static int
+find_downstairs(int *x, int *y)
+{
+    int i, j;
+
+    for (j = 0; j < ROWNO; j++)
+        for (i = 0; i < COLNO; i++)
+            if (on_downstairs(i, j)) {
+                *x = i;
+                *y = j;
+                return 1;
+            }
+    return 0;
+}
+
+static enum nh_direction
+adjacent_hostile(void)
+{
+    int i, x, y;
+
+    if (hero_x < 0)
+        return DIR_NONE;
+
+    for (i = 0; i < 8; i++) {
+        x = hero_x + xdir[i];
+        y = hero_y + ydir[i];
+        if (x < 0 || y < 0 || x >= COLNO || y >= ROWNO)
+            continue;
+        /* Monster numbers are offset by 1, so that 0 means no monster; numbers
+           above the number of monsters are warnings. */
+        if (map[y][x].mon && map[y][x].mon <= num_monsters &&
+            !(map[y][x].monflags & (MON_TAME | MON_PEACEFUL)))
+            return (enum nh_direction)i;
+    }
+    return DIR_NONE;
+}
+
+static void
+choose_command(struct nh_cmd_and_arg *cmd)
+{
+    enum nh_direction dir;
+    int stuck = hero_x == prev_x && hero_y == prev_y;
+    int idle = stuck && moves == prev_moves;    /* last command did nothing */
+    int x, y;
+
+    cmd->cmd = "autoexplore";
+    cmd->arg.argtype = 0;
+
+    /* If fighting didn't take any time, there's probably something odd about
+       the monster (e.g. it's peaceful after all); so try something else. */
+    if (!idle && (dir = adjacent_hostile()) != DIR_NONE) {
+        cmd->cmd = "fight";
+        cmd->arg.argtype = CMD_ARG_DIR;
+        cmd->arg.dir = dir;
+    } else if (hp * 7 < hpmax && moves - last_prayer > 1000) {
+        cmd->cmd = "pray";
+        say_yes = 1;
+        last_prayer = moves;
+    } else if (stuck && on_downstairs(hero_x, hero_y)) {
+        cmd->cmd = "move";
+        cmd->arg.argtype = CMD_ARG_DIR;
+        cmd->arg.dir = DIR_DOWN;
+    } else if (stuck && !strcmp(prev_cmd, "autoexplore") &&
+               find_downstairs(&x, &y)) {
+        cmd->cmd = "travel";
+        cmd->arg.argtype = CMD_ARG_POS;
+        cmd->arg.pos.x = x;
+        cmd->arg.pos.y = y;
+    } else if (stuck && bot_rand(3) == 0) {
+        cmd->cmd = "search";
+        cmd->arg.argtype = CMD_ARG_LIMIT;
+        cmd->arg.limit = 10;
+    } else if (idle || (stuck && strcmp(prev_cmd, "autoexplore") != 0)) {
+        cmd->cmd = "move";
+        cmd->arg.argtype = CMD_ARG_DIR;
+        cmd->arg.dir = (enum nh_direction)bot_rand(8);
+    }
+}
+
+static void
+bench_request_command(nh_bool debug, nh_bool completed, nh_bool interrupted,
+                      void *callbackarg,
+                      void (*callback)(const struct nh_cmd_and_arg *, void *))
+{
+    struct nh_cmd_and_arg cmd;
+
+    (void)debug;
+    (void)completed;
+    (void)interrupted;
+
+    if (restoring) {
+        stats.restore_time += now() - restore_start;
+        stats.restores++;
+        restoring = 0;
+    }
+
+    stats.commands++;
+
+    /* The command limit is a safety net, in case the bot gets stuck somewhere
+       where none of its commands take any time. */
+    if (stats.turns + moves >= turn_limit ||
+        stats.commands >= turn_limit * 50 ||
+        (save_every && stats.commands % save_every == 0)) {
+        stopping = stats.turns + moves >= turn_limit ||
+            stats.commands >= turn_limit * 50;
+        saving = 1;
+        save_start = now();
+        menu_answer = 1;        /* "Quicksave and exit the game" */
+        cmd.cmd = "save";
+        cmd.arg.argtype = 0;
+    } else
+        choose_command(&cmd);
+
+    prev_x = hero_x;
+    prev_y = hero_y;
+    prev_moves = moves;
+    prev_cmd = cmd.cmd;
+
+    callback(&cmd, callbackarg);
+}
+
+static struct nh_window_procs bench_windowprocs = {
+    bench_pause,
+    bench_display_buffer,
+    bench_update_status,
+    bench_print_message,
+    bench_request_command,
+    bench_display_menu,
+    bench_display_objects,
+    bench_list_items,
+    bench_update_screen,
+    bench_raw_print,
+    bench_query_key,
+    bench_getpos,
+    bench_getdir,
+    bench_yn_function,
+    bench_getlin,
+    bench_delay,
+    bench_level_changed,
+    bench_outrip,
+    bench_print_message,
+};
+
+
+/* Setup. */
+static char **
+init_game_paths(const char *tempdir)
+{
+    char **paths = malloc(sizeof (char *) * PREFIX_COUNT);
+    int i;
+
+    for (i = 0; i < PREFIX_COUNT; i++) {
+        const char *dir = i == DATAPREFIX ? datadir : tempdir;
+
+        paths[i] = malloc(strlen(dir) + 2);
+        strcpy(paths[i], dir);
+        if (!*dir || dir[strlen(dir) - 1] != '/')
+            strcat(paths[i], "/");
+    }
+
+    return paths;
+}
+
+static void
+read_drawing_info(void)
+{
+    struct nh_drawing_info *di = nh_get_drawing_info();
+    int i;
+
+    num_monsters = di->num_monsters;
+
+    for (i = 0; i < di->num_bgelements && num_downstair_bg < 3; i++)
+        if (!strcmp(di->bgelements[i].symname, "dnstair") ||
+            !strcmp(di->bgelements[i].symname, "dnladder") ||
+            !strcmp(di->bgelements[i].symname, "dnsstair"))
+            downstair_bg[num_downstair_bg++] = i;
+}
+
+/* Builds the options for a new game: the requested role, with the first race,
+   gender and alignment that are valid for it. */
+static struct nh_option_desc *
+game_options(void)
+{
+    struct nh_option_desc *opts = nhlib_clone_optlist(nh_get_options());
+    struct nh_roles_info *ri = nh_get_roles();
+    int role, race, gend, align;
+
+    for (role = 0; role < ri->num_roles; role++)
+        if (!strcmp(ri->rolenames_m[role], role_name) ||
+            (ri->rolenames_f[role] &&
+             !strcmp(ri->rolenames_f[role], role_name)))
+            break;
+    if (role == ri->num_roles) {
+        fprintf(stderr, "Unknown role '%s'.\n", role_name);
+        exit(EXIT_FAILURE);
+    }
+
+    for (race = 0; race < ri->num_races; race++)
+        for (gend = 0; gend < ri->num_genders; gend++)
+            for (align = 0; align < ri->num_aligns; align++)
+                if (ri->matrix[nh_cm_idx(*ri, role, race, gend, align)])
+                    goto found;
+    fprintf(stderr, "No valid character for role '%s'.\n", role_name);
+    exit(EXIT_FAILURE);
+
+found:
+    nhlib_find_option(opts, "role")->value.e = role;
+    nhlib_find_option(opts, "race")->value.e = race;
+    nhlib_find_option(opts, "gender")->value.e = gend;
+    nhlib_find_option(opts, "align")->value.e = align;
+    nhlib_find_option(opts, "mode")->value.e = MODE_NORMAL;
+    nhlib_copy_option_value(nhlib_find_option(opts, "name"),
+                            (union nh_optvalue){.s = (char *)"bench"});
+
+    return opts;
+}
+
+static void
+remove_tempdir(const char *tempdir)
+{
+    DIR *dir = opendir(tempdir);
+    struct dirent *de;
+    char path[4096];
+
+    if (!dir)
+        return;
+    while ((de = readdir(dir))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        snprintf(path, sizeof path, "%s/%s", tempdir, de->d_name);
+        if (unlink(path) != 0)
+            remove_tempdir(path);       /* e.g. the dumps directory */
+    }
+    closedir(dir);
+    rmdir(tempdir);
+}
+
+
+/* Checks that the engine used the seed and birthday it was given, which it
+   only does if it was built to allow fixed games. Both are on the third line
+   of the save file. */
+static void
+check_fixed_game(int fd, unsigned long game_seed)
+{
+    char buf[1024], *line = NULL;
+    unsigned long long birthday;
+    unsigned int seed_used;
+    ssize_t len = pread(fd, buf, sizeof buf - 1, 0);
+
+    if (len > 0) {
+        buf[len] = '\0';
+        line = strchr(buf, '\n');
+        if (line)
+            line = strchr(line + 1, '\n');
+    }
+    if (!line || sscanf(line + 1, "%llx %x", &birthday, &seed_used) != 2 ||
+        seed_used != (unsigned int)game_seed ||
+        birthday != strtoull(BENCH_BIRTHDAY, NULL, 10) * 1000000ULL) {
+        fprintf(stderr, "The engine ignored the fixed seed and birthday; "
+                "build it with -DDEBUG_FIXED_GAMES to benchmark it.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* Plays one game until the turn limit is reached, or the bot dies. Returns
+   nonzero if the benchmark should continue with another game. */
+static int
+play_one_game(const char *tempdir, struct nh_option_desc *opts,
+              unsigned long game_seed)
+{
+    char filename[4096], seedstr[32];
+    enum nh_play_status ret;
+    struct stat st;
+    double start;
+    int fd;
+
+    snprintf(filename, sizeof filename, "%s/bench-%lu.nhgame", tempdir,
+             game_seed);
+    fd = open(filename, O_TRUNC | O_CREAT | O_RDWR, 0660);
+    if (fd == -1) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(seedstr, sizeof seedstr, "%lu", game_seed);
+    setenv("NH4SEED", seedstr, 1);
+
+    start = now();
+    if (nh_create_game(fd, opts) != NHCREATE_OK) {
+        fprintf(stderr, "Could not create a game.\n");
+        exit(EXIT_FAILURE);
+    }
+    stats.create_time += now() - start;
+    stats.games++;
+    check_fixed_game(fd, game_seed);
+
+    memset(map, 0, sizeof map);
+    hero_x = hero_y = -1;
+    moves = 1;
+    last_prayer = -1000;
+
+    start = now();
+    do {
+        restoring = 1;
+        restore_start = now();
+        ret = nh_play_game(fd);
+        if (saving) {
+            stats.save_time += now() - save_start;
+            stats.saves++;
+            saving = 0;
+        }
+    } while ((ret == GAME_DETACHED && !stopping) || ret == RESTART_PLAY);
+    stats.play_time += now() - start;
+
+    stats.turns += moves;
+    if (fstat(fd, &st) == 0)
+        stats.log_bytes += st.st_size;
+    close(fd);
+
+    if (ret != GAME_DETACHED && ret != GAME_OVER) {
+        fprintf(stderr, "nh_play_game failed with status %d.\n", (int)ret);
+        exit(EXIT_FAILURE);
+    }
+
+    return ret == GAME_OVER && !stopping;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char tempdir[] = "/tmp/bench_nethack.XXXXXX";
+    struct nh_option_desc *opts;
+    struct alloc_counts alloc_start, alloc_end;
+    struct rusage ru;
+    char **paths;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-t") == 0)
+            turn_limit = atol(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+            seed = strtoul(argv[++i], NULL, 10);
+        else if (i + 1 < argc && strcmp(argv[i], "-S") == 0)
+            save_every = atol(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-r") == 0)
+            role_name = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "-d") == 0)
+            datadir = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0)
+            keep_files = 1;
+        else {
+            fprintf(stderr, "Usage: %s [-t turns] [-s seed] [-S commands] "
+                    "[-r role] [-d datadir] [-k]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (turn_limit < 1 || save_every < 0) {
+        fprintf(stderr, "At least 1 turn, and a nonnegative save interval, "
+                "please.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!datadir)
+        datadir = getenv("NETHACKDIR");
+    if (!datadir)
+        datadir = DEFAULT_DATADIR;
+
+    if (!mkdtemp(tempdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    bot_seed = seed;
+    setenv("NH4BIRTHDAY", BENCH_BIRTHDAY, 1);
+    paths = init_game_paths(tempdir);
+    nh_lib_init(&bench_windowprocs, paths);
+    for (i = 0; i < PREFIX_COUNT; i++)
+        free(paths[i]);
+    free(paths);
+
+    read_drawing_info();
+    opts = game_options();
+
+    *(void **)&bench_malloc_counts = dlsym(RTLD_DEFAULT, "bench_malloc_counts");
+    get_alloc_counts(&alloc_start);
+    while (play_one_game(tempdir, opts, seed + stats.games))
+        ;
+    get_alloc_counts(&alloc_end);
+
+    nhlib_free_optlist(opts);
+    nh_lib_exit();
+
+    if (keep_files)
+        printf("save files kept in %s\n", tempdir);
+    else
+        remove_tempdir(tempdir);
+
+    printf("%ld turns, %ld commands, %ld games (role %s, seed %lu)\n",
+           stats.turns, stats.commands, stats.games, role_name, seed);
+    printf("play: %.3f s, %.1f turns/s, %.1f commands/s\n", stats.play_time,
+           stats.turns / stats.play_time, stats.commands / stats.play_time);
+    printf("create: %.2f ms/game\n", stats.create_time * 1000 / stats.games);
+    if (stats.saves)
+        printf("save: %ld, %.1f saves/s\n", stats.saves,
+               stats.saves / stats.save_time);
+    if (stats.restores)
+        printf("restore: %ld, %.1f restores/s\n", stats.restores,
+               stats.restores / stats.restore_time);
+    printf("log: %lld bytes, %.1f bytes/turn\n", stats.log_bytes,
+           (double)stats.log_bytes / stats.turns);
+    printf("messages: %ld\n", stats.messages);
+    printf("xmalloc: %.1f allocations/turn, %.1f bytes/turn, "
+           "%.2f chunks/turn\n",
+           (double)(alloc_end.xallocs - alloc_start.xallocs) / stats.turns,
+           (double)(alloc_end.xbytes - alloc_start.xbytes) / stats.turns,
+           (double)(alloc_end.xchunks - alloc_start.xchunks) / stats.turns);
+    if (bench_malloc_counts)
+        printf("malloc: %.1f mallocs/turn, %.1f reallocs/turn, "
+               "%.1f frees/turn\n",
+               (double)(alloc_end.mallocs - alloc_start.mallocs) / stats.turns,
+               (double)(alloc_end.reallocs - alloc_start.reallocs) /
+               stats.turns,
+               (double)(alloc_end.frees - alloc_start.frees) / stats.turns);
+    else
+        printf("malloc: not counted (bench_malloc.preload not loaded)\n");
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        printf("peak RSS: %ld KiB\n", ru.ru_maxrss);
+
+    return 0;
+}
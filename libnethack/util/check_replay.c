@@ -0,0 +1,556 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+/* This is a regression check for seeking in replays. When a completed game is
+   replayed, log_sync() looks up the save backup to start each seek from in an
+   index of the save backups (see build_backup_index() in log.c); without the
+   index, it follows the chain of save backups backwards from the current one
+   instead. Both ways have to arrive at the same save, or what a replay shows
+   would depend on how it got there.
+
+   This replays the game twice, making the same seeks each time: jumps to
+   pseudo-random turns, and steps of a few turns backwards and forwards. The
+   second time, it throws the index away before each seek, so that log_sync()
+   takes the linear route. After each seek, it records the turn, the location
+   in the file of the save that was loaded, and a hash of the binary save; the
+   two replays have to agree on all three.
+
+   Given a second game, which should be the same game saved differently (such
+   as a copy compacted by savetool -c), it replays each of the two games once
+   instead, and checks that they load to the same states. It steps through
+   them a turn at a time from the start to the end, comparing the turn and the
+   binary save after each step; the locations in the files are expected to
+   differ. (Jumps could legitimately go to different saves: a jump backwards
+   stops at a save backup on the target turn, even if it isn't the first save
+   of that turn, and the two games don't have their save backups in the same
+   places.)
+
+   Usage: check_replay [-n seeks] [-s seed] [-d datadir] game [other-game]
+
+   -n: the number of seeks to make, with one game (default 200)
+   -s: the seed for choosing them (default 1)
+   -d: the directory containing nhdat (default: NETHACKDIR from the
+       environment, or the install location)
+
+   The games have to be completed (e.g. ones that bench_nethack -k kept after
+   the bot died). It prints each seek that differs, and exits with status 1 if
+   any did. */
+
+#ifdef AIMAKE_BUILDOS_MSWin32
+# error !AIMAKE_FAIL_SILENTLY! \
+    The replay check does not currently work on Windows.
+#endif
+
+#define _GNU_SOURCE     /* for mkdtemp */
+#include "hack.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef STRINGIFY_OPTION
+# define STRINGIFY_OPTION(x) STRINGIFY_OPTION_1(x)
+# define STRINGIFY_OPTION_1(x) #x
+#endif
+
+#ifdef AIMAKE_OPTION_gamesdatadir
+# define DEFAULT_DATADIR STRINGIFY_OPTION(AIMAKE_OPTION_gamesdatadir)
+#else
+# define DEFAULT_DATADIR "."
+#endif
+
+/* Report at most this many differences. */
+#define MAX_REPORTS 10
+
+/* Settings. */
+static int num_seeks = 200;
+static unsigned long seed = 1;
+static const char *datadir = NULL;
+
+/* Where each seek went, and where it ended up. */
+struct seek {
+    int dir, limit;
+    long turn, location;
+    unsigned long long hash;
+};
+
+static struct seek *seeks[2];
+static int seek_count[2], seek_space[2];
+static boolean stepping;        /* comparing two games a turn at a time */
+static int run;         /* 0 with the index, 1 without (or the other game) */
+static int seekno;
+static long final_turn;
+static boolean index_missing;
+
+/* The generator for the seeks (an LCG, so that it does not depend on the
+   platform's rand()). */
+static unsigned long check_seed;
+
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int
+check_rand(int n)
+{
+    check_seed = check_seed * 1103515245UL + 12345UL;
+    return (int)((check_seed >> 16) & 0x7fff) % n;
+}
+
+/* FNV-1a, of the data in a memfile (which ends at pos; len is the size of the
+   buffer). */
+static unsigned long long
+hash_memfile(const struct memfile *mf)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < mf->pos; i++) {
+        h ^= (unsigned char)mf->buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Chooses the next seek: mostly jumps to any turn of the game (< with a
+   count), with some steps backwards or forwards (left or right with a count).
+   The first seek goes to the end, to find out where that is. When stepping,
+   every seek is a step of one turn forwards. */
+static void
+choose_seek(struct seek *s)
+{
+    int r;
+
+    if (stepping) {
+        s->dir = DIR_E;
+        s->limit = 1;
+        return;
+    }
+
+    if (seekno == 0) {
+        s->dir = DIR_DOWN;
+        s->limit = 0;
+        return;
+    }
+
+    r = check_rand(4);
+    if (r < 2) {
+        s->dir = DIR_UP;
+        s->limit = 1 + (int)((long)check_rand(0x8000) * final_turn / 0x8000);
+    } else {
+        s->dir = r == 2 ? DIR_W : DIR_E;
+        s->limit = 1 + check_rand(50);
+    }
+}
+
+static void
+record_seek(struct seek *s)
+{
+    /* Without this, the first run would be checking nothing. */
+    if (run == 0 && !program_state.backup_index)
+        index_missing = TRUE;
+
+    s->turn = moves;
+    s->location = program_state.binary_save_location;
+    s->hash = hash_memfile(&program_state.binary_save);
+}
+
+
+/* Window procedures. Only the request for a command matters; replays don't ask
+   any questions, but if they did, they would be cancelled. */
+static void
+check_pause(enum nh_pause_reason reason)
+{
+    (void)reason;
+}
+
+static void
+check_display_buffer(const char *buf, nh_bool trymove)
+{
+    (void)buf;
+    (void)trymove;
+}
+
+static void
+check_update_status(struct nh_player_info *pi)
+{
+    (void)pi;
+}
+
+static void
+check_print_message(int turn, const char *msg)
+{
+    (void)turn;
+    (void)msg;
+}
+
+static void
+check_request_command(nh_bool debug, nh_bool completed, nh_bool interrupted,
+                      void *callbackarg,
+                      void (*callback)(const struct nh_cmd_and_arg *, void *))
+{
+    struct nh_cmd_and_arg cmd;
+    struct seek *s;
+    boolean finished = !stepping && seekno == num_seeks;
+
+    (void)debug;
+    (void)completed;
+    (void)interrupted;
+
+    /* The first request comes before any of our seeks. */
+    if (seekno > 0) {
+        s = seeks[run] + seekno - 1;
+        record_seek(s);
+        if (seekno == 1 || stepping)
+            final_turn = s->turn;
+
+        /* A step that doesn't get anywhere is at the end of the game. */
+        if (stepping && seekno > 1 && s->turn == s[-1].turn)
+            finished = TRUE;
+    }
+
+    if (finished) {
+        seek_count[run] = seekno;
+        cmd.cmd = "save";
+        cmd.arg.argtype = 0;
+        callback(&cmd, callbackarg);
+        return;
+    }
+
+    if (seekno == seek_space[run]) {
+        seek_space[run] = seek_space[run] * 2 + 256;
+        seeks[run] = realloc(seeks[run],
+                             seek_space[run] * sizeof (struct seek));
+    }
+    s = seeks[run] + seekno;
+    choose_seek(s);
+    cmd.cmd = "move";
+    cmd.arg.argtype = CMD_ARG_DIR;
+    cmd.arg.dir = s->dir;
+    if (s->limit) {
+        cmd.arg.argtype |= CMD_ARG_LIMIT;
+        cmd.arg.limit = s->limit;
+    }
+
+    if (run == 1 && !stepping) {
+        free(program_state.backup_index);
+        program_state.backup_index = NULL;
+        program_state.backup_index_count = 0;
+    }
+
+    seekno++;
+    callback(&cmd, callbackarg);
+}
+
+static void
+check_display_menu(struct nh_menulist *ml, const char *title, int how,
+                   int placement_hint, void *callbackarg,
+                   void (*callback)(const int *, int, void *))
+{
+    (void)title;
+    (void)how;
+    (void)placement_hint;
+
+    dealloc_menulist(ml);
+    callback(NULL, -1, callbackarg);
+}
+
+static void
+check_display_objects(struct nh_objlist *objlist, const char *title, int how,
+                      int placement_hint, void *callbackarg,
+                      void (*callback)(const struct nh_objresult *, int,
+                                       void *))
+{
+    (void)title;
+    (void)how;
+    (void)placement_hint;
+
+    dealloc_objmenulist(objlist);
+    callback(NULL, -1, callbackarg);
+}
+
+static nh_bool
+check_list_items(struct nh_objlist *objlist, nh_bool invent)
+{
+    (void)invent;
+
+    if (objlist)
+        dealloc_objmenulist(objlist);
+    return TRUE;
+}
+
+static void
+check_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
+{
+    (void)dbuf;
+    (void)ux;
+    (void)uy;
+}
+
+static void
+check_raw_print(const char *str)
+{
+    fprintf(stderr, "%s\n", str);
+}
+
+static struct nh_query_key_result
+check_query_key(const char *query, nh_bool count_allowed)
+{
+    (void)query;
+    (void)count_allowed;
+
+    return (struct nh_query_key_result){.key = '\033', .count = -1};
+}
+
+static struct nh_getpos_result
+check_getpos(int origx, int origy, nh_bool force, const char *goal)
+{
+    (void)force;
+    (void)goal;
+
+    return (struct nh_getpos_result){.howclosed = NHCR_CLIENT_CANCEL,
+            .x = origx, .y = origy};
+}
+
+static enum nh_direction
+check_getdir(const char *query, nh_bool restricted)
+{
+    (void)query;
+    (void)restricted;
+
+    return DIR_NONE;
+}
+
+static char
+check_yn_function(const char *query, const char *rset, char defchoice)
+{
+    (void)query;
+
+    if (defchoice)
+        return defchoice;
+    if (strchr(rset, 'n'))
+        return 'n';
+    if (strchr(rset, 'q'))
+        return 'q';
+    return rset[0];
+}
+
+static void
+check_getlin(const char *query, void *callbackarg,
+             void (*callback)(const char *, void *))
+{
+    (void)query;
+
+    callback("\033", callbackarg);
+}
+
+static void
+check_delay(void)
+{
+}
+
+static void
+check_level_changed(int displaymode)
+{
+    (void)displaymode;
+}
+
+static void
+check_outrip(struct nh_menulist *ml, nh_bool tombstone, const char *name,
+             int gold, const char *killbuf, int end_how, int year)
+{
+    (void)tombstone;
+    (void)name;
+    (void)gold;
+    (void)killbuf;
+    (void)end_how;
+    (void)year;
+
+    dealloc_menulist(ml);
+}
+
+static struct nh_window_procs check_windowprocs = {
+    check_pause,
+    check_display_buffer,
+    check_update_status,
+    check_print_message,
+    check_request_command,
+    check_display_menu,
+    check_display_objects,
+    check_list_items,
+    check_update_screen,
+    check_raw_print,
+    check_query_key,
+    check_getpos,
+    check_getdir,
+    check_yn_function,
+    check_getlin,
+    check_delay,
+    check_level_changed,
+    check_outrip,
+    check_print_message,
+};
+
+
+/* Replays a game once, making all the seeks; returns how long it took. */
+static double
+replay(const char *game)
+{
+    double start;
+    int fd, ret;
+
+    fd = open(game, O_RDONLY);
+    if (fd < 0) {
+        perror(game);
+        exit(EXIT_FAILURE);
+    }
+
+    seekno = 0;
+    check_seed = seed;
+    start = now();
+    ret = nh_play_game(fd);
+    close(fd);
+
+    if (ret != GAME_ALREADY_OVER || seek_count[run] == 0) {
+        fprintf(stderr, "%s could not be replayed (is it a completed "
+                "game?).\n", game);
+        exit(EXIT_FAILURE);
+    }
+    return now() - start;
+}
+
+static const char *
+describe_seek(const struct seek *s)
+{
+    static char buf[64];
+
+    if (s->dir == DIR_DOWN)
+        return "to the end";
+    snprintf(buf, sizeof buf, "%s %d", s->dir == DIR_UP ? "to turn" :
+             s->dir == DIR_W ? "back" : "forward", s->limit);
+    return buf;
+}
+
+static char **
+init_game_paths(const char *tempdir)
+{
+    char **paths = malloc(sizeof (char *) * PREFIX_COUNT);
+    int i;
+
+    for (i = 0; i < PREFIX_COUNT; i++) {
+        const char *dir = i == DATAPREFIX ? datadir : tempdir;
+
+        paths[i] = malloc(strlen(dir) + 2);
+        strcpy(paths[i], dir);
+        if (!*dir || dir[strlen(dir) - 1] != '/')
+            strcat(paths[i], "/");
+    }
+
+    return paths;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char tempdir[] = "/tmp/check_replay.XXXXXX";
+    char **paths;
+    const char *games[2];
+    struct seek *a, *b;
+    double times[2];
+    long bad = 0;
+    int opt, i, n;
+
+    while ((opt = getopt(argc, argv, "n:s:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_seeks = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            datadir = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind < argc - 2 || optind > argc - 1 || num_seeks < 1)
+        goto usage;
+    games[0] = argv[optind];
+    games[1] = argv[argc - 1];
+    stepping = games[1] != games[0];
+
+    if (!datadir)
+        datadir = getenv("NETHACKDIR");
+    if (!datadir)
+        datadir = DEFAULT_DATADIR;
+
+    if (!mkdtemp(tempdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    paths = init_game_paths(tempdir);
+    nh_lib_init(&check_windowprocs, paths);
+
+    for (run = 0; run < 2; run++) {
+        times[run] = replay(games[run]);
+        if (index_missing) {
+            fprintf(stderr, "The replay didn't use the save backup index.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    n = min(seek_count[0], seek_count[1]);
+    if (seek_count[0] != seek_count[1]) {
+        printf("the games end after %d and %d steps\n", seek_count[0],
+               seek_count[1]);
+        bad++;
+    }
+    for (i = 0; i < n; i++) {
+        a = seeks[0] + i;
+        b = seeks[1] + i;
+        if (a->turn == b->turn && a->hash == b->hash &&
+            (stepping || a->location == b->location))
+            continue;
+        if (bad++ < MAX_REPORTS)
+            printf("seek %d (%s): %s, turn %ld from %ld; %s, turn %ld from "
+                   "%ld%s\n", i, describe_seek(a),
+                   stepping ? "first game" : "with the index",
+                   a->turn, a->location,
+                   stepping ? "second game" : "without",
+                   b->turn, b->location,
+                   a->hash != b->hash ? " (binary saves differ)" : "");
+    }
+
+    printf("%d %s in a game of %ld turns, %ld differences\n", n,
+           stepping ? "steps" : "seeks", final_turn, bad);
+    if (stepping)
+        printf("time: %.1f ms for the first game, %.1f ms for the second\n",
+               times[0] * 1000, times[1] * 1000);
+    else
+        printf("time: %.1f ms with the index, %.1f ms without\n",
+               times[0] * 1000, times[1] * 1000);
+
+    nh_lib_exit();
+    for (i = 0; i < PREFIX_COUNT; i++)
+        free(paths[i]);
+    free(paths);
+    free(seeks[0]);
+    free(seeks[1]);
+    rmdir(tempdir);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "Usage: %s [-n seeks] [-s seed] [-d datadir] game "
+            "[other-game]\n", argv[0]);
+    return EXIT_FAILURE;
+}
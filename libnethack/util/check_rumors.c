@@ -0,0 +1,236 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+/* This is a regression check for the way rumors and oracles are chosen. The
+   engine reads each file into memory once and looks lines up by their offset
+   (see rumors.c); before that, it seeked to the chosen offset in the file and
+   read from there. The random numbers drawn are the same either way, so for
+   the games to be the same, the same offset has to lead to the same text.
+
+   For every byte offset that getrumor() can draw, in both the true and false
+   rumors, this compares the rumor that rumor_at() returns with the one that
+   the old seek-and-fgets code would have read. It then does the same for the
+   text of every oracle. Both read the files from nhdat, via dlb.
+
+   Usage: check_rumors [datadir]
+
+   datadir is the directory containing nhdat (default: NETHACKDIR from the
+   environment, or the install location). The exit status is 1 if anything
+   differs. */
+
+#include "hack.h"
+#include "dlb.h"
+
+#ifndef STRINGIFY_OPTION
+# define STRINGIFY_OPTION(x) STRINGIFY_OPTION_1(x)
+# define STRINGIFY_OPTION_1(x) #x
+#endif
+
+#ifdef AIMAKE_OPTION_gamesdatadir
+# define DEFAULT_DATADIR STRINGIFY_OPTION(AIMAKE_OPTION_gamesdatadir)
+#else
+# define DEFAULT_DATADIR "."
+#endif
+
+/* Report at most this many differences of each sort. */
+#define MAX_REPORTS 10
+
+static int true_start, true_size, true_end, false_start, false_size;
+
+
+/* The old init_rumors(): reads the header of the rumors file. */
+static boolean
+old_init_rumors(dlb *fp)
+{
+    char line[BUFSZ];
+
+    dlb_fgets(line, sizeof line, fp);   /* skip "don't edit" comment */
+    dlb_fgets(line, sizeof line, fp);
+    if (sscanf(line, "%6x\n", &true_size) != 1 || true_size <= 0)
+        return FALSE;
+
+    dlb_fseek(fp, 0L, SEEK_CUR);
+    true_start = dlb_ftell(fp);
+    true_end = true_start + true_size;
+    dlb_fseek(fp, 0L, SEEK_END);
+    false_start = true_end;
+    false_size = dlb_ftell(fp) - false_start;
+    return TRUE;
+}
+
+/* The old getrumor(), once it had chosen where to look. */
+static void
+old_rumor_at(dlb *fp, int adjtruth, int tidbit, char *out)
+{
+    char line[BUFSZ];
+    char *endp;
+    int beginning = adjtruth > 0 ? true_start : false_start;
+
+    dlb_fseek(fp, beginning + tidbit, SEEK_SET);
+    dlb_fgets(line, sizeof line, fp);
+    if (!dlb_fgets(line, sizeof line, fp) ||
+        (adjtruth > 0 && dlb_ftell(fp) > true_end)) {
+        /* reached end of rumors -- go back to beginning */
+        dlb_fseek(fp, beginning, SEEK_SET);
+        dlb_fgets(line, sizeof line, fp);
+    }
+    if ((endp = strchr(line, '\n')) != 0)
+        *endp = 0;
+    xcrypt(line, out);
+}
+
+static long
+check_rumors(long *checked)
+{
+    char expected[BUFSZ];
+    const char *got;
+    long bad = 0;
+    int adjtruth, tidbit, size;
+    dlb *fp;
+
+    fp = dlb_fopen(RUMORFILE, "r");
+    if (!fp || !old_init_rumors(fp)) {
+        fprintf(stderr, "Can't read the header of \"%s\".\n", RUMORFILE);
+        exit(EXIT_FAILURE);
+    }
+    if (!load_rumors() || !rumor_at(1, 0)) {
+        fprintf(stderr, "The engine can't read \"%s\".\n", RUMORFILE);
+        exit(EXIT_FAILURE);
+    }
+
+    for (adjtruth = 1; adjtruth >= 0; adjtruth--) {
+        size = adjtruth > 0 ? true_size : false_size;
+        for (tidbit = 0; tidbit < size; tidbit++) {
+            old_rumor_at(fp, adjtruth, tidbit, expected);
+            got = rumor_at(adjtruth, tidbit);
+            (*checked)++;
+            if (strcmp(expected, got) != 0 && bad++ < MAX_REPORTS)
+                printf("%s rumor at %d: expected \"%s\", got \"%s\"\n",
+                       adjtruth > 0 ? "true" : "false", tidbit, expected, got);
+        }
+    }
+
+    dlb_fclose(fp);
+    return bad;
+}
+
+/* For each oracle, compares the lines the old outoracle() read with the ones
+   oracle_at() returns.
+
+   One difference is expected, and not checked for: the old code read into a
+   buffer of COLNO characters, which splits lines of COLNO - 1 characters or
+   more in two, so it showed an empty line after each of them. That happens
+   to three of the oracles. Reading with a larger buffer here leaves out this
+   bug, which the new code doesn't have. */
+static long
+check_oracles(long *checked)
+{
+    char line[BUFSZ], expected[BUFSZ];
+    char *endp;
+    char *const *text;
+    unsigned int cnt = 0;
+    int *loc, i, n, nlines;
+    boolean differs;
+    long bad = 0;
+    dlb *fp;
+
+    fp = dlb_fopen(ORACLEFILE, "r");
+    if (!fp) {
+        fprintf(stderr, "Can't open \"%s\".\n", ORACLEFILE);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The old init_oracles(). The build currently makes the oracles file with
+       makedefs -d rather than -h, so it doesn't have the count and offsets
+       this expects, and the game never finds a real oracle in it. There's
+       nothing to compare then. */
+    dlb_fgets(line, sizeof line, fp);   /* skip "don't edit" comment */
+    dlb_fgets(line, sizeof line, fp);
+    if (sscanf(line, "%5d\n", &cnt) != 1 || cnt == 0) {
+        cnt = 0;
+        loc = NULL;
+    } else {
+        loc = malloc(cnt * sizeof (int));
+        for (i = 0; i < cnt; i++)
+            if (!dlb_fgets(line, sizeof line, fp) ||
+                sscanf(line, "%5x\n", &loc[i]) != 1)
+                cnt = 0;
+    }
+    if (!cnt) {
+        printf("\"%s\" has no oracle offsets, so no oracles are used\n",
+               ORACLEFILE);
+        free(loc);
+        dlb_fclose(fp);
+        return 0;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        text = oracle_at(loc[i], &nlines);
+        if (!text) {
+            fprintf(stderr, "The engine can't read \"%s\".\n", ORACLEFILE);
+            exit(EXIT_FAILURE);
+        }
+        (*checked)++;
+
+        differs = FALSE;
+        dlb_fseek(fp, loc[i], SEEK_SET);
+        for (n = 0; dlb_fgets(line, sizeof line, fp) &&
+                 strcmp(line, "---\n") != 0; n++) {
+            if ((endp = strchr(line, '\n')) != 0)
+                *endp = 0;
+            xcrypt(line, expected);
+            if (n >= nlines || strcmp(expected, text[n]) != 0) {
+                differs = TRUE;
+                break;
+            }
+        }
+        if (n != nlines)
+            differs = TRUE;
+        if (differs && bad++ < MAX_REPORTS)
+            printf("oracle %d (at %d): differs at line %d\n", i, loc[i], n);
+    }
+
+    free(loc);
+    dlb_fclose(fp);
+    return bad;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *datadir = NULL;
+    char *prefix;
+    long bad, rumors = 0, oracles = 0;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [datadir]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 2)
+        datadir = argv[1];
+    if (!datadir)
+        datadir = getenv("NETHACKDIR");
+    if (!datadir)
+        datadir = DEFAULT_DATADIR;
+
+    prefix = malloc(strlen(datadir) + 2);
+    strcpy(prefix, datadir);
+    if (!*datadir || datadir[strlen(datadir) - 1] != '/')
+        strcat(prefix, "/");
+    fqn_prefix[DATAPREFIX] = prefix;
+
+    if (!dlb_init()) {
+        fprintf(stderr, "Can't open the data library in %s.\n", datadir);
+        return EXIT_FAILURE;
+    }
+
+    bad = check_rumors(&rumors);
+    bad += check_oracles(&oracles);
+    printf("%ld rumor offsets and %ld oracles checked, %ld differences\n",
+           rumors, oracles, bad);
+
+    dlb_cleanup();
+    free(prefix);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
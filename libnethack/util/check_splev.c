@@ -0,0 +1,663 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+/* This is a regression check for the special level loader. load_special()
+   parses a level file out of the data library's copy of it in memory (mapped
+   from nhdat where possible); before that, it read the file a field at a time
+   with dlb_fread. Both have to consume the same bytes and make the same random
+   choices, or the levels in a game would depend on how the loader reads.
+
+   For every special level in nhdat, this first checks that the bytes the
+   loader parses (from dlb_fmem) are the ones in the file. It then creates the
+   level from a fixed seed, and records a digest of the result: the binary
+   save of the level, the level regions and message that makemaz() uses
+   afterwards, and the state of the random number generator. Each level is
+   created in a forked copy of the same game, so that no level depends on
+   which others were created before it.
+
+   The digests only mean something when compared with another build's. With
+   -o, they are written to a file; with -c, they are compared with a file
+   written by a build of the loader to compare with, and each level that
+   differs is reported.
+
+   Usage: check_splev [-s seed] [-d datadir] [-o file | -c file]
+
+   -s: the seed for the game and for each level (default 1)
+   -d: the directory containing nhdat (default: NETHACKDIR from the
+       environment, or the install location)
+
+   The exit status is 1 if any level can't be loaded, or differs. */
+
+#ifdef AIMAKE_BUILDOS_MSWin32
+# error !AIMAKE_FAIL_SILENTLY! \
+    The special level check does not currently work on Windows.
+#endif
+
+#define _GNU_SOURCE     /* for mkdtemp, setenv */
+#include "hack.h"
+#include "dlb.h"
+#include "sp_lev.h"
+#include "common_options.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef STRINGIFY_OPTION
+# define STRINGIFY_OPTION(x) STRINGIFY_OPTION_1(x)
+# define STRINGIFY_OPTION_1(x) #x
+#endif
+
+#ifdef AIMAKE_OPTION_gamesdatadir
+# define DEFAULT_DATADIR STRINGIFY_OPTION(AIMAKE_OPTION_gamesdatadir)
+#else
+# define DEFAULT_DATADIR "."
+#endif
+
+/* Report at most this many differences. */
+#define MAX_REPORTS 10
+
+/* Monster and object IDs start here on every level, rather than after those
+   of the game's own objects, which vary with the starting inventory. */
+#define CHECK_IDENT 100000
+
+/* The birthday the levels are created with; shopkeepers' names and the like
+   depend on it. */
+#define CHECK_BIRTHDAY 1401710400000000LL
+
+/* from dlb.c, like dlb_main uses them */
+extern boolean open_library(const char *, library *);
+extern void close_library(library *);
+
+/* from sp_lev.c */
+extern char *lev_message;
+extern lev_region *lregions;
+extern int num_lregions;
+
+struct level_result {
+    char name[64];
+    boolean loaded;
+    unsigned long long hash;
+};
+
+/* Settings. */
+static unsigned long seed = 1;
+static const char *datadir = NULL;
+static const char *outfile = NULL;
+static const char *cmpfile = NULL;
+
+static struct level_result *results;
+static int num_results;
+static long bad;
+static boolean checked, in_child;
+
+
+/* FNV-1a, continued from h. */
+static unsigned long long
+hash_bytes(unsigned long long h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len--) {
+        h ^= *p++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned long long
+hash_int(unsigned long long h, long long n)
+{
+    return hash_bytes(h, &n, sizeof n);
+}
+
+/* Finds where in the dungeon a level file is used, so that it can be created
+   there. Levels that aren't special levels of their own, such as the quest
+   fillers, are created where the hero is. */
+static d_level
+level_location(const char *name)
+{
+    char proto[64], *p;
+    s_level *sl;
+
+    strncpy(proto, name, sizeof proto - 1);
+    proto[sizeof proto - 1] = '\0';
+    if ((p = strstr(proto, LEV_EXT)))
+        *p = '\0';
+    sl = find_level(proto);
+    if (!sl && (p = strrchr(proto, '-')) && digit(p[1])) {
+        *p = '\0';     /* one of several versions of the level */
+        sl = find_level(proto);
+    }
+    return sl ? sl->dlevel : u.uz;
+}
+
+/* Creates one level, in a child process, and returns what it made. */
+static void
+create_level(const char *name, struct level_result *r)
+{
+    struct memfile mf;
+    unsigned long long h = 14695981039346656037ULL;
+    int fds[2], i, status;
+    const lev_region *lr;
+    xchar ledger = maxledgerno() + 1;   /* a slot no dungeon uses */
+    pid_t pid;
+
+    memset(r, 0, sizeof *r);
+    strncpy(r->name, name, sizeof r->name - 1);
+
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pid) {
+        close(fds[1]);
+        if (read(fds[0], r, sizeof *r) != sizeof *r)
+            r->loaded = FALSE;
+        close(fds[0]);
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    /* If the level panics, the game ends in this process, not the parent. */
+    in_child = TRUE;
+    close(fds[0]);
+    mt_srand(seed);
+    flags.ident = CHECK_IDENT;
+    u.ubirthday = CHECK_BIRTHDAY;
+    u.uz = level_location(name);
+    levels[ledger] = alloc_level(&u.uz);
+    r->loaded = load_special(levels[ledger], name);
+
+    if (r->loaded) {
+        mnew(&mf, NULL);
+        savelev(&mf, ledger);
+        h = hash_bytes(h, mf.buf, mf.pos);
+        mfree(&mf);
+
+        h = hash_int(h, num_lregions);
+        for (i = 0, lr = lregions; i < num_lregions; i++, lr++) {
+            h = hash_bytes(h, &lr->inarea, sizeof lr->inarea);
+            h = hash_bytes(h, &lr->delarea, sizeof lr->delarea);
+            h = hash_int(h, lr->in_islev);
+            h = hash_int(h, lr->del_islev);
+            h = hash_int(h, lr->rtype);
+            if (lr->rname.str)
+                h = hash_bytes(h, lr->rname.str, strlen(lr->rname.str));
+        }
+        if (lev_message)
+            h = hash_bytes(h, lev_message, strlen(lev_message));
+        h = hash_int(h, mt_random());
+        r->hash = h;
+    }
+
+    if (write(fds[1], r, sizeof *r) != sizeof *r)
+        _exit(EXIT_FAILURE);
+    _exit(EXIT_SUCCESS);
+}
+
+/* Compares what the loader parses with the bytes of the file in nhdat.
+   Returns FALSE if they differ; if the library isn't in memory, there's
+   nothing to compare, and it counts as the same. */
+static boolean
+check_file_bytes(library *lib, const libdir *entry, long *mapped)
+{
+    const char *mem;
+    char *buf;
+    boolean same = TRUE;
+    dlb *dp;
+
+    dp = dlb_fopen(entry->fname, RDBMODE);
+    if (!dp)
+        return FALSE;
+
+    mem = dlb_fmem(dp);
+    if (mem) {
+        (*mapped)++;
+        buf = malloc(entry->fsize ? entry->fsize : 1);
+        if (fseek(lib->fdata, entry->foffset, SEEK_SET) != 0 ||
+            fread(buf, 1, entry->fsize, lib->fdata) != (size_t)entry->fsize ||
+            memcmp(buf, mem, entry->fsize) != 0)
+            same = FALSE;
+        free(buf);
+    }
+
+    dlb_fclose(dp);
+    return same;
+}
+
+/* Checks every special level; called from inside the game, so that levels
+   can be created. */
+static void
+check_levels(void)
+{
+    library lib;
+    long i, mapped = 0;
+    size_t len;
+    const char *name;
+
+    memset(&lib, 0, sizeof lib);
+    if (!open_library(DLBFILE, &lib)) {
+        fprintf(stderr, "Can't open the data library in %s.\n", datadir);
+        exit(EXIT_FAILURE);
+    }
+
+    results = malloc(lib.nentries * sizeof (struct level_result));
+    for (i = 0; i < lib.nentries; i++) {
+        name = lib.dir[i].fname;
+        len = strlen(name);
+        if (len < strlen(LEV_EXT) ||
+            strcmp(name + len - strlen(LEV_EXT), LEV_EXT) != 0)
+            continue;
+
+        if (!check_file_bytes(&lib, &lib.dir[i], &mapped) &&
+            bad++ < MAX_REPORTS)
+            printf("%s: the loader doesn't see the bytes in the file\n",
+                   name);
+
+        create_level(name, &results[num_results]);
+        if (!results[num_results].loaded && bad++ < MAX_REPORTS)
+            printf("%s: can't be loaded\n", name);
+        num_results++;
+    }
+
+    if (!mapped)
+        printf("the data library isn't in memory, so the loader reads the "
+               "files instead\n");
+
+    close_library(&lib);
+}
+
+
+/* Window procedures. The game is only there to create levels in; the first
+   request for a command checks them, and then saves the game. */
+static void
+check_pause(enum nh_pause_reason reason)
+{
+    (void)reason;
+}
+
+static void
+check_display_buffer(const char *buf, nh_bool trymove)
+{
+    (void)buf;
+    (void)trymove;
+}
+
+static void
+check_update_status(struct nh_player_info *pi)
+{
+    (void)pi;
+}
+
+static void
+check_print_message(int turn, const char *msg)
+{
+    (void)turn;
+    (void)msg;
+}
+
+static void
+check_request_command(nh_bool debug, nh_bool completed, nh_bool interrupted,
+                      void *callbackarg,
+                      void (*callback)(const struct nh_cmd_and_arg *, void *))
+{
+    struct nh_cmd_and_arg cmd;
+
+    (void)debug;
+    (void)completed;
+    (void)interrupted;
+
+    if (!checked) {
+        check_levels();
+        checked = TRUE;
+    }
+
+    cmd.cmd = "save";
+    cmd.arg.argtype = 0;
+    callback(&cmd, callbackarg);
+}
+
+static void
+check_display_menu(struct nh_menulist *ml, const char *title, int how,
+                   int placement_hint, void *callbackarg,
+                   void (*callback)(const int *, int, void *))
+{
+    int answer = 1;     /* "Quicksave and exit the game" */
+
+    (void)title;
+    (void)how;
+    (void)placement_hint;
+
+    dealloc_menulist(ml);
+    callback(&answer, 1, callbackarg);
+}
+
+static void
+check_display_objects(struct nh_objlist *objlist, const char *title, int how,
+                      int placement_hint, void *callbackarg,
+                      void (*callback)(const struct nh_objresult *, int,
+                                       void *))
+{
+    (void)title;
+    (void)how;
+    (void)placement_hint;
+
+    dealloc_objmenulist(objlist);
+    callback(NULL, -1, callbackarg);
+}
+
+static nh_bool
+check_list_items(struct nh_objlist *objlist, nh_bool invent)
+{
+    (void)invent;
+
+    if (objlist)
+        dealloc_objmenulist(objlist);
+    return TRUE;
+}
+
+static void
+check_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
+{
+    (void)dbuf;
+    (void)ux;
+    (void)uy;
+}
+
+static void
+check_raw_print(const char *str)
+{
+    fprintf(stderr, "%s\n", str);
+}
+
+static struct nh_query_key_result
+check_query_key(const char *query, nh_bool count_allowed)
+{
+    (void)query;
+    (void)count_allowed;
+
+    return (struct nh_query_key_result){.key = '\033', .count = -1};
+}
+
+static struct nh_getpos_result
+check_getpos(int origx, int origy, nh_bool force, const char *goal)
+{
+    (void)force;
+    (void)goal;
+
+    return (struct nh_getpos_result){.howclosed = NHCR_CLIENT_CANCEL,
+            .x = origx, .y = origy};
+}
+
+static enum nh_direction
+check_getdir(const char *query, nh_bool restricted)
+{
+    (void)query;
+    (void)restricted;
+
+    return DIR_NONE;
+}
+
+static char
+check_yn_function(const char *query, const char *rset, char defchoice)
+{
+    (void)query;
+
+    if (defchoice)
+        return defchoice;
+    if (strchr(rset, 'n'))
+        return 'n';
+    if (strchr(rset, 'q'))
+        return 'q';
+    return rset[0];
+}
+
+static void
+check_getlin(const char *query, void *callbackarg,
+             void (*callback)(const char *, void *))
+{
+    (void)query;
+
+    callback("\033", callbackarg);
+}
+
+static void
+check_delay(void)
+{
+}
+
+static void
+check_level_changed(int displaymode)
+{
+    (void)displaymode;
+}
+
+static void
+check_outrip(struct nh_menulist *ml, nh_bool tombstone, const char *name,
+             int gold, const char *killbuf, int end_how, int year)
+{
+    (void)tombstone;
+    (void)name;
+    (void)gold;
+    (void)killbuf;
+    (void)end_how;
+    (void)year;
+
+    dealloc_menulist(ml);
+}
+
+static struct nh_window_procs check_windowprocs = {
+    check_pause,
+    check_display_buffer,
+    check_update_status,
+    check_print_message,
+    check_request_command,
+    check_display_menu,
+    check_display_objects,
+    check_list_items,
+    check_update_screen,
+    check_raw_print,
+    check_query_key,
+    check_getpos,
+    check_getdir,
+    check_yn_function,
+    check_getlin,
+    check_delay,
+    check_level_changed,
+    check_outrip,
+    check_print_message,
+};
+
+
+/* Writes the digests, one level per line. */
+static void
+write_results(const char *file)
+{
+    FILE *fp = fopen(file, "w");
+    int i;
+
+    if (!fp) {
+        perror(file);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_results; i++)
+        fprintf(fp, "%s %d %016llx\n", results[i].name, results[i].loaded,
+                results[i].hash);
+    fclose(fp);
+}
+
+/* Compares the digests with those in a file written by -o. */
+static void
+compare_results(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    char name[64];
+    unsigned long long hash;
+    int i, loaded, found = 0;
+
+    if (!fp) {
+        perror(file);
+        exit(EXIT_FAILURE);
+    }
+    while (fscanf(fp, "%63s %d %llx", name, &loaded, &hash) == 3) {
+        for (i = 0; i < num_results; i++)
+            if (!strcmp(results[i].name, name))
+                break;
+        if (i == num_results) {
+            if (bad++ < MAX_REPORTS)
+                printf("%s: not in this build's nhdat\n", name);
+            continue;
+        }
+        found++;
+        if ((loaded != 0) != (results[i].loaded != 0) ||
+            hash != results[i].hash)
+            if (bad++ < MAX_REPORTS)
+                printf("%s: created differently\n", name);
+    }
+    fclose(fp);
+
+    if (found != num_results && bad++ < MAX_REPORTS)
+        printf("%d levels are missing from %s\n", num_results - found, file);
+}
+
+static char **
+init_game_paths(const char *tempdir)
+{
+    char **paths = malloc(sizeof (char *) * PREFIX_COUNT);
+    int i;
+
+    for (i = 0; i < PREFIX_COUNT; i++) {
+        const char *dir = i == DATAPREFIX ? datadir : tempdir;
+
+        paths[i] = malloc(strlen(dir) + 2);
+        strcpy(paths[i], dir);
+        if (!*dir || dir[strlen(dir) - 1] != '/')
+            strcat(paths[i], "/");
+    }
+
+    return paths;
+}
+
+/* Creates the game the levels are created in, and checks them. The game is
+   created in debug mode, so that the seed fixes the dungeon's layout; the
+   character is the first valid one, as some levels depend on the hero's
+   alignment. */
+static void
+play_check_game(const char *tempdir)
+{
+    struct nh_option_desc *opts = nhlib_clone_optlist(nh_get_options());
+    struct nh_roles_info *ri = nh_get_roles();
+    char filename[4096], seedstr[32];
+    int fd, ret, race, gend, align;
+
+    for (race = 0; race < ri->num_races; race++)
+        for (gend = 0; gend < ri->num_genders; gend++)
+            for (align = 0; align < ri->num_aligns; align++)
+                if (ri->matrix[nh_cm_idx(*ri, 0, race, gend, align)])
+                    goto found;
+    fprintf(stderr, "No valid character for the first role.\n");
+    exit(EXIT_FAILURE);
+
+found:
+    nhlib_find_option(opts, "role")->value.e = 0;
+    nhlib_find_option(opts, "race")->value.e = race;
+    nhlib_find_option(opts, "gender")->value.e = gend;
+    nhlib_find_option(opts, "align")->value.e = align;
+    nhlib_find_option(opts, "mode")->value.e = MODE_WIZARD;
+    nhlib_copy_option_value(nhlib_find_option(opts, "name"),
+                            (union nh_optvalue){.s = (char *)"check"});
+
+    snprintf(filename, sizeof filename, "%s/check.nhgame", tempdir);
+    fd = open(filename, O_TRUNC | O_CREAT | O_RDWR, 0660);
+    if (fd == -1) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(seedstr, sizeof seedstr, "%lu", seed);
+    setenv("NH4SEED", seedstr, 1);
+    if (nh_create_game(fd, opts) != NHCREATE_OK) {
+        fprintf(stderr, "Could not create a game.\n");
+        exit(EXIT_FAILURE);
+    }
+    ret = nh_play_game(fd);
+    if (in_child)
+        _exit(EXIT_FAILURE);
+    close(fd);
+    unlink(filename);
+    nhlib_free_optlist(opts);
+
+    if (!checked) {
+        fprintf(stderr, "nh_play_game failed with status %d.\n", ret);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char tempdir[] = "/tmp/check_splev.XXXXXX";
+    char **paths;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "s:d:o:c:")) != -1) {
+        switch (opt) {
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            datadir = optarg;
+            break;
+        case 'o':
+            outfile = optarg;
+            break;
+        case 'c':
+            cmpfile = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc || (outfile && cmpfile))
+        goto usage;
+
+    if (!datadir)
+        datadir = getenv("NETHACKDIR");
+    if (!datadir)
+        datadir = DEFAULT_DATADIR;
+
+    if (!mkdtemp(tempdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    paths = init_game_paths(tempdir);
+    nh_lib_init(&check_windowprocs, paths);
+
+    play_check_game(tempdir);
+    if (outfile)
+        write_results(outfile);
+    if (cmpfile)
+        compare_results(cmpfile);
+
+    printf("%d special levels checked, %ld differences\n", num_results, bad);
+
+    nh_lib_exit();
+    for (i = 0; i < PREFIX_COUNT; i++)
+        free(paths[i]);
+    free(paths);
+    free(results);
+    rmdir(tempdir);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "Usage: %s [-s seed] [-d datadir] [-o file | -c file]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+}
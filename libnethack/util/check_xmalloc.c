@@ -0,0 +1,275 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+/* This is a regression check for xmalloc.c. xmalloc chains are carved out of
+   large chunks, and xrealloc resizes the newest allocation on a chain in place
+   where it can; this checks that it copies where it has to, that the contents
+   survive either way, that freeing via a size of 0 only reclaims the newest
+   allocation, and that a pointer that isn't on the chain is still a
+   segfault.
+
+   Usage: check_xmalloc
+
+   It prints each check that fails, and exits with status 1 if any did. */
+
+#ifdef AIMAKE_BUILDOS_MSWin32
+# error !AIMAKE_FAIL_SILENTLY! \
+    The xmalloc check does not currently work on Windows.
+#endif
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "xmalloc.h"
+
+/* Bigger than the largest chunk xmalloc.c uses. */
+#define HUGE_SIZE (256 * 1024)
+
+static int checks, failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void
+check(int ok, const char *what, int line)
+{
+    checks++;
+    if (!ok) {
+        failures++;
+        printf("line %d: check failed: %s\n", line, what);
+    }
+}
+
+static int
+aligned(const void *p)
+{
+    return (uintptr_t)p % _Alignof(max_align_t) == 0;
+}
+
+/* Fills memory with a pattern that depends on the seed, and checks it. */
+static void
+fill(void *p, size_t len, int seed)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        ((unsigned char *)p)[i] = (unsigned char)(i * 7 + seed);
+}
+
+static int
+filled(const void *p, size_t len, int seed)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (((const unsigned char *)p)[i] != (unsigned char)(i * 7 + seed))
+            return 0;
+    return 1;
+}
+
+static char *
+xmasprintf(struct xmalloc_block **chain, const char *fmt, ...)
+{
+    va_list args;
+    char *rv;
+
+    va_start(args, fmt);
+    rv = xmvasprintf(chain, fmt, args);
+    va_end(args);
+    return rv;
+}
+
+
+static void
+check_in_place(void)
+{
+    struct xmalloc_block *chain = NULL;
+    char *p, *q;
+
+    /* A NULL pointer is the same as xmalloc. */
+    p = xrealloc(&chain, NULL, 10);
+    CHECK(p != NULL && aligned(p));
+    fill(p, 10, 1);
+
+    /* Growing and shrinking the newest allocation, while it fits in the
+       chunk, happens in place. */
+    q = xrealloc(&chain, p, 100);
+    CHECK(q == p);
+    CHECK(filled(q, 10, 1));
+    fill(q, 100, 2);
+    q = xrealloc(&chain, p, 20);
+    CHECK(q == p);
+    CHECK(filled(q, 20, 2));
+
+    /* So the next allocation follows the shrunk one closely. */
+    q = xmalloc(&chain, 1);
+    CHECK(q > p && q < p + 100);
+
+    xmalloc_cleanup(&chain);
+    CHECK(chain == NULL);
+}
+
+static void
+check_copies(void)
+{
+    struct xmalloc_block *chain = NULL;
+    char *p, *q, *r;
+
+    /* Something that isn't the newest allocation is copied, whether it's
+       grown or shrunk; the original stays where it was. */
+    p = xmalloc(&chain, 50);
+    fill(p, 50, 3);
+    q = xmalloc(&chain, 50);
+    fill(q, 50, 4);
+
+    r = xrealloc(&chain, p, 80);
+    CHECK(r != NULL && r != p && aligned(r));
+    CHECK(filled(r, 50, 3));
+    CHECK(filled(q, 50, 4));
+
+    r = xrealloc(&chain, q, 30);
+    CHECK(r != NULL && r != q);
+    CHECK(filled(r, 30, 4));
+    CHECK(filled(q, 50, 4));
+
+    /* The newest allocation is copied too if it can't grow in place: here,
+       because it would need more than any chunk holds. */
+    p = xmalloc(&chain, 100);
+    fill(p, 100, 5);
+    q = xrealloc(&chain, p, HUGE_SIZE);
+    CHECK(q != NULL && q != p && aligned(q));
+    CHECK(filled(q, 100, 5));
+    fill(q, HUGE_SIZE, 6);
+
+    /* A huge allocation gets a chunk to itself, but can still be shrunk. */
+    p = xrealloc(&chain, q, 10);
+    CHECK(p == q);
+    CHECK(filled(p, 10, 6));
+
+    /* And allocations still work after it. */
+    p = xmalloc(&chain, 16);
+    CHECK(p != NULL && aligned(p));
+
+    xmalloc_cleanup(&chain);
+}
+
+static void
+check_free(void)
+{
+    struct xmalloc_block *chain = NULL;
+    char *p, *q;
+
+    /* Setting the newest allocation's size to 0 frees it, so that the next
+       allocation reuses its space. */
+    xmalloc(&chain, 8);
+    p = xmalloc(&chain, 40);
+    CHECK(xrealloc(&chain, p, 0) == NULL);
+    q = xmalloc(&chain, 40);
+    CHECK(q == p);
+
+    /* Doing that to an older allocation returns NULL too, but the space isn't
+       reused. */
+    xmalloc(&chain, 8);
+    CHECK(xrealloc(&chain, q, 0) == NULL);
+    p = xmalloc(&chain, 40);
+    CHECK(p != q);
+
+    /* Only the newest allocation can be freed; after freeing it, the one
+       before isn't the newest. */
+    p = xmalloc(&chain, 8);
+    q = xmalloc(&chain, 8);
+    xrealloc(&chain, q, 0);
+    CHECK(xrealloc(&chain, p, 16) != p);
+
+    xmalloc_cleanup(&chain);
+}
+
+static void
+check_chunks(void)
+{
+    struct xmalloc_block *chain = NULL;
+    unsigned long long allocs0, bytes0, chunks0, allocs1, bytes1, chunks1;
+    char *p[1000];
+    int i;
+
+    /* Lots of small allocations share chunks; each one is aligned, and none
+       of them overlap. */
+    xmalloc_get_stats(&allocs0, &bytes0, &chunks0);
+    for (i = 0; i < 1000; i++) {
+        p[i] = xmalloc(&chain, 1 + i % 64);
+        fill(p[i], 1 + i % 64, i);
+    }
+    xmalloc_get_stats(&allocs1, &bytes1, &chunks1);
+
+    for (i = 0; i < 1000; i++) {
+        CHECK(aligned(p[i]));
+        CHECK(filled(p[i], 1 + i % 64, i));
+    }
+    CHECK(allocs1 - allocs0 == 1000);
+    CHECK(chunks1 - chunks0 >= 1 && chunks1 - chunks0 < 20);
+
+    xmalloc_cleanup(&chain);
+}
+
+static void
+check_strings(void)
+{
+    struct xmalloc_block *chain = NULL;
+    char big[5000];
+    const char *s;
+
+    /* xmvasprintf starts with a small buffer and grows it with xrealloc. */
+    memset(big, 'x', sizeof big - 1);
+    big[sizeof big - 1] = '\0';
+    s = xmasprintf(&chain, "%s", "short");
+    CHECK(strcmp(s, "short") == 0);
+    s = xmasprintf(&chain, "<%s>", big);
+    CHECK(strlen(s) == sizeof big + 1 && s[0] == '<' &&
+          s[sizeof big] == '>' && strspn(s + 1, "x") == sizeof big - 1);
+
+    xmalloc_cleanup(&chain);
+}
+
+static void
+check_not_on_chain(void)
+{
+    pid_t pid;
+    int status;
+
+    /* This is meant to crash, so do it in a child process. */
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        struct xmalloc_block *chain = NULL;
+        static max_align_t elsewhere[4];
+
+        signal(SIGSEGV, SIG_DFL);
+        xmalloc(&chain, 8);
+        xrealloc(&chain, &elsewhere[2], 16);
+        _exit(0);
+    }
+
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid &&
+          WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+}
+
+
+int
+main(void)
+{
+    check_in_place();
+    check_copies();
+    check_free();
+    check_chunks();
+    check_strings();
+    check_not_on_chain();
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
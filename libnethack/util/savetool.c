@@ -0,0 +1,780 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+/* This is an offline tool for checking and shrinking save files. For each file
+   named on the command line (or each file in a directory named on the command
+   line), it decodes every save backup and applies every save diff, checking
+   that each produces a binary save from this version of NetHack, that the turn
+   counter never goes backwards, that the save backups link up correctly, and
+   that every other line is of a known sort. It doesn't load the games, so it
+   can't catch a binary save that decodes correctly but won't load.
+
+   With -c, it also rewrites completed games in a more compact form. Completed
+   games are only ever replayed, so they don't need save backups as often as
+   games in progress do: most save backups are replaced by a save diff against
+   the previous save, keeping only as many as needed to replay the game at a
+   reasonable speed. Each save diff is also recalculated by searching the
+   previous save for matching data, and replaced if that comes out shorter.
+   Everything else (the messages, commands, and so on) is copied unchanged. The
+   result is checked to decode to exactly the same binary saves as the original,
+   and to have the same lines otherwise, before it replaces it.
+
+   Usage: savetool [-c] [-n] [-q] [-j threads] [-p percent] [-m diffs]
+                   file-or-directory...
+
+   -c: compact completed games
+   -n: with -c, report how much smaller the games would get, but don't
+       rewrite them
+   -q: only report files with problems (and the totals)
+   -j: the number of files to process at once (default: the number of CPUs)
+   -p, -m: when compacting, keep a save backup once the save diffs since the
+       last one add up to this percentage of its size, or there are this many
+       of them (default 2000, 1000; the game itself uses 400, 250)
+
+   Each file is independent, so they're processed in parallel by a pool of
+   threads. Files that are currently open in a game (or being watched or
+   replayed) are skipped. The exit status is 1 if any file has problems. */
+
+#ifdef AIMAKE_BUILDOS_MSWin32
+# error !AIMAKE_FAIL_SILENTLY! \
+    The save file tool does not currently work on Windows.
+#endif
+
+#include "hack.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Settings. */
+static boolean compact = FALSE;
+static boolean dry_run = FALSE;
+static boolean quiet = FALSE;
+static int backup_diff_percent = 2000;
+static int backup_max_diffs = 1000;
+
+/* The files to process; next_file is the next one that no thread has picked up
+   yet. */
+static char **files;
+static int file_count, next_file;
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Totals, and the lock that also keeps lines of output from being mixed. */
+static int files_ok, files_bad, files_skipped, files_compacted;
+static long bytes_before, bytes_after;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* What was found out about a log by check_log. */
+struct log_check {
+    enum nh_log_status status;
+    const char *error;          /* NULL if nothing was wrong */
+    int error_line;             /* 1-based */
+    int backups, diffs;
+    int first_turn, last_turn;
+    boolean bad_hint;           /* the first backup's location hint is wrong */
+    unsigned long *crcs;        /* of each binary save, in order */
+    int crc_count;
+};
+
+/* Called by check_log for each line after the header. For save backups and
+   save diffs, prev is the binary save before the line (NULL for the first save
+   backup) and save the one after it; for other lines, both are NULL. */
+typedef void (*line_visitor)(void *, const char *, const struct memfile *,
+                             const struct memfile *);
+
+/* The compacted version of a log, as it's being built. */
+struct compaction {
+    char *buf;
+    long len, size;
+    long last_backup;           /* offset of the last save backup written */
+    long backup_bytes;          /* length of the last save backup written */
+    long diff_bytes;            /* length of the save diffs since then */
+    int diff_count;
+    int backups;
+};
+
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-c] [-n] [-q] [-j threads] [-p percent] "
+            "[-m diffs] file-or-directory...\n", progname);
+    exit(2);
+}
+
+/* Splits a file's contents into lines, replacing the newlines with NULs.
+   Returns the number of lines, or -1 if the file doesn't end with a newline (a
+   sign that a process crashed while writing it). */
+static int
+split_lines(char *buf, long len, char ***lines)
+{
+    char *p, *nl;
+    int count = 0, size = 0;
+
+    *lines = NULL;
+    for (p = buf; p < buf + len; p = nl + 1) {
+        nl = memchr(p, '\x0a', buf + len - p);
+        if (!nl)
+            return -1;
+        *nl = '\0';
+
+        if (count == size) {
+            size = size * 2 + 64;
+            *lines = realloc(*lines, size * sizeof (char *));
+        }
+        (*lines)[count++] = p;
+    }
+
+    return count;
+}
+
+/* Checks that a binary save is from this version of NetHack, and returns its
+   turn counter (or -1 if it's from the wrong version). */
+static int
+save_turn(const struct memfile *mf)
+{
+    struct memfile view = *mf;
+
+    /* the version information is 12 bytes, then the turn counter */
+    if (mf->pos < 16)
+        return -1;
+
+    view.pos = 0;
+    if (!uptodate(&view, NULL))
+        return -1;
+    return mread32(&view);
+}
+
+/* Decodes every save backup and save diff in a log held in memory, whose lines
+   have been split by split_lines. Returns FALSE (setting lc->error) if
+   anything is wrong with it. */
+static boolean
+check_log(char *buf, char **lines, int line_count, struct log_check *lc,
+          line_visitor visit, void *visit_arg)
+{
+    struct nh_game_info gi;
+    struct memfile save, next;
+    boolean have_save = FALSE;
+    long last_backup = -1, hint = -1, location;
+    int i, recovery_count, turn;
+    char *l;
+
+    memset(lc, 0, sizeof *lc);
+    lc->first_turn = lc->last_turn = -1;
+
+    if (line_count < 4) {
+        lc->error = "file is too short";
+        lc->error_line = line_count + 1;
+        return FALSE;
+    }
+
+    lc->status = parse_log_header(lines, &gi, &recovery_count);
+    if (lc->status == LS_INVALID) {
+        lc->error = "invalid header";
+        lc->error_line = 1;
+        return FALSE;
+    }
+
+    for (i = 3; i < line_count; i++) {
+        l = lines[i];
+
+        if (i == 3 && *l != '*') {
+            lc->error = "no save backup after the header";
+            goto error;
+        }
+
+        if (*l != '*' && *l != '~') {
+            /* Commands start with a lowercase letter, user input with an
+               uppercase letter; time lines with '+' and messages with '-'. */
+            if (!islower((unsigned char)*l) && !isupper((unsigned char)*l) &&
+                *l != '+' && *l != '-') {
+                lc->error = "unrecognised line";
+                goto error;
+            }
+            if (visit)
+                visit(visit_arg, l, NULL, NULL);
+            continue;
+        }
+
+        mnew(&next, NULL);
+        lc->error = decode_save_line(l, have_save ? &save : NULL, &next);
+        if (lc->error) {
+            mfree(&next);
+            goto error;
+        }
+
+        if (*l == '*') {
+            /* Each save backup records where the previous one is, apart from
+               the first, which records a hint as to where the last one is. */
+            location = strtol(l + 1, NULL, 16);
+            if (last_backup == -1)
+                hint = location;
+            else if (location != last_backup) {
+                mfree(&next);
+                lc->error = "save backup has the wrong previous location";
+                goto error;
+            }
+            last_backup = l - buf;
+            lc->backups++;
+        } else
+            lc->diffs++;
+
+        turn = save_turn(&next);
+        if (turn < 0 || turn < lc->last_turn) {
+            mfree(&next);
+            lc->error = turn < 0 ?
+                "binary save is from the wrong version of NetHack" :
+                "turn counter goes backwards";
+            goto error;
+        }
+        if (lc->first_turn < 0)
+            lc->first_turn = turn;
+        lc->last_turn = turn;
+
+        if (lc->crc_count % 256 == 0)
+            lc->crcs = realloc(lc->crcs, (lc->crc_count + 256) *
+                               sizeof (unsigned long));
+        lc->crcs[lc->crc_count++] =
+            crc32(0, (const unsigned char *)next.buf, next.pos);
+
+        if (visit)
+            visit(visit_arg, l, have_save ? &save : NULL, &next);
+
+        if (have_save)
+            mfree(&save);
+        save = next;
+        have_save = TRUE;
+    }
+
+    if (have_save)
+        mfree(&save);
+    lc->bad_hint = hint != last_backup;
+    return TRUE;
+
+error:
+    if (have_save)
+        mfree(&save);
+    lc->error_line = i + 1;
+    return FALSE;
+}
+
+
+static void
+compact_append(struct compaction *cp, const char *s, long len)
+{
+    if (cp->len + len > cp->size) {
+        cp->size = (cp->len + len) * 2 + 4096;
+        cp->buf = realloc(cp->buf, cp->size);
+    }
+    memcpy(cp->buf + cp->len, s, len);
+    cp->len += len;
+}
+
+/* Appends a line, which doesn't include its newline. */
+static void
+compact_append_line(struct compaction *cp, const char *line)
+{
+    compact_append(cp, line, strlen(line));
+    compact_append(cp, "\x0a", 1);
+}
+
+/* Writes a save diff line for the given diff, returning its length. */
+static long
+compact_append_diff(struct compaction *cp, const struct memfile *diff)
+{
+    char *b64buf = malloc(base64size(diff->diffpos) + 2);
+    long len;
+
+    b64buf[0] = '~';
+    base64_encode_binary((const unsigned char *)diff->diffbuf, b64buf + 1,
+                         diff->diffpos);
+    len = strlen(b64buf);
+    b64buf[len++] = '\x0a';
+    compact_append(cp, b64buf, len);
+
+    free(b64buf);
+    return len;
+}
+
+/* The line_visitor that builds the compacted log. */
+static void
+compact_line(void *arg, const char *line, const struct memfile *prev,
+             const struct memfile *save)
+{
+    struct compaction *cp = arg;
+    struct memfile diff;
+    long start = cp->len, len = strlen(line) + 1, difflen = 0;
+    boolean keep_backup;
+    char header[11];
+
+    if (!save) {
+        compact_append_line(cp, line);
+        return;
+    }
+
+    /* A save backup is kept if it's the first one, or if the game would have
+       written one here at the cadence we're aiming for. */
+    keep_backup = *line == '*' &&
+        (!prev || cp->diff_count >= backup_max_diffs ||
+         cp->diff_bytes * 100 >= cp->backup_bytes * backup_diff_percent);
+
+    if (!keep_backup) {
+        /* Write a save diff, using whichever is shorter out of the original
+           line (if it's a save diff) and a recalculated diff. If the save
+           changed so much that the diff is no shorter than the save backup,
+           keep the save backup after all. */
+        mnew(&diff, (struct memfile *)prev);
+        mwrite_matching(&diff, save->buf, save->pos);
+        mdiffflush(&diff);
+        difflen = compact_append_diff(cp, &diff);
+        mfree(&diff);
+
+        if (len <= difflen) {
+            cp->len = start;
+            if (*line == '*')
+                keep_backup = TRUE;
+            else {
+                compact_append_line(cp, line);
+                difflen = len;
+            }
+        }
+    }
+
+    if (keep_backup) {
+        /* The first save backup's location is filled in at the end. */
+        snprintf(header, sizeof header, "*%08lx ",
+                 cp->backups ? (unsigned long)cp->last_backup : 0UL);
+        compact_append(cp, header, 10);
+        compact_append_line(cp, line + 10);
+
+        cp->last_backup = start;
+        cp->backup_bytes = len;
+        cp->diff_bytes = 0;
+        cp->diff_count = 0;
+        cp->backups++;
+    } else {
+        cp->diff_bytes += difflen;
+        cp->diff_count++;
+    }
+}
+
+/* Returns TRUE if two logs have the same lines apart from their save backups
+   and save diffs, i.e. the same header, messages, commands, and so on. */
+static boolean
+same_other_lines(char **lines1, int count1, char **lines2, int count2)
+{
+    int i = 0, j = 0;
+
+    for (;;) {
+        while (i < count1 && (*lines1[i] == '*' || *lines1[i] == '~'))
+            i++;
+        while (j < count2 && (*lines2[j] == '*' || *lines2[j] == '~'))
+            j++;
+        if (i == count1 || j == count2)
+            return i == count1 && j == count2;
+        if (strcmp(lines1[i++], lines2[j++]) != 0)
+            return FALSE;
+    }
+}
+
+/* Compacts a completed game. Returns FALSE (setting *error) if the compacted
+   version doesn't decode to the same saves as the original, or if anything
+   other than the saves changed. */
+static boolean
+compact_log(char *buf, char **lines, int line_count,
+            const struct log_check *orig, struct compaction *cp,
+            const char **error)
+{
+    struct log_check lc;
+    char **new_lines, hint[9];
+    int new_line_count, i;
+    boolean ok, same_lines = FALSE;
+
+    memset(cp, 0, sizeof *cp);
+    for (i = 0; i < 3; i++)
+        compact_append_line(cp, lines[i]);
+
+    if (!check_log(buf, lines, line_count, &lc, compact_line, cp)) {
+        free(lc.crcs);
+        *error = lc.error;      /* can't happen; it was checked already */
+        return FALSE;
+    }
+    free(lc.crcs);
+    lc.crcs = NULL;
+    lc.error = NULL;
+
+    /* The first save backup's location is a hint to where the last one is. It
+       starts just after the header, and its location just after the '*'. */
+    snprintf(hint, sizeof hint, "%08lx", (unsigned long)cp->last_backup);
+    memcpy(cp->buf + (lines[3] - buf) + 1, hint, 8);
+
+    /* Check the result, on a copy because split_lines replaces the newlines. */
+    {
+        char *copy = malloc(cp->len);
+
+        memcpy(copy, cp->buf, cp->len);
+        new_line_count = split_lines(copy, cp->len, &new_lines);
+        ok = new_line_count >= 0 &&
+            check_log(copy, new_lines, new_line_count, &lc, NULL, NULL);
+        if (ok)
+            same_lines = same_other_lines(lines, line_count, new_lines,
+                                          new_line_count);
+        free(new_lines);
+        free(copy);
+    }
+
+    if (!ok)
+        *error = lc.error ? lc.error : "compacted log is malformed";
+    else if (lc.bad_hint)
+        *error = "compacted log has the wrong location hint";
+    else if (lc.crc_count != orig->crc_count ||
+             memcmp(lc.crcs, orig->crcs,
+                    lc.crc_count * sizeof (unsigned long)) != 0)
+        *error = "compacted log decodes to different saves";
+    else if (!same_lines)
+        *error = "compacted log has different lines other than saves";
+    else
+        *error = NULL;
+
+    free(lc.crcs);
+    return !*error;
+}
+
+/* Replaces the file at path with the given contents, with the same
+   permissions, via a temporary file in the same directory, so that the file is
+   never partially written. */
+static boolean
+replace_file(const char *path, const struct stat *st, const char *buf,
+             long len)
+{
+    char tmppath[strlen(path) + 8];
+    long written = 0, ret;
+    int fd;
+
+    snprintf(tmppath, sizeof tmppath, "%s.XXXXXX", path);
+    fd = mkstemp(tmppath);
+    if (fd < 0)
+        return FALSE;
+
+    while (written < len) {
+        ret = write(fd, buf + written, len - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            goto error;
+        written += ret;
+    }
+
+    if (fchmod(fd, st->st_mode & 07777) < 0 || fsync(fd) < 0)
+        goto error;
+    /* This only works if we're running as root; otherwise, the owner is us,
+       which is fine too. */
+    if (fchown(fd, st->st_uid, st->st_gid) < 0) {}
+    if (close(fd) < 0 || rename(tmppath, path) < 0) {
+        unlink(tmppath);
+        return FALSE;
+    }
+    return TRUE;
+
+error:
+    close(fd);
+    unlink(tmppath);
+    return FALSE;
+}
+
+
+/* Reads a whole file into memory. Returns NULL (setting errno) on error. */
+static char *
+read_file(int fd, long len)
+{
+    char *buf = malloc(len + 1);
+    long got = 0, ret;
+
+    while (got < len) {
+        ret = read(fd, buf + got, len - got);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            if (!ret)
+                errno = EIO;    /* the file got shorter */
+            free(buf);
+            return NULL;
+        }
+        got += ret;
+    }
+    return buf;
+}
+
+static const char *
+status_name(enum nh_log_status status)
+{
+    switch (status) {
+    case LS_SAVED:
+        return "saved";
+    case LS_DONE:
+        return "completed";
+    case LS_IN_PROGRESS:
+        return "in progress";
+    case LS_CRASHED:
+        return "crashed";
+    default:
+        return "invalid";
+    }
+}
+
+static void
+process_file(const char *path)
+{
+    struct stat st;
+    struct flock fl;
+    struct log_check lc;
+    struct compaction cp = {0};
+    char *buf = NULL, **lines = NULL, result[BUFSZ];
+    const char *error = NULL;
+    int fd, line_count;
+    boolean bad = FALSE, skipped = FALSE, compacted = FALSE;
+
+    memset(&lc, 0, sizeof lc);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        snprintf(result, sizeof result, "could not open: %s",
+                 strerror(errno));
+        bad = TRUE;
+        goto report;
+    }
+
+    /* Games lock their save files while they have them open. We lock the file
+       for reading so that nothing can write to it while we look at it, but
+       first check that nothing else has it locked at all (our own lock
+       wouldn't stop a game reading it while we replace it). */
+    memset(&fl, 0, sizeof fl);
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    if (fcntl(fd, F_GETLK, &fl) < 0 || fl.l_type != F_UNLCK) {
+        snprintf(result, sizeof result, "skipped (in use)");
+        skipped = TRUE;
+        goto report;
+    }
+    fl.l_type = F_RDLCK;
+    if (fcntl(fd, F_SETLK, &fl) < 0) {
+        snprintf(result, sizeof result, "skipped (in use)");
+        skipped = TRUE;
+        goto report;
+    }
+
+    buf = read_file(fd, st.st_size);
+    if (!buf) {
+        snprintf(result, sizeof result, "could not read: %s",
+                 strerror(errno));
+        bad = TRUE;
+        goto report;
+    }
+
+    line_count = split_lines(buf, st.st_size, &lines);
+    if (line_count < 0) {
+        snprintf(result, sizeof result,
+                 "ends with a partial line (needs recovery)");
+        bad = TRUE;
+        goto report;
+    }
+
+    if (!check_log(buf, lines, line_count, &lc, NULL, NULL)) {
+        snprintf(result, sizeof result, "%s at line %d", lc.error,
+                 lc.error_line);
+        bad = TRUE;
+        goto report;
+    }
+
+    snprintf(result, sizeof result, "ok (%s, turns %d-%d, %d backup%s, "
+             "%d diff%s%s)", status_name(lc.status), lc.first_turn,
+             lc.last_turn, lc.backups, lc.backups == 1 ? "" : "s", lc.diffs,
+             lc.diffs == 1 ? "" : "s",
+             lc.bad_hint ? ", wrong location hint" : "");
+
+    if (!compact || lc.status != LS_DONE)
+        goto report;
+
+    if (!compact_log(buf, lines, line_count, &lc, &cp, &error)) {
+        snprintf(result, sizeof result, "could not compact: %s", error);
+        bad = TRUE;
+        goto report;
+    }
+
+    if (cp.len >= st.st_size) {
+        snprintf(result, sizeof result, "already compact (%ld bytes, "
+                 "%d backup%s)", (long)st.st_size, lc.backups,
+                 lc.backups == 1 ? "" : "s");
+        goto report;
+    }
+
+    if (!dry_run && !replace_file(path, &st, cp.buf, cp.len)) {
+        snprintf(result, sizeof result, "could not rewrite: %s",
+                 strerror(errno));
+        bad = TRUE;
+        goto report;
+    }
+
+    snprintf(result, sizeof result, "%s %ld -> %ld bytes (%d -> %d "
+             "backups)", dry_run ? "would compact" : "compacted",
+             (long)st.st_size, cp.len, lc.backups, cp.backups);
+    compacted = TRUE;
+
+report:
+    pthread_mutex_lock(&report_lock);
+    if (bad)
+        files_bad++;
+    else if (skipped)
+        files_skipped++;
+    else
+        files_ok++;
+    if (compacted) {
+        files_compacted++;
+        bytes_before += st.st_size;
+        bytes_after += cp.len;
+    }
+    if (bad || !quiet)
+        printf("%s: %s\n", path, result);
+    pthread_mutex_unlock(&report_lock);
+
+    if (fd >= 0)
+        close(fd);      /* also releases the lock */
+    free(cp.buf);
+    free(lc.crcs);
+    free(lines);
+    free(buf);
+}
+
+static void *
+worker(void *unused)
+{
+    int i;
+
+    (void) unused;
+
+    for (;;) {
+        pthread_mutex_lock(&work_lock);
+        i = next_file++;
+        pthread_mutex_unlock(&work_lock);
+
+        if (i >= file_count)
+            return NULL;
+        process_file(files[i]);
+    }
+}
+
+
+static void
+add_file(const char *path)
+{
+    if (file_count % 256 == 0)
+        files = realloc(files, (file_count + 256) * sizeof (char *));
+    files[file_count++] = strdup(path);
+}
+
+/* Adds the given path, or if it's a directory, the regular files in it. */
+static void
+add_path(const char *path)
+{
+    struct stat st;
+    struct dirent *de;
+    DIR *dir;
+
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        add_file(path);     /* an error is reported when it's processed */
+        return;
+    }
+
+    dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Could not read directory %s: %s\n", path,
+                strerror(errno));
+        files_bad++;
+        return;
+    }
+
+    while ((de = readdir(dir))) {
+        char filepath[strlen(path) + strlen(de->d_name) + 2];
+
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(filepath, sizeof filepath, "%s/%s", path, de->d_name);
+        if (stat(filepath, &st) == 0 && S_ISREG(st.st_mode))
+            add_file(filepath);
+    }
+    closedir(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t *threads;
+    int opt, i, ret, thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "cnqj:p:m:")) != -1) {
+        switch (opt) {
+        case 'c':
+            compact = TRUE;
+            break;
+        case 'n':
+            dry_run = TRUE;
+            break;
+        case 'q':
+            quiet = TRUE;
+            break;
+        case 'j':
+            thread_count = atoi(optarg);
+            break;
+        case 'p':
+            backup_diff_percent = atoi(optarg);
+            break;
+        case 'm':
+            backup_max_diffs = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind == argc || backup_diff_percent <= 0 || backup_max_diffs <= 0)
+        usage(argv[0]);
+
+    for (i = optind; i < argc; i++)
+        add_path(argv[i]);
+
+    if (thread_count > file_count)
+        thread_count = file_count;
+    if (thread_count < 1)
+        thread_count = 1;
+
+    threads = malloc(thread_count * sizeof (pthread_t));
+    for (i = 0; i < thread_count; i++)
+        if ((ret = pthread_create(threads + i, NULL, worker, NULL)) != 0) {
+            fprintf(stderr, "Could not create thread: %s\n", strerror(ret));
+            if (i == 0)
+                return 2;
+            thread_count = i;
+            break;
+        }
+    for (i = 0; i < thread_count; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    printf("%d file%s: %d ok, %d with problems, %d skipped", file_count,
+           file_count == 1 ? "" : "s", files_ok, files_bad, files_skipped);
+    if (compact)
+        printf("; %s %d, saving %ld bytes", dry_run ? "would compact" :
+               "compacted", files_compacted, bytes_before - bytes_after);
+    printf("\n");
+
+    for (i = 0; i < file_count; i++)
+        free(files[i]);
+    free(files);
+
+    return files_bad ? 1 : 0;
+}
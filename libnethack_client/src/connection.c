@@ -7,6 +7,7 @@
  */
 
 #include "nhclient.h"
+#include <zlib.h>
 
 struct nhnet_server_version nhnet_server_ver;
 
@@ -15,6 +16,12 @@ static int connection_id;
 static int net_active;
 int conn_err, error_retry_ok;
 
+/* If the server agreed to compress the connection, everything after the auth
+   response is a raw deflate stream in each direction. The streams last for the
+   whole connection, and are sync-flushed at the end of each message. */
+static int compressing;
+static z_stream zsend, zrecv;
+
 /* Prevent automatic retries during connection setup or teardown.
  * When the connection is being set up, it is better to report a failure
  * immediately; when the connection is being closed it doesn't matter if it
@@ -77,27 +84,112 @@ test_restore_connection(void)
 }
 
 
+static void
+start_compression(void)
+{
+    memset(&zsend, 0, sizeof (zsend));
+    memset(&zrecv, 0, sizeof (zrecv));
+    if (deflateInit2(&zsend, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+    if (inflateInit2(&zrecv, -15) != Z_OK) {
+        deflateEnd(&zsend);
+        return;
+    }
+    compressing = TRUE;
+}
+
+
+static void
+end_compression(void)
+{
+    if (!compressing)
+        return;
+    deflateEnd(&zsend);
+    inflateEnd(&zrecv);
+    compressing = FALSE;
+}
+
+
 static int
-send_json_msg(json_t * jmsg)
+send_all(const char *data, int len)
 {
-    char *msgstr;
-    int msglen, datalen, ret;
+    int datalen, ret;
 
-    msgstr = json_dumps(jmsg, JSON_COMPACT);
-    msglen = strlen(msgstr);
     datalen = 0;
-    do {
-        ret = send(sockfd, &msgstr[datalen], msglen - datalen, 0);
+    while (datalen < len) {
+        ret = send(sockfd, &data[datalen], len - datalen, 0);
         if (ret == -1 && errno == EINTR)
             continue;
-        else if (ret == -1) {
-            free(msgstr);
+        else if (ret == -1)
             return FALSE;
-        }
         datalen += ret;
-    } while (datalen < msglen);
+    }
+
+    return TRUE;
+}
+
+
+static int
+send_json_msg(json_t * jmsg)
+{
+    char *msgstr, zbuf[16384];
+    int msglen, ret;
+
+    msgstr = json_dumps(jmsg, JSON_COMPACT);
+    msglen = strlen(msgstr);
+
+    if (!compressing) {
+        ret = send_all(msgstr, msglen);
+        free(msgstr);
+        return ret;
+    }
+
+    zsend.next_in = (unsigned char *)msgstr;
+    zsend.avail_in = msglen;
+    ret = TRUE;
+    do {
+        zsend.next_out = (unsigned char *)zbuf;
+        zsend.avail_out = sizeof (zbuf);
+        if (deflate(&zsend, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+            ret = FALSE;
+            break;
+        }
+        ret = send_all(zbuf, sizeof (zbuf) - zsend.avail_out);
+    } while (ret && (zsend.avail_in || !zsend.avail_out));
 
     free(msgstr);
+    return ret;
+}
+
+
+/* Decompress received data into rbuf, growing it as necessary. Returns FALSE
+   if the data is broken, or if there is too much of it. */
+static int
+inflate_json_msg(char *zbuf, int zlen, char **rbuf, int *rbufsize,
+                 int *datalen)
+{
+    int ret;
+
+    zrecv.next_in = (unsigned char *)zbuf;
+    zrecv.avail_in = zlen;
+    do {
+        if (*datalen >= *rbufsize - 1) {
+            if (*rbufsize >= 16 * 1024 * 1024)
+                return FALSE;
+            *rbufsize *= 2;
+            *rbuf = realloc(*rbuf, *rbufsize);
+        }
+
+        /* leave the last byte in the buffer free for the '\0' */
+        zrecv.next_out = (unsigned char *)&(*rbuf)[*datalen];
+        zrecv.avail_out = *rbufsize - *datalen - 1;
+        ret = inflate(&zrecv, Z_SYNC_FLUSH);
+        *datalen = *rbufsize - 1 - zrecv.avail_out;
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return FALSE;
+    } while (zrecv.avail_in || !zrecv.avail_out);
+
     return TRUE;
 }
 
@@ -109,7 +201,7 @@ send_json_msg(json_t * jmsg)
 static json_t *
 receive_json_msg(void)
 {
-    char *rbuf, *bp;
+    char *rbuf, *bp, zbuf[16384];
     int datalen, ret, rbufsize;
     json_t *recv_msg;
     json_error_t err;
@@ -139,15 +231,32 @@ receive_json_msg(void)
             return NULL;
         }
 
-        /* leave the last byte in the buffer free for the '\0' */
-        ret = recv(sockfd, &rbuf[datalen], rbufsize - datalen - 1, 0);
-        if (ret == -1 && errno == EINTR)
-            continue;
-        else if (ret <= 0) {
-            free(rbuf);
-            return NULL;
+        if (compressing) {
+            ret = recv(sockfd, zbuf, sizeof (zbuf), 0);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            else if (ret <= 0) {
+                free(rbuf);
+                return NULL;
+            }
+            if (!inflate_json_msg(zbuf, ret, &rbuf, &rbufsize, &datalen)) {
+                print_error("Broken compressed data received from server.");
+                free(rbuf);
+                return json_object();
+            }
+            if (!datalen)
+                continue;
+        } else {
+            /* leave the last byte in the buffer free for the '\0' */
+            ret = recv(sockfd, &rbuf[datalen], rbufsize - datalen - 1, 0);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            else if (ret <= 0) {
+                free(rbuf);
+                return NULL;
+            }
+            datalen += ret;
         }
-        datalen += ret;
 
         rbuf[datalen] = '\0';   /* terminate the string */
         bp = &rbuf[datalen - 1];
@@ -468,7 +577,9 @@ do_connect(const char *host, int port, const char *user, const char *pass,
 
     in_connect_disconnect = TRUE;
     sockfd = fd;
-    jmsg = json_pack("{ss,ss}", "username", user, "password", pass);
+    end_compression();
+    jmsg = json_pack("{ss,ss,ss}", "username", user, "password", pass,
+                     "compress", "deflate");
     if (reg_user) {
         if (email)
             json_object_set_new(jmsg, "email", json_string(email));
@@ -490,6 +601,11 @@ do_connect(const char *host, int port, const char *user, const char *pass,
         sockfd = -1;
         return NO_CONNECTION;
     }
+    /* older servers ignore the request for compression */
+    if (json_unpack(jmsg, "{so*}", "compress", &jarr) != -1 &&
+        json_is_string(jarr) && !strcmp(json_string_value(jarr), "deflate"))
+        start_compression();
+
     /* the "version" field in the response is optional */
     if (json_unpack(jmsg, "{so*}", "version", &jarr) != -1 &&
         json_is_array(jarr) && json_array_size(jarr) >= 3) {
@@ -545,6 +661,7 @@ nhnet_disconnect(void)
             json_decref(msg);
         close(sockfd);
     }
+    end_compression();
     sockfd = -1;
     connection_id = 0;
     conn_err = FALSE;
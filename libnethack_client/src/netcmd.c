@@ -8,6 +8,7 @@
 
 #include "nhclient.h"
 #include "menulist.h"
+#include "player_info.h"
 
 struct netcmd {
     const char *name;
@@ -177,74 +178,38 @@ static json_t *
 cmd_update_status(json_t *params, int display_only)
 {
     static struct nh_player_info player;
+    const struct player_info_field *f;
+    char *field;
     int i;
     json_t *p;
 
-    if ((p = json_object_get(params, "plname")))
-        strncpy(player.plname, json_string_value(p), PL_NSIZ - 1);
-    if ((p = json_object_get(params, "rank")))
-        strncpy(player.rank, json_string_value(p), PL_NSIZ - 1);
-    if ((p = json_object_get(params, "level_desc")))
-        strncpy(player.level_desc, json_string_value(p), COLNO - 1);
-    if ((p = json_object_get(params, "x")))
-        player.x = json_integer_value(p);
-    if ((p = json_object_get(params, "y")))
-        player.y = json_integer_value(p);
-    if ((p = json_object_get(params, "z")))
-        player.z = json_integer_value(p);
-    if ((p = json_object_get(params, "score")))
-        player.score = json_integer_value(p);
-    if ((p = json_object_get(params, "xp")))
-        player.xp = json_integer_value(p);
-    if ((p = json_object_get(params, "gold")))
-        player.gold = json_integer_value(p);
-    if ((p = json_object_get(params, "moves")))
-        player.moves = json_integer_value(p);
-    if ((p = json_object_get(params, "max_rank_sz")))
-        player.max_rank_sz = json_integer_value(p);
-    if ((p = json_object_get(params, "st")))
-        player.st = json_integer_value(p);
-    if ((p = json_object_get(params, "st_extra")))
-        player.st_extra = json_integer_value(p);
-    if ((p = json_object_get(params, "dx")))
-        player.dx = json_integer_value(p);
-    if ((p = json_object_get(params, "co")))
-        player.co = json_integer_value(p);
-    if ((p = json_object_get(params, "in")))
-        player.in = json_integer_value(p);
-    if ((p = json_object_get(params, "wi")))
-        player.wi = json_integer_value(p);
-    if ((p = json_object_get(params, "ch")))
-        player.ch = json_integer_value(p);
-    if ((p = json_object_get(params, "align")))
-        player.align = json_integer_value(p);
-    if ((p = json_object_get(params, "hp")))
-        player.hp = json_integer_value(p);
-    if ((p = json_object_get(params, "hpmax")))
-        player.hpmax = json_integer_value(p);
-    if ((p = json_object_get(params, "en")))
-        player.en = json_integer_value(p);
-    if ((p = json_object_get(params, "enmax")))
-        player.enmax = json_integer_value(p);
-    if ((p = json_object_get(params, "ac")))
-        player.ac = json_integer_value(p);
-    if ((p = json_object_get(params, "level")))
-        player.level = json_integer_value(p);
-    if ((p = json_object_get(params, "coinsym")))
-        player.coinsym = json_integer_value(p);
-    if ((p = json_object_get(params, "monnum")))
-        player.monnum = json_integer_value(p);
-    if ((p = json_object_get(params, "cur_monnum")))
-        player.cur_monnum = json_integer_value(p);
-    if ((p = json_object_get(params, "can_enhance")))
-        player.can_enhance = json_integer_value(p);
-    if ((p = json_object_get(params, "statusitems"))) {
-        player.nr_items = json_array_size(p);
-        if (player.nr_items > STATUSITEMS_MAX)
-            player.nr_items = STATUSITEMS_MAX;
-        for (i = 0; i < player.nr_items; i++)
-            strncpy(player.statusitems[i],
-                    json_string_value(json_array_get(p, i)), ITEMLEN - 1);
+    for (f = player_info_fields; f->name; f++) {
+        if (!(p = json_object_get(params, f->name)))
+            continue;
+
+        field = (char *)&player + f->offset;
+        switch (f->type) {
+        case PIF_STRING:
+            strncpy(field, json_string_value(p), f->size - 1);
+            break;
+        case PIF_INT:
+            *(int *)field = json_integer_value(p);
+            break;
+        case PIF_CHAR:
+            *field = json_integer_value(p);
+            break;
+        case PIF_BOOL:
+            *(nh_bool *)field = json_integer_value(p);
+            break;
+        case PIF_STATUSITEMS:
+            player.nr_items = json_array_size(p);
+            if (player.nr_items > STATUSITEMS_MAX)
+                player.nr_items = STATUSITEMS_MAX;
+            for (i = 0; i < player.nr_items; i++)
+                strncpy(player.statusitems[i],
+                        json_string_value(json_array_get(p, i)), ITEMLEN - 1);
+            break;
+        }
     }
 
     windowprocs.win_update_status(&player);
@@ -612,19 +577,35 @@ cmd_display_objects(json_t *params, int display_only)
 }
 
 
+/* The item lists last received, as the base for diffs; indexed by invent. */
+static struct nh_objlist item_lists[2];
+
 static json_t *
 cmd_list_items(json_t *params, int display_only)
 {
-    struct nh_objlist objlist;
-    int i, invent;
-    json_t *jarr;
+    struct nh_objlist objlist, *base;
+    int i, invent, index;
+    json_t *jarr, *jdiff, *jobj;
 
     if (json_unpack
-        (params, "{so,si,si!}", "items", &jarr, "icount",
-         &(objlist.icount), "invent", &invent) == -1) {
+        (params, "{si,si*}", "icount", &(objlist.icount), "invent",
+         &invent) == -1) {
         print_error("Incorrect parameter type in cmd_list_items");
         return NULL;
     }
+    base = &item_lists[invent ? 1 : 0];
+
+    /* the list is sent either in full, or as a diff against the previous list,
+       in which items are replaced by their index in the previous list if they
+       haven't changed */
+    jarr = json_object_get(params, "items");
+    jdiff = json_object_get(params, "diff");
+    if (!jarr == !jdiff) {
+        print_error("Incorrect parameter type in cmd_list_items");
+        return NULL;
+    }
+    if (jdiff)
+        jarr = jdiff;
 
     if (!json_is_array(jarr) || json_array_size(jarr) != objlist.icount) {
         print_error("Damaged items array in cmd_list_items");
@@ -634,8 +615,29 @@ cmd_list_items(json_t *params, int display_only)
     objlist.items = malloc(objlist.icount * sizeof (struct nh_objitem));
     objlist.size = objlist.icount;
 
-    for (i = 0; i < objlist.icount; i++)
-        json_read_objitem(json_array_get(jarr, i), objlist.items + i);
+    for (i = 0; i < objlist.icount; i++) {
+        jobj = json_array_get(jarr, i);
+        if (jdiff && json_is_integer(jobj)) {
+            index = json_integer_value(jobj);
+            if (index < 0 || index >= base->icount) {
+                print_error("Damaged items diff in cmd_list_items");
+                free(objlist.items);
+                return NULL;
+            }
+            objlist.items[i] = base->items[index];
+        } else
+            json_read_objitem(jobj, objlist.items + i);
+    }
+
+    /* keep a copy for the next diff; the window procs take objlist */
+    dealloc_objmenulist(base);
+    if (objlist.icount) {
+        base->items = malloc(objlist.icount * sizeof (struct nh_objitem));
+        base->size = base->icount = objlist.icount;
+        memcpy(base->items, objlist.items,
+               objlist.icount * sizeof (struct nh_objitem));
+    }
+
     windowprocs.win_list_items(&objlist, invent);
 
     return NULL;
@@ -36,10 +36,14 @@ extern enum nh_play_status EXPORT (nh_play_game) (int fd);
 extern enum nh_create_response EXPORT(nh_create_game) (
     int fd, struct nh_option_desc *opts);
 extern const_char_p_const_p EXPORT(nh_get_copyright_banner) (void);
+extern void EXPORT(nh_get_xmalloc_stats) (
+    unsigned long long *allocations, unsigned long long *bytes,
+    unsigned long long *chunks);
 
 /* log.c */
 extern enum nh_log_status EXPORT(nh_get_savegame_status) (
     int fd, struct nh_game_info *si);
+extern void EXPORT(nh_set_backup_cadence) (int diff_percent, int max_diffs);
 
 /* cmd.c */
 extern nh_cmd_desc_p EXPORT(nh_get_commands) (int *count);
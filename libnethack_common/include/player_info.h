@@ -0,0 +1,67 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+#ifndef PLAYER_INFO_H
+# define PLAYER_INFO_H
+
+# include <stddef.h>
+# include "nethack_types.h"
+
+/* The fields of struct nh_player_info that update_status sends over the
+   network, each as PIF(name, type, flags). Adding a field to the struct and
+   to this list is all that is needed to transmit it. The order is the order
+   the fields are written in, which affects the order of keys in the JSON. */
+# define PLAYER_INFO_FIELDS                         \
+    PIF(plname, PIF_STRING, PIF_INITIAL_ONLY)       \
+    PIF(coinsym, PIF_CHAR, PIF_INITIAL_ONLY)        \
+    PIF(max_rank_sz, PIF_INT, PIF_INITIAL_ONLY)     \
+    PIF(rank, PIF_STRING, 0)                        \
+    PIF(level_desc, PIF_STRING, 0)                  \
+    PIF(x, PIF_INT, 0)                              \
+    PIF(y, PIF_INT, 0)                              \
+    PIF(z, PIF_INT, 0)                              \
+    PIF(score, PIF_INT, 0)                          \
+    PIF(xp, PIF_INT, 0)                             \
+    PIF(gold, PIF_INT, 0)                           \
+    PIF(moves, PIF_INT, 0)                          \
+    PIF(st, PIF_INT, 0)                             \
+    PIF(st_extra, PIF_INT, 0)                       \
+    PIF(dx, PIF_INT, 0)                             \
+    PIF(co, PIF_INT, 0)                             \
+    PIF(in, PIF_INT, 0)                             \
+    PIF(wi, PIF_INT, 0)                             \
+    PIF(ch, PIF_INT, 0)                             \
+    PIF(align, PIF_INT, 0)                          \
+    PIF(hp, PIF_INT, 0)                             \
+    PIF(hpmax, PIF_INT, 0)                          \
+    PIF(en, PIF_INT, 0)                             \
+    PIF(enmax, PIF_INT, 0)                          \
+    PIF(ac, PIF_INT, 0)                             \
+    PIF(level, PIF_INT, 0)                          \
+    PIF(monnum, PIF_INT, 0)                         \
+    PIF(cur_monnum, PIF_INT, 0)                     \
+    PIF(can_enhance, PIF_BOOL, 0)                   \
+    PIF(statusitems, PIF_STATUSITEMS, 0)
+
+enum player_info_type {
+    PIF_STRING,         /* char[], sent as a string */
+    PIF_INT,
+    PIF_CHAR,           /* sent as a number */
+    PIF_BOOL,           /* nh_bool, sent as a number */
+    PIF_STATUSITEMS,    /* the first nr_items statusitems, as an array */
+};
+
+/* fields that are only sent with the first update, not when they change */
+# define PIF_INITIAL_ONLY 0x1
+
+struct player_info_field {
+    const char *name;
+    size_t offset, size;
+    enum player_info_type type;
+    int flags;
+};
+
+/* PLAYER_INFO_FIELDS as a table, terminated by an entry with a NULL name */
+extern const struct player_info_field player_info_fields[];
+
+#endif
@@ -13,14 +13,16 @@ struct tm;
 #ifndef XMALLOC_H
 # define XMALLOC_H
 
-struct xmalloc_block {
-    void *mem;
-    struct xmalloc_block *next;
-};
+/* An xmalloc chain is a (struct xmalloc_block *) that starts out NULL; what it
+   points to is private to xmalloc.c. */
+struct xmalloc_block;
 
 extern void *xmalloc(struct xmalloc_block **blocklist, size_t size);
 extern void xmalloc_cleanup(struct xmalloc_block **blocklist);
 extern void *xrealloc(struct xmalloc_block **blocklist, void *ptr, size_t size);
+extern void xmalloc_get_stats(unsigned long long *allocations,
+                              unsigned long long *bytes,
+                              unsigned long long *chunks);
 extern char *xmvasprintf(struct xmalloc_block **blocklist,
                          const char *fmt, va_list args) PRINTFLIKE(2,0);
 extern char *xmastrftime(struct xmalloc_block **blocklist,
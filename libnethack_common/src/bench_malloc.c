@@ -0,0 +1,76 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+/* Counts calls to the allocation functions, for the benchmarks
+   (bench_nethack and bench_uncursed). This is an LD_PRELOAD library for glibc
+   systems. If aimake compiled it like the rest of the tree, it would see an
+   object defining malloc and link it into every program and library that
+   calls malloc; so a rule in aimake.rules (_build_bench_malloc) runs the
+   compiler on it directly, giving
+
+       libnethack_common/src/bench_malloc.c/bench_malloc.preload
+
+   in the build directory. Run a benchmark with LD_PRELOAD set to that file.
+   The benchmarks look up bench_malloc_counts at runtime, and leave the
+   allocation counts out of their reports if it isn't there.
+
+   The replacements pass everything on to glibc's own allocator, so memory from
+   functions that aren't replaced here (such as posix_memalign) can still be
+   freed. The counters aren't atomic; the benchmarks are single-threaded. */
+
+#ifndef BENCH_MALLOC_SHIM
+# error !AIMAKE_FAIL_SILENTLY! \
+    bench_malloc.c is only built as an LD_PRELOAD library.
+#endif
+
+#include <stdlib.h>
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+extern void bench_malloc_counts(unsigned long long *, unsigned long long *,
+                                unsigned long long *);
+
+static unsigned long long malloc_calls, realloc_calls, free_calls;
+
+void *
+malloc(size_t size)
+{
+    malloc_calls++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    malloc_calls++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    realloc_calls++;
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    /* free(NULL) costs nothing, and there are a lot of them */
+    if (ptr)
+        free_calls++;
+    __libc_free(ptr);
+}
+
+/* malloc and calloc both count as mallocs. */
+void
+bench_malloc_counts(unsigned long long *mallocs, unsigned long long *reallocs,
+                    unsigned long long *frees)
+{
+    *mallocs = malloc_calls;
+    *reallocs = realloc_calls;
+    *frees = free_calls;
+}
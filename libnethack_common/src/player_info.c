@@ -0,0 +1,13 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* NetHack may be freely redistributed.  See license for details. */
+
+#include "player_info.h"
+
+#define PIF(name, type, flags)                                          \
+    {#name, offsetof(struct nh_player_info, name),                      \
+     sizeof (((struct nh_player_info *)0)->name), type, flags},
+
+const struct player_info_field player_info_fields[] = {
+    PLAYER_INFO_FIELDS
+    {NULL, 0, 0, 0, 0}
+};
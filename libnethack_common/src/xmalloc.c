@@ -4,6 +4,9 @@
 /* NetHack may be freely redistributed.  See license for details. */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <signal.h>
 #include <stdio.h>
 #include <time.h>
@@ -15,29 +18,108 @@
    record the pointers we allocate on chains, and after a specific point in
    time, we know that all pointers on the chain should have died (e.g. messages
    by the end of the turn, API returns by the next API call). Thus, at that
-   point, we can just clean up all the pointers at once. */
+   point, we can just clean up all the pointers at once.
+
+   Because nothing on a chain is freed individually, there's no need to ask
+   malloc for each pointer separately. Instead, a chain is a list of large
+   chunks, and allocations are carved off the end of the newest chunk; cleaning
+   up a chain frees just the chunks. Each allocation is preceded by its size,
+   so that xrealloc can copy it. */
+
+/* Precedes every allocation; the union makes sure that what follows it is
+   suitably aligned for anything. */
+union xmalloc_header {
+    size_t size;
+    max_align_t align;
+};
+
+struct xmalloc_block {
+    struct xmalloc_block *next;    /* the chunk that filled up before this */
+    size_t size;                   /* bytes of space in mem */
+    size_t used;                   /* bytes of mem allocated so far */
+    size_t last;                   /* offset of the newest allocation, or
+                                      NO_LAST_ALLOCATION */
+    max_align_t mem[];
+};
+
+#define NO_LAST_ALLOCATION ((size_t)-1)
+
+/* The first chunk on a chain is small, because most chains only ever hold a
+   few short strings; subsequent chunks double in size up to a limit. Anything
+   larger than the limit gets a chunk to itself. */
+#define XMALLOC_FIRST_CHUNK (1024 - sizeof (struct xmalloc_block))
+#define XMALLOC_MAX_CHUNK (64 * 1024)
+
+/* Running totals for benchmarks; see xmalloc_get_stats(). These describe the
+   process, not any game, so they are never reset. */
+static struct {
+    unsigned long long allocations, bytes, chunks;
+} xmalloc_stats;
+
+/* The amount of chunk space an allocation of the given size uses up, or 0 if
+   the size is absurdly large. */
+static size_t
+xmalloc_space_needed(size_t size)
+{
+    const size_t align = sizeof (union xmalloc_header);
+
+    if (size > SIZE_MAX - 2 * align)
+        return 0;
+    return (sizeof (union xmalloc_header) + size + align - 1) / align * align;
+}
 
 void *
 xmalloc(struct xmalloc_block **blocklist, size_t size)
 {
-    void *mem;
-    struct xmalloc_block *b;
+    struct xmalloc_block *b = *blocklist;
+    union xmalloc_header *h;
+    size_t need = xmalloc_space_needed(size);
 
-    mem = malloc(size);
-    if (!mem)
+    if (!need)
         return NULL;
 
-    b = malloc(sizeof (struct xmalloc_block));
-    if (!b) {
-        free(mem);
-        return NULL;
+    if (!b || b->size - b->used < need) {
+        size_t chunksize = b ? b->size * 2 : XMALLOC_FIRST_CHUNK;
+
+        if (chunksize > XMALLOC_MAX_CHUNK)
+            chunksize = XMALLOC_MAX_CHUNK;
+        if (chunksize < need)
+            chunksize = need;
+
+        b = malloc(sizeof (struct xmalloc_block) + chunksize);
+        if (!b)
+            return NULL;
+        xmalloc_stats.chunks++;
+
+        b->next = *blocklist;
+        b->size = chunksize;
+        b->used = 0;
+        b->last = NO_LAST_ALLOCATION;
+        *blocklist = b;
     }
 
-    b->mem = mem;
-    b->next = *blocklist;
-    *blocklist = b;
+    h = (union xmalloc_header *)((char *)b->mem + b->used);
+    h->size = size;
+    b->last = b->used;
+    b->used += need;
+
+    xmalloc_stats.allocations++;
+    xmalloc_stats.bytes += size;
+    return h + 1;
+}
+
 
-    return mem;
+/* Reports how many allocations have been made on xmalloc chains since the
+   process started, how many bytes they asked for, and how many chunks had to
+   be requested from malloc to hold them. Each program that links this file
+   has its own totals. */
+void
+xmalloc_get_stats(unsigned long long *allocations, unsigned long long *bytes,
+                  unsigned long long *chunks)
+{
+    *allocations = xmalloc_stats.allocations;
+    *bytes = xmalloc_stats.bytes;
+    *chunks = xmalloc_stats.chunks;
 }
 
 
@@ -50,75 +132,83 @@ xmalloc_cleanup(struct xmalloc_block **blocklist)
         b = *blocklist;
         *blocklist = b->next;
 
-        free(b->mem);
         free(b);
     }
 }
 
 /* Resizes a pointer that's on an xmalloc chain.
 
-   This is intended for use with pointers that have only just been allocated,
-   although it will work for any pointer on the chain.
+   This is intended for use with pointers that have only just been allocated;
+   the most recent allocation on a chain can usually be resized in place. It
+   will work for any pointer on the chain, though (by copying it).
 
-   It can also be used to free a pointer "early", by setting size to 0. */
+   It can also be used to free a pointer "early", by setting size to 0 (although
+   the memory is only reused if it was the most recent allocation). */
 void *
 xrealloc(struct xmalloc_block **blocklist, void *ptr, size_t size)
 {
+    struct xmalloc_block *b = *blocklist;
+    union xmalloc_header *h;
+    void *newptr;
+    size_t need;
+
     if (!ptr) /* same special case as realloc */
         return xmalloc(blocklist, size);
 
-    /* This loop effectively treats a blocklist as being defined recursively: a
-       blocklist contains a memory location and another (possibly NULL)
-       blocklist. This leads to the following neat method of looping over a
-       singly linked list in a way that allows deletion of elements. */
-    while (*blocklist) {
-        if ((*blocklist)->mem == ptr) {
+    h = (union xmalloc_header *)ptr - 1;
+
+    if (b && b->last != NO_LAST_ALLOCATION &&
+        (char *)b->mem + b->last == (char *)h) {
 
-            if (size > 0) {
+        if (size == 0) {
+            b->used = b->last;
+            b->last = NO_LAST_ALLOCATION;
+            return NULL;
+        }
 
-                void *newptr = realloc(ptr, size);
-                if (!newptr)
-                    return NULL;
+        need = xmalloc_space_needed(size);
+        if (need && need <= b->size - b->last) {
+            b->used = b->last + need;
+            h->size = size;
+            return ptr;
+        }
 
-                (*blocklist)->mem = newptr;
-                return newptr;
-                
-            } else {
+    } else {
 
-                /* My reading of C11 implies that it's possible for realloc(ptr,
-                   0) to deallocate ptr, then allocate and return a valid block
-                   of memory (that cannot be dereferenced, due to being
-                   effectively zero bytes long). Obviously, this is stupid, but
-                   we may as well use free() to dodge the whole issue... */
+        /* Check that the pointer is actually on the chain. */
+        for (; b; b = b->next)
+            if ((char *)h >= (char *)b->mem &&
+                (char *)h < (char *)b->mem + b->used)
+                break;
 
-                struct xmalloc_block *oldblock = *blocklist;
-                (*blocklist) = (*blocklist)->next;
-                
-                free(ptr);
-                free(oldblock);
-                return NULL;
-            }
+        /* We didn't find it. The correct reaction to memory corruption like
+           this is a segfault, the same way as a NULL dereference or the like.
 
+           C11 actually officially defines segfaults as something that exist,
+           although it doesn't require an implementation to produce them in
+           any situation other than a function explicitly saying "this
+           situation is a segfault"; that is, however, the situation we have
+           here. Some older non-UNIX compilers may not be aware of segfaults,
+           though, so we substitute an abort() in that situation. */
+        if (!b) {
+#ifdef SIGSEGV
+            raise(SIGSEGV);
+#endif
+            /* We alo substitute an abort if a SIGSEGV handler returned. (That
+               shouldn't happen either.) */
+            abort();
         }
-        blocklist = &((*blocklist)->next);
-    }
 
-    /* We didn't find it. The correct reaction to memory corruption like this is
-       a segfault, the same way as a NULL dereference or the like.
+        if (size == 0)
+            return NULL;
+    }
 
-       C11 actually officially defines segfaults as something that exist,
-       although it doesn't require an implementation to produce them in any
-       situation other than a function explicitly saying "this situation is a
-       segfault"; that is, however, the situation we have here. Some older
-       non-UNIX compilers may not be aware of segfaults, though, so we
-       substitute an abort() in that situation. */
+    newptr = xmalloc(blocklist, size);
+    if (!newptr)
+        return NULL;
 
-#ifdef SIGSEGV
-    raise(SIGSEGV);
-#endif
-    /* We alo substitute an abort if a SIGSEGV handler returned. (That shouldn't
-       happen either.) */
-    abort();
+    memcpy(newptr, ptr, h->size < size ? h->size : size);
+    return newptr;
 }
 
 /* vasprintf, allocating on an xmalloc chain. */
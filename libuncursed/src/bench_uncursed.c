@@ -0,0 +1,451 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack general public license
+ *  - the GNU General Public license v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+/* This is a benchmark for the rendering side of uncursed. It draws a fixed
+   pseudo-random sequence of screens, modelled on a game of NetHack (a map with
+   things moving around on it, a message line, status lines, and the occasional
+   menu), and reports how fast that went, how much output it produced, and how
+   many allocation calls it made per frame.
+
+   Usage: bench_uncursed [--interface tty|sdl] [-f frames] [-s seed]
+                         [-h rows] [-w columns]
+
+   With the tty plugin, output goes to a pseudo-terminal of the given size; the
+   other end is read (and discarded) by a child process, which counts the bytes
+   and answers the terminal queries the plugin makes on startup. The SDL plugin
+   is run on SDL's dummy video driver with a software renderer, unless the
+   environment says otherwise.
+
+   Allocation calls are only counted if the benchmark is run with the counting
+   library built from libnethack_common/src/bench_malloc.c preloaded (see the
+   instructions there). Replacing malloc in this file instead wouldn't work in
+   an aimake build: aimake would link the replacements into libuncursed, and
+   everything else that calls malloc, too. */
+
+#ifdef AIMAKE_BUILDOS_MSWin32
+# error !AIMAKE_FAIL_SILENTLY! \
+    The rendering benchmark does not currently work on Windows.
+#endif
+
+#define _GNU_SOURCE     /* for posix_openpt, ptsname, setenv, RTLD_DEFAULT */
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uncursed.h"
+
+#define MAPROWS 21
+#define MONSTERS 12
+
+/* Allocation calls, from a preloaded bench_malloc.preload if there is one. */
+static void (*bench_malloc_counts)(unsigned long long *, unsigned long long *,
+                                   unsigned long long *);
+
+static unsigned long long
+allocation_calls(void)
+{
+    unsigned long long mallocs, reallocs, frees;
+
+    if (!bench_malloc_counts)
+        return 0;
+    bench_malloc_counts(&mallocs, &reallocs, &frees);
+    return mallocs + reallocs + frees;
+}
+
+/* The output side, for the tty plugin. */
+static int use_pty = 0;
+static int saved_stdin = -1, saved_stdout = -1;
+static int control_pipe[2], reply_pipe[2];
+static pid_t reader_pid;
+
+/* Runs in the child process: reads everything written to the terminal, and
+   reports how much that was when asked to via the control pipe. */
+static void
+read_terminal_output(int master)
+{
+    static const char query[] = "\x1b[6n";  /* report cursor position */
+    char buf[4096];
+    long long count = 0;
+    int matched = 0;
+
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    while (1) {
+        struct pollfd fds[2] = {
+            {.fd = master, .events = POLLIN},
+            {.fd = control_pipe[0], .events = POLLIN},
+        };
+        ssize_t len, i;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        /* Drain the terminal first, so that a count request sees all the
+           output written before it. */
+        while ((len = read(master, buf, sizeof buf)) > 0) {
+            count += len;
+
+            /* The tty plugin checks whether the terminal supports Unicode by
+               sending two UTF-8 encoded characters and asking where the
+               cursor ended up; say it moved two columns, i.e. it does. */
+            for (i = 0; i < len; i++) {
+                if (buf[i] == query[matched])
+                    matched++;
+                else
+                    matched = buf[i] == query[0];
+                if (matched == (int)sizeof query - 1) {
+                    if (write(master, "\x1b[1;3R", 6) < 0)
+                        perror("write");
+                    matched = 0;
+                }
+            }
+        }
+        if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR &&
+                         !(fds[1].revents & POLLIN)))
+            break;
+
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            char c;
+
+            if (read(control_pipe[0], &c, 1) <= 0)
+                break;
+            if (write(reply_pipe[1], &count, sizeof count) < 0)
+                break;
+        }
+    }
+}
+
+/* Points stdin and stdout at a new pseudo-terminal. */
+static void
+start_pty(int rows, int cols)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    int slave;
+    struct winsize ws;
+
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        exit(EXIT_FAILURE);
+    }
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        perror("ptsname");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&ws, 0, sizeof ws);
+    ws.ws_row = rows;
+    ws.ws_col = cols;
+    ioctl(master, TIOCSWINSZ, &ws);
+
+    if (pipe(control_pipe) < 0 || pipe(reply_pipe) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    reader_pid = fork();
+    if (reader_pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (reader_pid == 0) {
+        close(slave);
+        close(control_pipe[1]);
+        close(reply_pipe[0]);
+        read_terminal_output(master);
+        _exit(0);
+    }
+
+    close(master);
+    close(control_pipe[0]);
+    close(reply_pipe[1]);
+
+    saved_stdin = dup(0);
+    saved_stdout = dup(1);
+    dup2(slave, 0);
+    dup2(slave, 1);
+    close(slave);
+    use_pty = 1;
+}
+
+/* Returns the number of bytes written to the terminal so far. */
+static long long
+terminal_output_bytes(void)
+{
+    long long count = 0;
+
+    if (!use_pty)
+        return 0;
+
+    fflush(stdout);
+    tcdrain(1);
+    if (write(control_pipe[1], "c", 1) < 0 ||
+        read(reply_pipe[0], &count, sizeof count) != sizeof count)
+        return -1;
+    return count;
+}
+
+static void
+stop_pty(void)
+{
+    if (!use_pty)
+        return;
+
+    fflush(stdout);
+    dup2(saved_stdin, 0);
+    dup2(saved_stdout, 1);
+    close(saved_stdin);
+    close(saved_stdout);
+    close(control_pipe[1]);
+    close(reply_pipe[0]);
+    waitpid(reader_pid, NULL, 0);
+}
+
+static double
+now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* The workload. Everything is derived from a simple LCG, so that the same seed
+   always gives the same sequence of screens. */
+static unsigned long seed = 1;
+
+static int
+rn(int n)
+{
+    seed = seed * 1103515245UL + 12345UL;
+    return (int)((seed >> 16) & 0x7fff) % n;
+}
+
+static const char *const messages[] = {
+    "You hit the jackal!", "The jackal bites!", "You kill the jackal!",
+    "You see here a scroll labeled ELBIB YLOH.", "You hear some noises.",
+    "The newt misses.", "Welcome to experience level 2.",
+    "There is a doorway here.  You see here 12 gold pieces.",
+    "You feel a strange vibration under your feet.", "",
+};
+
+static int map_y[MONSTERS + 1], map_x[MONSTERS + 1];
+static int maprows, mapcols;
+
+static void
+draw_terrain(int y, int x)
+{
+    if (y == 1 || y == maprows || x == 0 || x == mapcols - 1) {
+        attrset(COLOR_PAIR(7));
+        mvaddch(y, x, y == 1 || y == maprows ? '-' : '|');
+    } else {
+        attrset(COLOR_PAIR((x * 7 + y * 3) % 11 ? 7 : 3));
+        mvaddch(y, x, (x * 7 + y * 3) % 11 ? '.' : '#');
+    }
+}
+
+static void
+draw_initial_screen(void)
+{
+    int y, x, i;
+
+    erase();
+    for (y = 1; y <= maprows; y++)
+        for (x = 0; x < mapcols; x++)
+            draw_terrain(y, x);
+
+    for (i = 0; i <= MONSTERS; i++) {
+        map_y[i] = 2 + rn(maprows - 2);
+        map_x[i] = 1 + rn(mapcols - 2);
+    }
+}
+
+static void
+draw_frame(int frame)
+{
+    int i;
+
+    /* Everything moves by a square, the player last so they stay visible. */
+    for (i = MONSTERS; i >= 0; i--) {
+        draw_terrain(map_y[i], map_x[i]);
+        map_y[i] += rn(3) - 1;
+        map_x[i] += rn(3) - 1;
+        if (map_y[i] < 2)
+            map_y[i] = 2;
+        if (map_y[i] > maprows - 1)
+            map_y[i] = maprows - 1;
+        if (map_x[i] < 1)
+            map_x[i] = 1;
+        if (map_x[i] > mapcols - 2)
+            map_x[i] = mapcols - 2;
+
+        attrset(i ? COLOR_PAIR(1 + i % 6) | (i & 1 ? A_BOLD : 0) :
+                COLOR_PAIR(7) | A_BOLD);
+        mvaddch(map_y[i], map_x[i], i ? "dDjFxr"[i % 6] : '@');
+    }
+
+    /* Now and then, something flashy, like a spell effect. */
+    if (rn(8) == 0) {
+        int y = 2 + rn(maprows - 4), x = 1 + rn(mapcols - 4), j;
+
+        attrset(COLOR_PAIR(1 + rn(6)) | A_BOLD);
+        for (j = 0; j < 3; j++)
+            mvprintw(y + j, x, "*%c*", j == 1 ? '#' : '*');
+    }
+
+    attrset(0);
+    mvprintw(0, 0, "%s", messages[rn(sizeof messages / sizeof *messages)]);
+    clrtoeol();
+
+    mvprintw(LINES - 2, 0, "Agent the Stripling      St:18/%02d Dx:14 "
+             "Co:17 In:8 Wi:10 Ch:9 Lawful", frame % 100);
+    clrtoeol();
+    mvprintw(LINES - 1, 0, "Dlvl:%d $:%d HP:%d(%d) Pw:%d(%d) AC:6 "
+             "Xp:1/%d T:%d", 1 + frame / 500, frame / 3, 5 + frame % 12, 16,
+             2, 2, frame % 20, frame);
+    clrtoeol();
+    refresh();
+
+    /* Every so often, a menu over the top of the map, which goes away again
+       on the next frame. */
+    if (frame % 50 == 49) {
+        WINDOW *menu = newwin(MAPROWS - 4 < 16 ? MAPROWS - 4 : 16, 40, 2,
+                              COLS - 42);
+        int lines, cols;
+
+        getmaxyx(menu, lines, cols);
+        (void)cols;
+        box(menu, 0, 0);
+        for (i = 1; i < lines - 1; i++)
+            mvwprintw(menu, i, 2, "%c - an uncursed +%d long sword",
+                      'a' + i - 1, i % 3);
+        wrefresh(menu);
+        delwin(menu);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int frames = 2000, rows = 24, cols = 80, i, frame;
+    const char *interface = "tty";
+    long long bytes_start, bytes_end;
+    unsigned long long allocs_start, allocs_end, allocs_frame, allocs_max = 0;
+    int frames_allocating = 0;
+    double wall_start, wall_end;
+    clock_t cpu_start, cpu_end;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--interface") == 0 && i + 1 < argc)
+            interface = argv[i + 1];
+        else if (strncmp(argv[i], "--interface=", 12) == 0)
+            interface = argv[i] + 12;
+    }
+
+    if (strcmp(interface, "sdl") == 0) {
+        setenv("SDL_VIDEODRIVER", "dummy", 0);
+        setenv("UNCURSED_SDL_PREFER_SOFTWARE", "1", 0);
+    }
+
+    initialize_uncursed(&argc, argv);
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-f") == 0)
+            frames = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+            seed = strtoul(argv[++i], NULL, 10);
+        else if (i + 1 < argc && strcmp(argv[i], "-h") == 0)
+            rows = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "-w") == 0)
+            cols = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--interface tty|sdl] [-f frames] "
+                    "[-s seed] [-h rows] [-w columns]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (frames < 1 || rows < 24 || cols < 80) {
+        fprintf(stderr, "At least 1 frame, on at least 80x24, please.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(interface, "sdl") != 0)
+        start_pty(rows, cols);
+
+    initscr();
+    set_faketerm_font_file("./tilesets/dat/fonts/font14.png");
+    start_color();
+    for (i = 1; i <= 7; i++)
+        init_pair(i, i, 0);
+
+    maprows = LINES - 3 < MAPROWS ? LINES - 3 : MAPROWS;
+    mapcols = COLS;
+    draw_initial_screen();
+    refresh();
+
+    *(void **)&bench_malloc_counts = dlsym(RTLD_DEFAULT, "bench_malloc_counts");
+
+    bytes_start = terminal_output_bytes();
+    allocs_start = allocs_end = allocation_calls();
+    cpu_start = clock();
+    wall_start = now();
+
+    for (frame = 0; frame < frames; frame++) {
+        draw_frame(frame);
+
+        /* Counting is cheap enough to do every frame, which shows whether the
+           calls are spread out or come from the occasional expensive frame. */
+        allocs_frame = allocs_end;
+        allocs_end = allocation_calls();
+        allocs_frame = allocs_end - allocs_frame;
+        if (allocs_frame > allocs_max)
+            allocs_max = allocs_frame;
+        if (allocs_frame)
+            frames_allocating++;
+    }
+
+    wall_end = now();
+    cpu_end = clock();
+    bytes_end = terminal_output_bytes();
+
+    endwin();
+    stop_pty();
+
+    printf("%d frames at %dx%d with the %s plugin\n", frames, COLS, LINES,
+           interface);
+    printf("time: %.3f s (%.3f s CPU), %.1f frames/s\n",
+           wall_end - wall_start,
+           (double)(cpu_end - cpu_start) / CLOCKS_PER_SEC,
+           frames / (wall_end - wall_start));
+    if (use_pty)
+        printf("output: %lld bytes, %.1f bytes/frame\n",
+               bytes_end - bytes_start,
+               (double)(bytes_end - bytes_start) / frames);
+    if (bench_malloc_counts)
+        printf("allocation: %.2f malloc/realloc/free calls/frame, at most "
+               "%llu in one frame, %d frames with any\n",
+               (double)(allocs_end - allocs_start) / frames, allocs_max,
+               frames_allocating);
+    else
+        printf("allocation: not counted (bench_malloc.preload not loaded)\n");
+
+    return 0;
+}
@@ -49,6 +49,48 @@ AIMAKE_ABI_VERSION(1.0.1)
 static WINDOW *nout_win = 0;        /* Window drawn onto by wnoutrefresh */
 static WINDOW *disp_win = 0;        /* Window drawn onto by doupdate */
 
+/* The parts of the screen where nout_win and disp_win might differ, so that
+   doupdate doesn't have to compare the whole screen: for each row, the first
+   and last column that might need an update. A row is clean if its first dirty
+   column is INT_MAX and its last is -1. */
+static int *dirty_minx = 0;
+static int *dirty_maxx = 0;
+static int dirty_rows = 0;
+
+static void
+mark_dirty(int y, int minx, int maxx)
+{
+    if (y < 0 || y >= dirty_rows)
+        return;
+    if (minx < dirty_minx[y])
+        dirty_minx[y] = minx;
+    if (maxx > dirty_maxx[y])
+        dirty_maxx[y] = maxx;
+}
+
+/* Called whenever nout_win and disp_win change size; everything is marked as
+   dirty, because we have no idea what changed. */
+static void
+resize_dirty_rows(int h, int w)
+{
+    int j;
+
+    free(dirty_minx);
+    free(dirty_maxx);
+    dirty_minx = malloc(h * sizeof *dirty_minx);
+    dirty_maxx = malloc(h * sizeof *dirty_maxx);
+    if (!dirty_minx || !dirty_maxx) {
+        fprintf(stderr, "uncursed: could not allocate memory!\n");
+        exit(5);
+    }
+
+    dirty_rows = h;
+    for (j = 0; j < h; j++) {
+        dirty_minx[j] = 0;
+        dirty_maxx[j] = w - 1;
+    }
+}
+
 /* uncursed hook handling */
 struct uncursed_hooks *uncursed_hook_list = NULL;
 static int uncursed_hooks_inited = 0;
@@ -502,11 +544,17 @@ delete_tiles_region)
     int i;
 
     for (i = 0; i < (disp_win->maxx + 1) * (disp_win->maxy + 1); i++)
-        if (disp_win->regionarray[i] == win->region)
+        if (disp_win->regionarray[i] == win->region) {
             disp_win->regionarray[i] = &invalid_region;
+            mark_dirty(i / (disp_win->maxx + 1), i % (disp_win->maxx + 1),
+                       i % (disp_win->maxx + 1));
+        }
     for (i = 0; i < (nout_win->maxx + 1) * (nout_win->maxy + 1); i++)
-        if (nout_win->regionarray[i] == win->region)
+        if (nout_win->regionarray[i] == win->region) {
             nout_win->regionarray[i] = NULL;
+            mark_dirty(i / (nout_win->maxx + 1), i % (nout_win->maxx + 1),
+                       i % (nout_win->maxx + 1));
+        }
     for (i = 0; i < (win->maxx + 1) * (win->maxy + 1); i++)
         win->regionarray[i] = NULL;
 
@@ -1488,6 +1536,25 @@ overwrite(const WINDOW *from, const WINDOW *to)
                    min(from->maxx, to->maxx), 0);
 }
 
+/* Returns whether two characters look different, ignoring tiles regions. */
+static int
+cells_differ(const cchar_t *p, const cchar_t *q)
+{
+    int k;
+
+    if (p->attr != q->attr)
+        return 1;
+
+    for (k = 0; k < CCHARW_MAX; k++) {
+        if (p->chars[k] != q->chars[k])
+            return 1;
+        if (p->chars[k] == 0)
+            return 0;
+    }
+
+    return 0;
+}
+
 int
 copywin(const WINDOW *from, const WINDOW *to, int from_miny, int from_minx,
         int to_miny, int to_minx, int to_maxy, int to_maxx, int skip_blanks)
@@ -1518,13 +1585,18 @@ copywin(const WINDOW *from, const WINDOW *to, int from_miny, int from_minx,
             if (skip_blanks && f->chars[0] == 32)
                 continue;
 
-            *t = *f;
-
             void **rf =
                 from->regionarray + i - to_minx + from_minx +
                 (j - to_miny + from_miny) * (from->maxx + 1);
             void **rt = to->regionarray + i + j * (to->maxx + 1);
 
+            /* Most of nout_win is typically unchanged by a wnoutrefresh; only
+               remember the parts where something changed. */
+            if (to == disp_win ||
+                (to == nout_win && (*rt != *rf || cells_differ(t, f))))
+                mark_dirty(j, i, i);
+
+            *t = *f;
             *rt = *rf;
         }
     }
@@ -1979,6 +2051,7 @@ initscr(void)
         fprintf(stderr, "uncursed: could not allocate memory!\n");
         exit(5);
     }
+    resize_dirty_rows(LINES, COLS);
 
     return stdscr;
 }
@@ -2008,6 +2081,7 @@ uncursed_rhook_setsize(int h, int w)
     wresize(stdscr, h, w);
     wresize(nout_win, h, w);
     wresize(disp_win, h, w);
+    resize_dirty_rows(h, w);
     redrawwin(stdscr); /* we need to touch every character */
 
     struct uncursed_hooks *hook;
@@ -2229,12 +2303,14 @@ wredrawln(WINDOW *win, int first, int num)
     int j, i;
     for (j = win->scry + first;
          j < win->scry + first + num && j <= disp_win->maxy; j++) {
-        if (j >= 0)
+        if (j >= 0) {
             for (i = win->scrx;
                  i <= win->scrx + win->maxx && i <= disp_win->maxx; i++) {
                 if (i >= 0)
                     disp_win->chararray[i + j * win->stride].attr = -1;
             }
+            mark_dirty(j, win->scrx, win->scrx + win->maxx);
+        }
     }
     return touchline(win, first, num);
 }
@@ -2276,26 +2352,22 @@ doupdate(void)
     }
     nout_win->clear_on_refresh = 0;
 
-    cchar_t *p = nout_win->chararray;
-    cchar_t *q = disp_win->chararray;
-    void **rp = nout_win->regionarray;
-    void **rq = disp_win->regionarray;
+    for (j = 0; j <= nout_win->maxy && j < dirty_rows; j++) {
+        int minx = dirty_minx[j] < 0 ? 0 : dirty_minx[j];
+        int maxx = min(dirty_maxx[j], nout_win->maxx);
 
-    for (j = 0; j <= nout_win->maxy; j++) {
-        for (i = 0; i <= nout_win->maxx; i++) {
-            int k;
+        dirty_minx[j] = INT_MAX;
+        dirty_maxx[j] = -1;
 
-            if (p->attr != q->attr || *rp != *rq || *rq == &invalid_region)
-                uncursed_hook_update(j, i);
+        for (i = minx; i <= maxx; i++) {
+            if (!uncursed_rhook_needsupdate(j, i))
+                continue;
 
-            for (k = 0; k < CCHARW_MAX; k++) {
-                if (p->chars[k] != q->chars[k])
-                    uncursed_hook_update(j, i);
-                if (p->chars[k] == 0)
-                    break;
-            }
+            uncursed_hook_update(j, i);
 
-            p++; q++; rp++; rq++;
+            /* If no hook drew the character, we still need to next time. */
+            if (uncursed_rhook_needsupdate(j, i))
+                mark_dirty(j, i, i);
         }
     }
 
@@ -2325,9 +2397,6 @@ uncursed_rhook_needsupdate(int y, int x)
     cchar_t *p = nout_win->chararray + x + y * nout_win->stride;
     cchar_t *q = disp_win->chararray + x + y * disp_win->stride;
 
-    if (p->attr != q->attr)
-        return 1;
-
     if (disp_win->regionarray[x + y * (disp_win->maxx + 1)] ==
         &invalid_region)
         return 1;
@@ -2336,16 +2405,7 @@ uncursed_rhook_needsupdate(int y, int x)
         disp_win->regionarray[x + y * (disp_win->maxx + 1)])
         return 1;
 
-    int k;
-
-    for (k = 0; k < CCHARW_MAX; k++) {
-        if (p->chars[k] != q->chars[k])
-            return 1;
-        if (p->chars[k] == 0)
-            return 0;
-    }
-
-    return 0;
+    return cells_differ(p, q);
 }
 
 void *
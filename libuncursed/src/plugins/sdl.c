@@ -539,8 +539,8 @@ sdl_hook_allocate_tiles_region(int height, int width, int loc_h, int loc_w,
         load_png_file_to_texture(tileset_filename, &region->tilesize_w,
                                  &region->tilesize_h);
     if (!region->tileset) {
-        free(region);
         free(region->tiles);
+        free(region);
         return NULL;
     }
 
@@ -992,120 +992,267 @@ tty_hook_getkeyorcodepoint(int timeout_ms)
     return getkeyorcodepoint_inner(timeout_ms, 0);
 }
 
-void
-tty_hook_update(int y, int x)
+/* Output is assembled a row at a time in row_buffer, and written with a single
+   stdio call. It is only ever drained between complete escape sequences or
+   characters, so that stdio doesn't flush in the middle of one. */
+static char row_buffer[4096];
+static int row_length = 0;
+
+static void
+drain_row_buffer(void)
 {
-    int j, i;
+    if (!row_length)
+        return;
 
-    /* If we need to do a full redraw, do so. */
-    if (terminal_contents_unknown) {
-        terminal_contents_unknown = 0;
-        last_color = -1;
-        last_cursor = -1;
-        last_x = -1;
+    if (chars_since_flush + row_length > OFILE_BUFFER_SIZE - 200)
+        tty_hook_flush();
+    fwrite(row_buffer, 1, row_length, ofile);
+    chars_since_flush += row_length;
+    row_length = 0;
+}
 
-        for (j = 0; j < last_h; j++)
-            for (i = 0; i < last_w; i++)
-                tty_hook_update(j, i);
-        return;
+static void
+row_output(const char *s, int len)
+{
+    if (row_length + len > (int)sizeof row_buffer)
+        drain_row_buffer();
+    memcpy(row_buffer + row_length, s, len);
+    row_length += len;
+}
+
+/* The parameters of an SGR sequence that sets all of a color (as returned by
+   uncursed_rhook_color_at), from a reset state.
+
+   The general idea here is to specify bold for bright foreground, but blink
+   for bright background only on terminals without 256-color support (via
+   exploiting the "5" in the code for setting 256-color background). We set the
+   colors using the 8-color code first, then the 16-color code, to get support
+   for 16 colors without losing support for 8 colors. */
+static int
+sgr_fg(char *buf, int fg)
+{
+    if (fg == 16)                                   /* default fg */
+        return sprintf(buf, "39;");                 /* SGR default fg */
+    else if (fg >= 8)                               /* bright fg */
+        /* SGR bold; SGR 8 color (fg & 8); SGR 16 color (fg) */
+        return sprintf(buf, "1;%d;%d;", fg + 22, fg + 82);
+    else                                            /* dark fg */
+        return sprintf(buf, "%d;", fg + 30);        /* SGR 8 color (fg) */
+}
+
+static int
+sgr_bg(char *buf, int bg)
+{
+    if (bg == 16)                                   /* default bg */
+        return sprintf(buf, "49;");                 /* SGR default bg */
+    else if (bg >= 8)                               /* bright bg */
+        /* SGR 256 color 5 /or/ SGR blink (depending on color depth);
+           SGR 8 color (bg & 8); SGR 16 color (bg) */
+        return sprintf(buf, "48;5;5;%d;%d;", bg + 32, bg + 92);
+    else
+        return sprintf(buf, "%d;", bg + 40);        /* SGR 8 color (bg) */
+}
+
+#define IS_BRIGHT(c) ((c) >= 8 && (c) != 16)
+
+/* Writes the shortest SGR sequence that changes the terminal's color from
+   `from` to `to` into buf, and returns its length. `from` is -1 if the
+   terminal's state is unknown, in which case a reset is needed. */
+static int
+sgr_sequence(char *buf, int from, int to)
+{
+    char full[64], change[64];
+    int fl, cl;
+
+    if (from == to)
+        return 0;
+
+    /* from a reset */
+    fl = sprintf(full, CSI "0;");                   /* SGR reset */
+    fl += sgr_fg(full + fl, to & 31);
+    if (to & 1024)
+        fl += sprintf(full + fl, "4;");             /* SGR underline */
+    fl += sgr_bg(full + fl, (to >> 5) & 31);
+    full[fl - 1] = 'm';
+
+    /* from the previous color, changing only what differs; bold and blink
+       have to be turned off explicitly when leaving a bright color */
+    if (from != -1) {
+        cl = sprintf(change, CSI);
+        if ((from & 31) != (to & 31)) {
+            if (IS_BRIGHT(from & 31) && !IS_BRIGHT(to & 31))
+                cl += sprintf(change + cl, "22;");  /* SGR normal intensity */
+            cl += sgr_fg(change + cl, to & 31);
+        }
+        if ((from & 1024) != (to & 1024))
+            cl += sprintf(change + cl, (to & 1024) ? "4;" : "24;");
+        if (((from >> 5) & 31) != ((to >> 5) & 31)) {
+            if (IS_BRIGHT((from >> 5) & 31) && !IS_BRIGHT((to >> 5) & 31))
+                cl += sprintf(change + cl, "25;");  /* SGR blink off */
+            cl += sgr_bg(change + cl, (to >> 5) & 31);
+        }
+        change[cl - 1] = 'm';
+
+        if (cl < fl) {
+            memcpy(buf, change, cl);
+            return cl;
+        }
     }
 
-    if (last_color == -1) {
-        /* In addition to resending color, resend the other font information
-           too. */
-        set_charset(y, x);
-    } else if (!uncursed_rhook_needsupdate(y, x))
-        return;
+    memcpy(buf, full, fl);
+    return fl;
+}
 
-    if (last_y != y || last_x == -1) {
-        ofile_output(CSI "%d;%dH", y + 1, x + 1);        /* move cursor */
-    } else if (last_x > x) {
-        if (last_x == x + 1)
-            ofile_outputs(CSI "D");                      /* move left */
-        else
-            ofile_output(CSI "%dD", last_x - x);         /* move left */
-    } else if (last_x < x) {
-        if (last_x == x-1)
-            ofile_outputs(CSI "C");                      /* move right */
-        else
-            ofile_output(CSI "%dC", x - last_x);         /* move right */
+/* Writes the character at (y, x) into buf, and returns its length. */
+static int
+cell_text(char *buf, int y, int x)
+{
+    if (supports_utf8) {
+        const char *utf8 = uncursed_rhook_utf8_at(y, x);
+        int len = strlen(utf8);
+
+        memcpy(buf, utf8, len);
+        return len;
     }
 
+    *buf = uncursed_rhook_cp437_at(y, x);
+    return 1;
+}
+
+/* Draws the character at (y, x), where the cursor is. */
+static void
+draw_cell(int y, int x)
+{
+    char buf[64 + CCHARW_MAX * 4];
     int color = uncursed_rhook_color_at(y, x);
+    int len = sgr_sequence(buf, last_color, color);
 
-    if (color != last_color) {
-        last_color = color;
-
-        /* The general idea here is to specify bold for bright foreground, but
-           blink for bright background only on terminals without 256-color
-           support (via exploiting the "5" in the code for setting 256-color
-           background). We set the colors using the 8-color code first, then
-           the 16-color code, to get support for 16 colors without losing
-           support for 8 colors. */
-        ofile_outputs(CSI "0;");                         /* SGR reset */
-        if ((color & 31) == 16)         /* default fg */
-            ofile_outputs("39;");                        /* SGR default fg */
-        else if ((color & 31) >= 8)     /* bright fg */
-            /* SGR bold; SGR 8 color (fg & 8); SGR 16 color (fg) */
-            ofile_output("1;%d;%d;", (color & 31) + 22, (color & 31) + 82);
-        else    /* dark fg */
-            ofile_output("%d;", (color & 31) + 30);      /* SGR 8 color (fg) */
-        color >>= 5;
-        if (color & 32)
-            ofile_outputs("4;");                         /* SGR underline */
-        color &= 31;
-        if (color == 16)        /* default bg */
-            ofile_outputs("49m");                        /* SGR default bg */
-        else if (color >= 8)    /* bright bg */
-            /* SGR 256 color 5 /or/ SGR blink (depending on color depth);
-               SGR 8 color (bg & 8); SGR 16 color (bg) */
-            ofile_output("48;5;5;%d;%dm", color + 32, color + 92);
-        else
-            ofile_output("%dm", color + 40);             /* SGR 8 color (bg) */
+    last_color = color;
+    len += cell_text(buf + len, y, x);
+    row_output(buf, len);
+
+    uncursed_rhook_updated(y, x);
+    last_x = x + 1;
+    last_y = y;
+    if (last_x == last_w)
+        last_x = -1;    /* the cursor position is unreliable after the last
+                           column */
+}
+
+/* The number of bytes needed to draw the characters from the cursor up to, but
+   not including, column x, followed by the color change for column x; or -1
+   if that would be more than `limit` bytes. */
+static int
+overwrite_cost(int y, int x, int limit)
+{
+    char buf[64 + CCHARW_MAX * 4];
+    int i, color, cost = 0, prev_color = last_color;
+
+    for (i = last_x; i <= x && cost <= limit; i++) {
+        color = uncursed_rhook_color_at(y, i);
+        cost += sgr_sequence(buf, prev_color, color);
+        prev_color = color;
+        if (i < x)
+            cost += cell_text(buf, y, i);
     }
 
-    if (supports_utf8)
-        ofile_outputs(uncursed_rhook_utf8_at(y, x));
-    else
-        ofile_output("%c", uncursed_rhook_cp437_at(y, x));
+    return cost <= limit ? cost : -1;
+}
 
-    uncursed_rhook_updated(y, x);
+/* Moves the cursor to (y, x), either with a cursor motion sequence, or by
+   redrawing the characters in between if that is shorter. */
+static void
+move_to(int y, int x)
+{
+    char buf[32], sgr[64];
+    int len;
 
-    last_x = x + 1;
+    if (last_y == y && last_x == x)
+        return;
+
+    if (last_y != y || last_x == -1)
+        len = sprintf(buf, CSI "%d;%dH", y + 1, x + 1);  /* move cursor */
+    else if (last_x > x)
+        len = last_x == x + 1 ? sprintf(buf, CSI "D") :  /* move left */
+            sprintf(buf, CSI "%dD", last_x - x);
+    else
+        len = last_x == x - 1 ? sprintf(buf, CSI "C") :  /* move right */
+            sprintf(buf, CSI "%dC", x - last_x);
+
+    /* Overwriting is only possible when moving right along the row. Compare
+       like with like: both ways end up with the color change for x. */
+    if (last_y == y && last_x != -1 && last_x < x) {
+        int color = uncursed_rhook_color_at(y, x);
+        int motion = len + sgr_sequence(sgr, last_color, color);
+        int overwrite = overwrite_cost(y, x, motion - 1);
+
+        if (overwrite != -1) {
+            while (last_x != -1 && last_x < x)
+                draw_cell(y, last_x);
+            return;
+        }
+    }
+
+    row_output(buf, len);
     last_y = y;
+    last_x = x;
+}
 
-    /* To save on output, redraw up to three characters that don't need
-       redrawing rather than skipping them. We first check to see if the second,
-       third or fourth character needs an update; if none do, then we're
-       skipping at least four characters (first character doesn't need an
-       update) or zero characters (first character needs an update), and
-       shouldn't do any redundant drawing in either case. If one of those does
-       need an update, we draw up to the first character that needs a
-       non-redundant update using redundant updates. */
-
-    int any_nearby_updates = 0;
-    for (i = last_x + 1; i < last_x + 4 && i < last_w; i++)
-        any_nearby_updates |= uncursed_rhook_needsupdate(y, i);
-
-    while (any_nearby_updates && last_x < last_w) {
-        if (uncursed_rhook_needsupdate(y, last_x))
-            break;
-        if (uncursed_rhook_color_at(y, last_x) != last_color)
-            break;
-        if (supports_utf8)
-            ofile_outputs(uncursed_rhook_utf8_at(y, last_x));
-        else
-            ofile_output("%c", uncursed_rhook_cp437_at(y, last_x));
+/* Draws everything that needs updating in row y, from column x onwards, and
+   column x itself if draw_first is set. */
+static void
+update_row(int y, int x, int draw_first)
+{
+    int end;
 
-        /* futureproofing; we checked that the update isn't needed, so this
-           should technically always be a no-op */
-        uncursed_rhook_updated(y, last_x);
+    for (end = last_w - 1; end > x; end--)
+        if (uncursed_rhook_needsupdate(y, end))
+            break;
 
-        last_x++;
+    for (; x <= end; x++) {
+        if (!draw_first && !uncursed_rhook_needsupdate(y, x))
+            continue;
+        draw_first = 0;
+        move_to(y, x);
+        draw_cell(y, x);
     }
 
-    if (last_x == last_w)
+    drain_row_buffer();
+}
+
+void
+tty_hook_update(int y, int x)
+{
+    int j;
+
+    /* If we need to do a full redraw, do so. */
+    if (terminal_contents_unknown) {
+        terminal_contents_unknown = 0;
+        last_color = -1;
+        last_cursor = -1;
         last_x = -1;
+
+        set_charset(0, 0);
+        last_y = 0;
+        last_x = 0;
+        update_row(0, 0, 1);
+        for (j = 1; j < last_h; j++)
+            update_row(j, 0, 0);
+        return;
+    }
+
+    if (last_color == -1) {
+        /* In addition to resending color, resend the other font information
+           too. */
+        set_charset(y, x);
+        last_y = y;
+        last_x = x;
+    } else if (!uncursed_rhook_needsupdate(y, x))
+        return;
+
+    /* The rest of the row is drawn in the same go, so that the cheapest way to
+       get from one changed character to the next can be chosen. */
+    update_row(y, x, 1);
 }
 
 void
@@ -23,6 +23,13 @@ struct coord {
 static struct nh_dbuf_entry display_buffer[ROWNO][COLNO];
 static struct nh_dbuf_entry onscreen_display_buffer[ROWNO][COLNO];
 static nh_bool fully_refresh_display_buffer = 1;
+
+/* With blinking on, cells that have more than one symbol cycle through them,
+   changing every BLINK_INTERVAL milliseconds. Only those cells need to be
+   redrawn when the frame changes. */
+#define BLINK_INTERVAL 666
+static unsigned char onscreen_symcount[ROWNO][COLNO];
+static unsigned int onscreen_frame;
 static const int mxdir[DIR_SELF + 1] = { -1, -1, 0, 1, 1, 1, 0, -1, 0, 0 };
 static const int mydir[DIR_SELF + 1] = { 0, -1, -1, -1, 0, 1, 1, 1, 0, 0 };
 
@@ -46,21 +53,29 @@ get_milliseconds(void)
 #endif
 
 
+static unsigned int
+blink_frame(void)
+{
+    return (unsigned int)get_milliseconds() / BLINK_INTERVAL;
+}
+
 
 int
 get_map_key(int place_cursor)
 {
     int key = ERR;
 
-    if (settings.blink)
-        wtimeout(mapwin, 666);  /* wait 2/3 of a second before switching */
-
     if (player.x && place_cursor) {     /* x == 0 is not a valid coordinate */
         wmove(mapwin, player.y, player.x);
         curs_set(1);
     }
 
     while (1) {
+        /* wake up when the next blink frame is due, to draw it */
+        if (settings.blink)
+            wtimeout(mapwin, BLINK_INTERVAL -
+                     (unsigned int)get_milliseconds() % BLINK_INTERVAL);
+
         key = nh_wgetch(mapwin);
         draw_map(player.x, player.y);
         doupdate();
@@ -99,6 +114,7 @@ draw_map(int cx, int cy)
 {
     int x, y, symcount, attr, cursx, cursy;
     unsigned int frame;
+    nh_bool new_frame;
     struct curses_symdef syms[4];
 
     if (!mapwin)
@@ -106,11 +122,8 @@ draw_map(int cx, int cy)
 
     getyx(mapwin, cursy, cursx);
 
-    frame = 0;
-    if (settings.blink) {
-        frame = get_milliseconds() / 666;
-        fully_refresh_display_buffer = 1;
-    }
+    frame = settings.blink ? blink_frame() : 0;
+    new_frame = frame != onscreen_frame;
 
     for (y = 0; y < ROWNO; y++) {
         for (x = 0; x < COLNO; x++) {
@@ -118,6 +131,7 @@ draw_map(int cx, int cy)
             struct nh_dbuf_entry *dbyx = &(display_buffer[y][x]);
 
             if (!fully_refresh_display_buffer &&
+                !(new_frame && onscreen_symcount[y][x] > 1) &&
                 memcmp(dbyx, &(onscreen_display_buffer[y][x]),
                        sizeof *dbyx) == 0)
                 continue; /* no need to redraw an unchanged tile */
@@ -208,10 +222,12 @@ draw_map(int cx, int cy)
                     bg_color = CLR_BLUE;
             }
             print_sym(mapwin, &syms[frame % symcount], attr, bg_color);
+            onscreen_symcount[y][x] = symcount;
         }
     }
 
     fully_refresh_display_buffer = 0;
+    onscreen_frame = frame;
     wmove(mapwin, cursy, cursx);
     wnoutrefresh(mapwin);
 }
@@ -4,9 +4,65 @@
 /* NetHack may be freely redistributed.  See license for details. */
 
 #include "nhcurses.h"
+#include <fcntl.h>
 
 void
 replay(void)
 {
-    /* TODO: Load a completed game */
+    char buf[BUFSZ];
+    fnchar logdir[BUFSZ], filename[1024], **files;
+    int fd, i, size, ret, pick[1];
+    enum nh_log_status status;
+    struct nh_game_info gi;
+    struct nh_menulist menu;
+
+    if (!get_gamedir(LOG_DIR, logdir)) {
+        curses_raw_print("Could not find or create the log directory.");
+        return;
+    }
+
+    files = list_gamefiles(logdir, &size);
+    if (!size) {
+        curses_msgwin("No completed games found.");
+        return;
+    }
+
+    init_menulist(&menu);
+
+    /* Only completed games can be replayed; the engine loads anything else as
+       an ordinary saved game. */
+    for (i = 0; i < size; i++) {
+        fd = sys_open(files[i], O_RDONLY, FILE_OPEN_MASK);
+        status = nh_get_savegame_status(fd, &gi);
+        close(fd);
+
+        describe_game(buf, status, &gi);
+        add_menu_item(&menu, (status == LS_DONE) ? i + 1 : 0, buf, 0, FALSE);
+    }
+
+    curses_display_menu(&menu, "completed games", PICK_ONE,
+                        PLHINT_ANYWHERE, pick, curses_menu_callback);
+
+    filename[0] = '\0';
+    if (pick[0] != CURSES_MENU_CANCELLED)
+        fnncat(filename, files[pick[0] - 1],
+               sizeof (filename) / sizeof (fnchar) - 1);
+
+    for (i = 0; i < size; i++)
+        free(files[i]);
+    free(files);
+
+    if (pick[0] == CURSES_MENU_CANCELLED)
+        return;
+
+    fd = sys_open(filename, O_RDONLY, FILE_OPEN_MASK);
+    create_game_windows();
+
+    ret = playgame(fd);
+
+    close(fd);
+
+    destroy_game_windows();
+    cleanup_messages();
+    game_ended(ret, filename, FALSE);
 }
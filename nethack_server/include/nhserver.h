@@ -84,6 +84,10 @@
 #  define DEFAULT_CLIENT_TIMEOUT (15 * 60)      /* 15 minutes */
 # endif
 
+# if !defined(DEFAULT_RELAY_BUFFER_SIZE)
+#  define DEFAULT_RELAY_BUFFER_SIZE (64 * 1024) /* per connected client */
+# endif
+
 
 struct settings {
     char *logfile;
@@ -94,6 +98,14 @@ struct settings {
     struct sockaddr_un bind_addr_unix;
     int port;
     int client_timeout;
+    int relay_buffer_size;      /* max. buffered game output per client */
+    int relay_pipe_size;        /* 0 = leave the kernel default alone */
+    int relay_threads;          /* 0 = relay from the main thread */
+    int relay_flush_deadline;   /* ms a partial message may stay corked;
+                                   0 = never cork */
+    int backup_diff_percent;    /* save backup cadence; 0 = engine default */
+    int backup_max_diffs;
+    char disable_compression;   /* refuse clients that ask for compression */
     char nodaemon;
     char disable_ipv4;
     char disable_ipv6;
@@ -139,15 +151,16 @@ extern struct nh_player_info player_info;
 
 /* auth.c */
 extern int auth_user(char *authbuf, const char *peername, int *is_reg,
-                     int *reconnect_id);
+                     int *reconnect_id, int *compress);
 extern void auth_send_result(int sockfd, enum authresult, int is_reg,
-                             int connid);
+                             int connid, int compress);
 
 /* clientmain.c */
 extern noreturn void client_main(int userid, int infd, int outfd);
 extern noreturn void exit_client(const char *err);
 extern void client_msg(const char *key, json_t * value);
-extern json_t *read_input(void);
+extern void client_msg_raw(const char *key, const json_writer_t *value);
+extern json_t *read_input(json_arena_t *arena);
 
 /* config.c */
 extern int read_config(const char *confname);
@@ -202,8 +215,9 @@ extern int remove_unix_socket(void);
 extern int runserver(void);
 
 /* winprocs.c */
-extern json_t *get_display_data(void);
+extern const char *get_display_data(size_t *len);
 extern void reset_cached_diplaydata(void);
+extern void reset_item_lists(void);
 extern void srv_display_buffer(const char *buf, nh_bool trymove);
 extern char srv_yn_function(const char *query, const char *rset,
                             char defchoice);
@@ -43,13 +43,15 @@ is_valid_username(const char *name)
 
 
 int
-auth_user(char *authbuf, const char *peername, int *is_reg, int *reconnect_id)
+auth_user(char *authbuf, const char *peername, int *is_reg, int *reconnect_id,
+          int *compress)
 {
     json_error_t err;
-    json_t *obj, *cmd, *name, *pass, *email, *reconn;
+    json_t *obj, *cmd, *name, *pass, *email, *reconn, *jcompress;
     const char *namestr, *passstr, *emailstr;
     int userid = 0;
 
+    *compress = FALSE;
     obj = json_loads(authbuf, 0, &err);
     if (!obj)
         return 0;
@@ -69,6 +71,7 @@ auth_user(char *authbuf, const char *peername, int *is_reg, int *reconnect_id)
     pass = json_object_get(cmd, "password");
     email = json_object_get(cmd, "email");      /* is null for auth */
     reconn = json_object_get(cmd, "reconnect");
+    jcompress = json_object_get(cmd, "compress");       /* optional */
 
     if (!name || !pass)
         goto err;
@@ -80,6 +83,10 @@ auth_user(char *authbuf, const char *peername, int *is_reg, int *reconnect_id)
         !is_valid_username(namestr))
         goto err;
 
+    if (jcompress && json_is_string(jcompress) &&
+        !strcmp(json_string_value(jcompress), "deflate"))
+        *compress = TRUE;
+
     *reconnect_id = 0;
     if (!*is_reg) {
         if (reconn && json_is_integer(reconn))
@@ -120,7 +127,8 @@ err:
 
 
 void
-auth_send_result(int sockfd, enum authresult result, int is_reg, int connid)
+auth_send_result(int sockfd, enum authresult result, int is_reg, int connid,
+                 int compress)
 {
     int ret, written, len;
     json_t *jval;
@@ -134,6 +142,9 @@ auth_send_result(int sockfd, enum authresult result, int is_reg, int connid)
     jval =
         json_pack("{s:{si,si,s:[i,i,i]}}", key, "return", result, "connection",
                   connid, "version", VERSION_MAJOR, VERSION_MINOR, PATCHLEVEL);
+    if (compress)
+        json_object_set_new(json_object_get(jval, key), "compress",
+                            json_string("deflate"));
     jstr = json_dumps(jval, JSON_COMPACT);
     len = strlen(jstr);
     written = 0;
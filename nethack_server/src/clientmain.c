@@ -13,9 +13,13 @@
 
 #include "nhserver.h"
 #include <ctype.h>
+#include <time.h>
 
 #define COMMBUF_SIZE (1024 * 1024)
 
+/* single waits for the relay longer than this are logged as they happen */
+#define OUTPUT_STALL_LOG_MS 1000
+
 /* copied from nhcurses.h */
 #ifdef AIMAKE_OPTION_gamesdatadir
 # ifndef NETHACKDIR
@@ -90,49 +94,162 @@ init_game_paths(void)
 }
 
 
-void
-client_msg(const char *key, json_t * value)
+/* Time spent waiting for the relay to accept output. The pipe to the master is
+   non-blocking; when it is full, the game waits in poll() rather than spinning,
+   and the wait is recorded here. */
+static struct {
+    int stalls;         /* writes that had to wait */
+    long blocked_ms;    /* total time spent waiting */
+    long longest_ms;
+} output_stats;
+
+
+static long
+monotonic_ms(void)
 {
-    int len, ret, pos;
-    char *jsonstr;
-    json_t *jval, *display_data;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
 
-    jval = json_object();
+static void
+record_output_stall(long stall_ms)
+{
+    output_stats.stalls++;
+    output_stats.blocked_ms += stall_ms;
+    if (stall_ms > output_stats.longest_ms)
+        output_stats.longest_ms = stall_ms;
+    if (stall_ms >= OUTPUT_STALL_LOG_MS)
+        log_msg("Output for user %d blocked for %ld ms", user_info.uid,
+                stall_ms);
+}
+
+
+static void
+report_output_stats(void)
+{
+    if (output_stats.stalls)
+        log_msg("Output for user %d blocked %d times for %ld ms in total "
+                "(longest %ld ms)", user_info.uid, output_stats.stalls,
+                output_stats.blocked_ms, output_stats.longest_ms);
+}
+
+
+/* Write all of data to outfd. A message is only ever followed by a read of
+   the client's reply, so there is nothing useful to do while the relay is
+   backed up; the wait is bounded by the same timeout as input, after which the
+   relay is assumed to be gone. */
+static int
+write_output(const char *data, size_t len)
+{
+    struct pollfd pfd[1] = { {outfd, POLLOUT, 0} };
+    long start = 0, waited = 0, limit = (settings.client_timeout + 60) * 1000L;
+    size_t pos = 0;
+    ssize_t ret;
+
+    while (pos < len) {
+        ret = write(outfd, &data[pos], len - pos);
+        if (ret > 0) {
+            pos += ret;
+            continue;
+        } else if (ret == -1 && errno == EINTR)
+            continue;
+        else if (ret == 0 || errno != EAGAIN)
+            break;
+
+        /* the pipe is full: wait for the relay to drain it */
+        if (!start)
+            start = monotonic_ms();
+        ret = poll(pfd, 1, limit - waited);
+        waited = monotonic_ms() - start;
+        if (ret == 0 || waited >= limit)
+            break;
+        if (ret == -1 && errno != EINTR)
+            break;
+        if (pfd[0].revents & (POLLERR | POLLHUP))
+            break;
+    }
+
+    if (start)
+        record_output_stall(monotonic_ms() - start);
+    return pos == len;
+}
+
+
+/* Messages are written straight into msg_writer, which is reused, rather than
+   built as a tree and then serialized. The result is the same. */
+static json_writer_t *msg_writer;
+
+/* Starts a message; the caller writes the value for key. */
+static json_writer_t *
+begin_client_msg(const char *key)
+{
+    const char *display_data;
+    size_t display_len;
+
+    if (!msg_writer)
+        msg_writer = json_writer_new(0);
+    else
+        json_writer_clear(msg_writer);
+    json_writer_object_begin(msg_writer);
 
     /* send out display data whenever anything else goes out */
-    display_data = get_display_data();
+    display_data = get_display_data(&display_len);
     if (display_data) {
-        json_object_set_new(jval, "display", display_data);
-        display_data = NULL;
+        json_writer_key(msg_writer, "display");
+        json_writer_raw(msg_writer, display_data, display_len);
     }
 
     /* actual message content */
-    json_object_set_new(jval, key, value);
-    jsonstr = json_dumps(jval, JSON_COMPACT);
-    json_decref(jval);
-
-    if (can_send_msg) {
-        len = strlen(jsonstr);
-        pos = 0;
-        do {
-            ret = write(outfd, &jsonstr[pos], len - pos);
-            if (ret == -1 && (errno == EINTR || errno == EAGAIN))
-                continue;
-            else if (ret == -1 || ret == 0) {   /* bad news */
-                /* since we just found we can't write output to the pipe,
-                   prevent any more tries */
-                close(infd);
-                close(outfd);
-                infd = outfd = -1;
-                exit_client(NULL);      /* Goodbye. */
-            }
-            pos += ret;
-        } while (pos < len);
+    if (key)
+        json_writer_key(msg_writer, key);
+    return msg_writer;
+}
+
+
+static void
+send_client_msg(void)
+{
+    json_writer_object_end(msg_writer);
+
+    if (can_send_msg && !write_output(json_writer_text(msg_writer),
+                                      json_writer_length(msg_writer))) {
+        /* bad news: since we just found we can't write output to the pipe,
+           prevent any more tries */
+        close(infd);
+        close(outfd);
+        infd = outfd = -1;
+        exit_client(NULL);      /* Goodbye. */
     }
     /* this message is sent; don't send another */
     can_send_msg = FALSE;
+}
+
 
-    free(jsonstr);
+void
+client_msg(const char *key, json_t * value)
+{
+    json_writer_t *writer;
+
+    /* a NULL value (from a failed json_pack) leaves out the key */
+    writer = begin_client_msg(value ? key : NULL);
+    if (value) {
+        json_writer_value(writer, value);
+        json_decref(value);
+    }
+    send_client_msg();
+}
+
+
+/* Like client_msg, but the value has already been written. */
+void
+client_msg_raw(const char *key, const json_writer_t *value)
+{
+    json_writer_raw(begin_client_msg(key), json_writer_text(value),
+                    json_writer_length(value));
+    send_client_msg();
 }
 
 noreturn void
@@ -162,6 +279,8 @@ exit_client(const char *err)
         infd = outfd = -1;
     }
 
+    report_output_stats();
+
     termination_flag = 3;       /* make sure the command loop exits if
                                    nh_exit_game jumps there */
     if (!sigsegv_flag)
@@ -177,8 +296,12 @@ exit_client(const char *err)
 }
 
 
+static json_arena_t *command_arena;
+
+/* Read one JSON object from the client. It is parsed into the given arena,
+   so it stays valid until the next read into the same arena. */
 json_t *
-read_input(void)
+read_input(json_arena_t *arena)
 {
     int ret, datalen, done;
     static char commbuf[COMMBUF_SIZE];
@@ -191,7 +314,9 @@ read_input(void)
     done = FALSE;
     datalen = 0;
     while (!done && !termination_flag) {
-        ret = poll(pfd, 1, settings.client_timeout * 1000);
+        /* The master process evicts idle games; this only catches the case
+           where it somehow fails to do so. */
+        ret = poll(pfd, 1, (settings.client_timeout + 60) * 1000);
         if (ret == 0)
             exit_client("Inactivity timeout");
 
@@ -213,6 +338,7 @@ read_input(void)
             datalen = ret - 1;
             /* also reset the cached display data to make sure all display
                state is re-sent */
+            reset_item_lists();
             continue;
         }
 
@@ -223,7 +349,9 @@ read_input(void)
 
         jval = NULL;
         if (*bp == '}') {       /* possibly the end of the json object */
-            jval = json_loads(commbuf, JSON_REJECT_DUPLICATES, &err);
+            json_arena_reset(arena);
+            jval = json_loads_arena(arena, commbuf, JSON_REJECT_DUPLICATES,
+                                    &err);
             if (jval)
                 done = TRUE;
             else if (err.position < datalen)
@@ -248,8 +376,13 @@ client_main_loop(void)
     void *iter;
     int i;
 
+    /* Commands are read into their own arena: a command's arguments stay in
+       use while the game reads responses to its requests. */
+    if (!command_arena && !(command_arena = json_arena_new()))
+        exit_client("Out of memory");
+
     while (!termination_flag) {
-        obj = read_input();
+        obj = read_input(command_arena);
         if (termination_flag) {
             if (obj)
                 json_decref(obj);
@@ -299,6 +432,7 @@ client_main(int userid, int _infd, int _outfd)
     infd = _infd;
     outfd = _outfd;
     gamefd = -1;
+    fcntl(outfd, F_SETFL, fcntl(outfd, F_GETFL) | O_NONBLOCK);
 
     init_database();
     if (!db_get_user_info(userid, &user_info)) {
@@ -312,6 +446,9 @@ client_main(int userid, int _infd, int _outfd)
         free(gamepaths[i]);
     free(gamepaths);
 
+    nh_set_backup_cadence(settings.backup_diff_percent,
+                          settings.backup_max_diffs);
+
     client_main_loop();
 
     exit_client(NULL);
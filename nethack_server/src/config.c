@@ -195,6 +195,94 @@ parse_config_line(char *line)
         }
     }
 
+    else if (!strcmp(line, "relay_buffer_size")) {
+        if (!settings.relay_buffer_size)
+            settings.relay_buffer_size = atoi(val);
+
+        if (settings.relay_buffer_size < 4096 ||
+            settings.relay_buffer_size > (16 * 1024 * 1024)) {
+            fprintf(stderr,
+                    "Error: the value for relay_buffer_size must be in the"
+                    " range [4096, 16777216].\n");
+            return FALSE;
+        }
+    }
+
+    else if (!strcmp(line, "relay_pipe_size")) {
+        if (!settings.relay_pipe_size)
+            settings.relay_pipe_size = atoi(val);
+
+        if (settings.relay_pipe_size < 0 ||
+            settings.relay_pipe_size > (16 * 1024 * 1024)) {
+            fprintf(stderr,
+                    "Error: the value for relay_pipe_size must be in the"
+                    " range [0, 16777216].\n");
+            return FALSE;
+        }
+    }
+
+    else if (!strcmp(line, "relay_flush_deadline")) {
+        if (!settings.relay_flush_deadline)
+            settings.relay_flush_deadline = atoi(val);
+
+        if (settings.relay_flush_deadline < 0 ||
+            settings.relay_flush_deadline > 1000) {
+            fprintf(stderr,
+                    "Error: the value for relay_flush_deadline must be in the"
+                    " range [0, 1000].\n");
+            return FALSE;
+        }
+    }
+
+    else if (!strcmp(line, "disable_compression")) {
+        if (*val == '1' || !strcmp(val, "true"))
+            settings.disable_compression = TRUE;
+        else if (*val != '0' && strcmp(val, "false")) {
+            fprintf(stderr,
+                    "Error: disable_compression may only be set to \"0\", "
+                    "\"1\", \"true\" or \"false\".\n");
+            return FALSE;
+        }
+    }
+
+    else if (!strcmp(line, "relay_threads")) {
+        if (!settings.relay_threads)
+            settings.relay_threads = atoi(val);
+
+        if (settings.relay_threads < 0 || settings.relay_threads > 256) {
+            fprintf(stderr,
+                    "Error: the value for relay_threads must be in the"
+                    " range [0, 256].\n");
+            return FALSE;
+        }
+    }
+
+    else if (!strcmp(line, "backup_diff_percent")) {
+        if (!settings.backup_diff_percent)
+            settings.backup_diff_percent = atoi(val);
+
+        if (settings.backup_diff_percent < 10 ||
+            settings.backup_diff_percent > 100000) {
+            fprintf(stderr,
+                    "Error: the value for backup_diff_percent must be in the"
+                    " range [10, 100000].\n");
+            return FALSE;
+        }
+    }
+
+    else if (!strcmp(line, "backup_max_diffs")) {
+        if (!settings.backup_max_diffs)
+            settings.backup_max_diffs = atoi(val);
+
+        if (settings.backup_max_diffs < 1 ||
+            settings.backup_max_diffs > 100000) {
+            fprintf(stderr,
+                    "Error: the value for backup_max_diffs must be in the"
+                    " range [1, 100000].\n");
+            return FALSE;
+        }
+    }
+
     else if (!strcmp(line, "dbhost")) {
         if (!settings.dbhost)
             settings.dbhost = strdup(val);
@@ -313,6 +401,9 @@ setup_defaults(void)
 
     if (!settings.client_timeout)
         settings.client_timeout = DEFAULT_CLIENT_TIMEOUT;
+
+    if (!settings.relay_buffer_size)
+        settings.relay_buffer_size = DEFAULT_RELAY_BUFFER_SIZE;
 }
 
 
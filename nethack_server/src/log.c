@@ -10,17 +10,35 @@
 
 #include <time.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 static FILE *logfile;
 static int startup_pid;
 
+/* Relay threads log too. log_lock also makes sure that no thread is halfway
+   through writing to the log when a game process is forked; otherwise the
+   child could inherit a locked logfile and hang on its first message. */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+lock_log(void)
+{
+    pthread_mutex_lock(&log_lock);
+}
+
+static void
+unlock_log(void)
+{
+    pthread_mutex_unlock(&log_lock);
+}
+
 
 void
 log_msg(const char *fmt, ...)
 {
     char msgbuf[512], timestamp[32], *last;
-    struct tm *tm_local;
+    struct tm tm_buf, *tm_local;
     struct timeval tv;
     va_list args;
 
@@ -36,10 +54,11 @@ log_msg(const char *fmt, ...)
 
     /* make a timestamp like "2011-11-30 18:45:59" */
     gettimeofday(&tv, NULL);
-    tm_local = localtime(&tv.tv_sec);
+    tm_local = localtime_r(&tv.tv_sec, &tm_buf);
     if (!tm_local ||
         !strftime(timestamp, sizeof (timestamp), "%Y-%m-%d %H:%M:%S", tm_local))
         strcpy(timestamp, "???");
+    lock_log();
     fprintf(logfile, "%s.%06ld [%d] %s\n", timestamp, tv.tv_usec, getpid(),
             msgbuf);
     fflush(logfile);
@@ -48,6 +67,7 @@ log_msg(const char *fmt, ...)
         /* stdout is still open, lets print some stuff */
         fprintf(stdout, "%s.%06ld [%d] %s\n", timestamp, tv.tv_usec, getpid(),
                 msgbuf);
+    unlock_log();
 }
 
 
@@ -61,6 +81,7 @@ begin_logging(void)
         return FALSE;
     }
 
+    pthread_atfork(lock_log, unlock_log, unlock_log);
     return TRUE;
 }
 
@@ -118,6 +139,18 @@ report_startup(void)
     log_msg("  unixsocket = %s", addr2str(&settings.bind_addr_unix));
     log_msg("  port = %d", settings.port);
     log_msg("  client_timeout = %d", settings.client_timeout);
+    log_msg("  relay_buffer_size = %d", settings.relay_buffer_size);
+    if (settings.relay_pipe_size)
+        log_msg("  relay_pipe_size = %d", settings.relay_pipe_size);
+    if (settings.relay_flush_deadline)
+        log_msg("  relay_flush_deadline = %d", settings.relay_flush_deadline);
+    log_msg("  relay_threads = %d", settings.relay_threads);
+    log_msg("  disable_compression = %s",
+            settings.disable_compression ? "true" : "false");
+    if (settings.backup_diff_percent)
+        log_msg("  backup_diff_percent = %d", settings.backup_diff_percent);
+    if (settings.backup_max_diffs)
+        log_msg("  backup_max_diffs = %d", settings.backup_max_diffs);
 
     /* database settings */
     log_msg("  dbhost = %s", settings.dbhost ? settings.dbhost : "(not set)");
@@ -41,9 +41,16 @@
  * inactivity, though).
  * When the connection is re-established, the client's requests get forwarded
  * again.
+ *
+ * The relaying itself can optionally be spread over several threads of the
+ * main server process (settings.relay_threads). This doesn't conflict with the
+ * one-process-per-game rule: the threads only ever pass data between sockets
+ * and pipes, and never touch game state. Each relay thread owns a "shard" of
+ * the established games; the main thread keeps the listening sockets,
+ * authenticates new connections and hands them off to a shard.
  */
 
-/* For accept4 and timersub */
+/* For accept4, F_SETPIPE_SZ and timersub */
 #ifndef _GNU_SOURCE
 # define _GNU_SOURCE
 #endif
@@ -51,7 +58,14 @@
 #include "nhserver.h"
 
 #include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <zlib.h>
 
 #if defined(OPEN_MAX)
 static int
@@ -77,12 +91,34 @@ get_open_max(void)
    */
 #define AUTHBUFSIZE 512
 
+/* Games are indexed by user id, so that a reconnecting client can find its
+   game without walking the game lists. Must be a power of 2. */
+#define USER_INDEX_SIZE 1024
+
+/* Idle games are found via a hashed timer wheel with a resolution of one
+   second; a game whose deadline is more than IDLE_WHEEL_SLOTS seconds away
+   just stays put for another revolution. Must be a power of 2. */
+#define IDLE_WHEEL_SLOTS 256
+
+/* size of the buffers for compressed data; see start_compression() */
+#define ZBUF_SIZE 16384
+
 enum comm_status {
     NEW_CONNECTION,
     CLIENT_DISCONNECTED,
     CLIENT_CONNECTED
 };
 
+/* Game output which has been read from a game's pipe, but not yet sent to the
+   client. This is a ring buffer of settings.relay_buffer_size bytes; data is
+   read into it directly from the pipe and written out of it directly to the
+   socket, so there is no additional copy. */
+struct relay_buffer {
+    char *data;
+    int start;          /* offset of the first unsent byte */
+    int len;            /* number of unsent bytes */
+};
+
 /* Client communication data.
 
    This structure tracks connected clients, ie remote users with open sockets
@@ -93,6 +129,7 @@ enum comm_status {
    cause all sorts of headaches and saving a few bytes just isn't worth it. */
 struct client_data {
     enum comm_status state;
+    struct relay_shard *shard;
     int pid;
     int userid;         /* owner of this game */
     int connid;
@@ -100,8 +137,66 @@ struct client_data {
     int pipe_out;       /* master -> game pipe */
     int pipe_in;        /* game -> master pipe */
     int sock;           /* master <-> client socket */
-    int unsent_data_size;
-    char *unsent_data;
+    int sock_blocked;   /* the last write to sock returned EAGAIN */
+    struct relay_buffer outbuf;
+    struct client_data *index_next;     /* next game in the same user index
+                                           bucket */
+    struct client_data *idle_next, **idle_prev;    /* idle wheel slot */
+    time_t last_input;  /* when the client last sent us anything */
+
+    /* state of a minimal JSON scanner run over the game's output, so that we
+       know whether the relayed data ends at the end of a message */
+    int msg_depth;
+    char msg_in_string, msg_escaped;
+    char corked;        /* TCP_CORK is set on sock */
+    long cork_deadline; /* see monotonic_ms() */
+
+    /* deflate streams for a client that asked for compression, or NULL */
+    z_stream *zout, *zin;
+    struct relay_buffer zbuf;   /* compressed output that wasn't sent yet;
+                                   this one is linear, not a ring */
+    char zflush_pending;        /* zout still holds part of a sync flush */
+};
+
+
+/* A relay shard: a set of established games, together with the epoll instance
+   that watches their sockets and pipes.
+
+   Without relay threads, there is only one shard (main_shard), which is served
+   by the main event loop along with the listening sockets. Otherwise each shard
+   is served by a thread of its own. A shard's lock is held by its thread while
+   it processes a batch of events, and by the main thread while it hands a
+   connection off to the shard, so the two never see each other's half-done
+   changes. */
+struct relay_shard {
+    int epfd;
+    int wakefd;         /* eventfd used to stop the shard's thread */
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+
+    /* disconnected_list_head: list of games which are fully established, but
+       the client has disconnected. The client can reconnect to the running
+       game later. in these client_data structures, sockfd will be -1, but
+       everything else is valid.*/
+    struct client_data disconnected_list_head;
+
+    /* connected_list_head: list of games which are fully established and have
+       a connected client. */
+    struct client_data connected_list_head;
+
+    struct client_data **fd_to_client;
+    int fd_to_client_max;
+
+    /* all games of this shard, by userid & (USER_INDEX_SIZE - 1); within a
+       bucket, the most recently (re)linked game comes first */
+    struct client_data *user_index[USER_INDEX_SIZE];
+
+    struct client_data *idle_wheel[IDLE_WHEEL_SLOTS];
+    time_t idle_wheel_time;     /* the wheel has been run up to this second */
+    int idle_count;
+
+    int corked_count;   /* number of connected games with corked sockets */
 };
 
 
@@ -110,76 +205,254 @@ struct client_data {
 static struct client_data new_connection_dummy = { NEW_CONNECTION, 0
                                                    /* , 0 etc */  };
 
-/* disconnected_list_head: list of games which are fully established, but the
-   client has disconnected. The client can reconnect to the running game later.
-   in these client_data structures, sockfd will be -1, but everything else is
-   valid.*/
-static struct client_data disconnected_list_head;
+/* The shard served by the main event loop. With relay threads, it only holds
+   connections that have not been authenticated yet. */
+static struct relay_shard main_shard;
+
+static struct relay_shard *shards;
+static int shard_count, next_shard;
 
-/* connected_list_head: list of games which are fully established and have a
-   connected client. */
-static struct client_data connected_list_head;
+static pthread_mutex_t client_count_lock = PTHREAD_MUTEX_INITIALIZER;
+static int client_count;
 
-static struct client_data **fd_to_client;
-static int client_count, fd_to_client_max;
+/* SIGCHLD is blocked in the master process and read from here instead, so that
+   a game process exiting wakes up the main event loop */
+static int sigchld_fd = -1;
+static sigset_t sigchld_set;
 
 /*---------------------------------------------------------------------------*/
 
 
-static void cleanup_game_process(struct client_data *client, int epfd);
+static void cleanup_game_process(struct client_data *client);
 static int init_server_socket(struct sockaddr *sa);
-static int fork_client(struct client_data *client, int epfd);
-static void handle_new_connection(int newfd, int epfd);
+static int fork_client(struct client_data *client);
+static void handle_new_connection(int newfd);
+static void forget_cork(struct client_data *client);
+static void detach_client_socket(struct client_data *client);
+static int start_compression(struct client_data *client);
+static void end_compression(struct client_data *client);
+
+
+static time_t
+monotonic_seconds(void)
+{
+    struct timespec ts;
 
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static long
+monotonic_ms(void)
+{
+    struct timespec ts;
 
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+
+/* Linking a game into one of a shard's lists also (re)indexes it. */
 static void
 link_client_data(struct client_data *client, struct client_data *list)
 {
+    struct client_data **bucket =
+        &client->shard->user_index[client->userid & (USER_INDEX_SIZE - 1)];
+
     client->prev = list;
     client->next = list->next;
     list->next = client;
     if (client->next)
         client->next->prev = client;
 
+    client->index_next = *bucket;
+    *bucket = client;
+
+    pthread_mutex_lock(&client_count_lock);
     client_count++;
+    pthread_mutex_unlock(&client_count_lock);
 }
 
 static void
 unlink_client_data(struct client_data *client)
 {
+    struct client_data **bucket =
+        &client->shard->user_index[client->userid & (USER_INDEX_SIZE - 1)];
+
     if (client->prev)
         client->prev->next = client->next;
     if (client->next)
         client->next->prev = client->prev;
 
+    while (*bucket && *bucket != client)
+        bucket = &(*bucket)->index_next;
+    if (*bucket)
+        *bucket = client->index_next;
+    client->index_next = NULL;
+
+    pthread_mutex_lock(&client_count_lock);
     client_count--;
+    pthread_mutex_unlock(&client_count_lock);
+}
+
+static int
+get_client_count(void)
+{
+    int count;
+
+    pthread_mutex_lock(&client_count_lock);
+    count = client_count;
+    pthread_mutex_unlock(&client_count_lock);
+
+    return count;
+}
+
+/*
+ * Idle games. Every game sits on its shard's idle wheel, in the slot for the
+ * second in which it would time out if the client sent nothing more. Input
+ * from the client only updates last_input; the game is moved along when its
+ * old slot comes up. This way the master process finds idle games with a
+ * little work per second, rather than each game process having to notice its
+ * own inactivity.
+ */
+static void
+idle_wheel_add(struct client_data *client)
+{
+    struct relay_shard *shard = client->shard;
+    time_t deadline = client->last_input + settings.client_timeout;
+    struct client_data **slot =
+        &shard->idle_wheel[deadline & (IDLE_WHEEL_SLOTS - 1)];
+
+    client->idle_next = *slot;
+    client->idle_prev = slot;
+    if (*slot)
+        (*slot)->idle_prev = &client->idle_next;
+    *slot = client;
+    shard->idle_count++;
+}
+
+static void
+idle_wheel_remove(struct client_data *client)
+{
+    if (!client->idle_prev)
+        return;
+
+    *client->idle_prev = client->idle_next;
+    if (client->idle_next)
+        client->idle_next->idle_prev = client->idle_prev;
+    client->idle_next = NULL;
+    client->idle_prev = NULL;
+    client->shard->idle_count--;
 }
 
+static void
+run_idle_wheel(struct relay_shard *shard)
+{
+    time_t t, now = monotonic_seconds();
+    struct client_data *client, *next;
+    struct client_data **slot;
+
+    if (!shard->idle_count) {
+        shard->idle_wheel_time = now;
+        return;
+    }
+
+    /* after a long sleep, one revolution visits every slot */
+    if (now - shard->idle_wheel_time > IDLE_WHEEL_SLOTS)
+        shard->idle_wheel_time = now - IDLE_WHEEL_SLOTS;
+
+    for (t = shard->idle_wheel_time + 1; t <= now; t++) {
+        /* detach the whole slot first, so that games which go back into it
+           aren't visited twice */
+        slot = &shard->idle_wheel[t & (IDLE_WHEEL_SLOTS - 1)];
+        client = *slot;
+        *slot = NULL;
+
+        for (; client; client = next) {
+            next = client->idle_next;
+            client->idle_next = NULL;
+            client->idle_prev = NULL;
+            shard->idle_count--;
+
+            if (client->last_input + settings.client_timeout > now)
+                idle_wheel_add(client);
+            else {
+                log_msg("Inactivity timeout for game at pid %d, user %d",
+                        client->pid, client->userid);
+                cleanup_game_process(client);
+            }
+        }
+    }
+
+    shard->idle_wheel_time = now;
+}
+
+
+
 static struct client_data *
-alloc_client_data(struct client_data *list_start)
+alloc_client_data(struct relay_shard *shard, int userid)
 {
     struct client_data *client = malloc(sizeof (struct client_data));
 
     memset(client, 0, sizeof (struct client_data));
-    link_client_data(client, list_start);
+    client->shard = shard;
+    client->userid = userid;
+    link_client_data(client, &shard->connected_list_head);
     client->sock = client->pipe_in = client->pipe_out = -1;
 
+    client->last_input = monotonic_seconds();
+    idle_wheel_add(client);
+
     return client;
 }
 
 
 static void
-map_fd_to_client(int fd, struct client_data *client)
+map_fd_to_client(struct relay_shard *shard, int fd, struct client_data *client)
 {
     int size;
 
-    while (fd >= fd_to_client_max) {
-        size = fd_to_client_max * sizeof (struct client_data *);
-        fd_to_client = realloc(fd_to_client, 2 * size);
-        memset(&fd_to_client[fd_to_client_max], 0, size);
-        fd_to_client_max *= 2;
+    while (fd >= shard->fd_to_client_max) {
+        size = shard->fd_to_client_max * sizeof (struct client_data *);
+        shard->fd_to_client = realloc(shard->fd_to_client, 2 * size);
+        memset(&shard->fd_to_client[shard->fd_to_client_max], 0, size);
+        shard->fd_to_client_max *= 2;
+    }
+    shard->fd_to_client[fd] = client;
+}
+
+
+static int
+init_shard(struct relay_shard *shard)
+{
+    memset(shard, 0, sizeof (struct relay_shard));
+    shard->wakefd = -1;
+    pthread_mutex_init(&shard->lock, NULL);
+
+    shard->fd_to_client_max = 64;       /* will be doubled every time it
+                                           becomes too small */
+    shard->fd_to_client = calloc(shard->fd_to_client_max,
+                                 sizeof (struct client_data *));
+
+    shard->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epfd == -1) {
+        log_msg("Error in epoll_create1");
+        return FALSE;
     }
-    fd_to_client[fd] = client;
+
+    return TRUE;
+}
+
+
+static void
+free_shard(struct relay_shard *shard)
+{
+    if (shard->epfd != -1)
+        close(shard->epfd);
+    if (shard->wakefd != -1)
+        close(shard->wakefd);
+    free(shard->fd_to_client);
+    pthread_mutex_destroy(&shard->lock);
 }
 
 
@@ -267,18 +540,26 @@ post_fork_cleanup(void)
     for (i = 0; i < get_open_max(); i++)
         if (fcntl(i, F_GETFD) & FD_CLOEXEC)
             close(i);
+    sigprocmask(SIG_UNBLOCK, &sigchld_set, NULL);
+
+    /* Relay threads may have been halfway through changing their client lists
+       when we forked, so the lists can't be walked safely; just leave that
+       memory alone in that case. */
+    if (settings.relay_threads)
+        return;
 
-    for (ccur = disconnected_list_head.next; ccur; ccur = cnext) {
+    for (ccur = main_shard.disconnected_list_head.next; ccur; ccur = cnext) {
         cnext = ccur->next;
         free(ccur);
     }
 
-    for (ccur = connected_list_head.next; ccur; ccur = cnext) {
+    for (ccur = main_shard.connected_list_head.next; ccur; ccur = cnext) {
         cnext = ccur->next;
+        free(ccur->outbuf.data);
         free(ccur);
     }
 
-    free(fd_to_client);
+    free(main_shard.fd_to_client);
 }
 
 
@@ -288,8 +569,9 @@ post_fork_cleanup(void)
  * process.
  */
 static int
-fork_client(struct client_data *client, int epfd)
+fork_client(struct client_data *client)
 {
+    struct relay_shard *shard = client->shard;
     int ret1, ret2, userid;
     int pipe_out_fd[2];
     int pipe_in_fd[2];
@@ -307,7 +589,7 @@ fork_client(struct client_data *client, int epfd)
            fail with the same status as the first if the first call fails. */
         log_msg("Failed to create communication pipes for new connection: %s",
                 strerror(errno));
-        cleanup_game_process(client, epfd);
+        cleanup_game_process(client);
         return FALSE;
     }
 
@@ -320,10 +602,19 @@ fork_client(struct client_data *client, int epfd)
     fcntl(pipe_out_fd[1], F_SETFD, FD_CLOEXEC); /* client does not need to
                                                    inherit this */
 
+    /* The default pipe capacity is smaller than a full map update, which makes
+       the game process block halfway through writing one. */
+    if (settings.relay_pipe_size) {
+        if (fcntl(pipe_in_fd[0], F_SETPIPE_SZ, settings.relay_pipe_size) == -1 ||
+            fcntl(pipe_out_fd[1], F_SETPIPE_SZ, settings.relay_pipe_size) == -1)
+            log_msg("Failed to set the pipe size to %d: %s",
+                    settings.relay_pipe_size, strerror(errno));
+    }
+
     client->pipe_out = pipe_out_fd[1];
     client->pipe_in = pipe_in_fd[0];
-    map_fd_to_client(client->pipe_out, client);
-    map_fd_to_client(client->pipe_in, client);
+    map_fd_to_client(shard, client->pipe_out, client);
+    map_fd_to_client(shard, client->pipe_in, client);
 
     client->pid = fork();
     if (client->pid > 0) {      /* parent */
@@ -341,22 +632,22 @@ fork_client(struct client_data *client, int epfd)
            closed here, this end gets handled in cleanup_game_process */
         close(pipe_out_fd[0]);
         close(pipe_in_fd[1]);
-        cleanup_game_process(client, epfd);
+        cleanup_game_process(client);
         log_msg("Failed to fork a client process: %s", strerror(errno));
         return FALSE;
     }
 
     client->state = CLIENT_CONNECTED;
     unlink_client_data(client);
-    link_client_data(client, &connected_list_head);
+    link_client_data(client, &shard->connected_list_head);
 
     /* register the pipe fds for monitoring by epoll */
     memset(&ev, 0, sizeof ev);
     ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
     ev.data.fd = client->pipe_out;
-    epoll_ctl(epfd, EPOLL_CTL_ADD, client->pipe_out, &ev);
+    epoll_ctl(shard->epfd, EPOLL_CTL_ADD, client->pipe_out, &ev);
     ev.data.fd = client->pipe_in;
-    epoll_ctl(epfd, EPOLL_CTL_ADD, client->pipe_in, &ev);
+    epoll_ctl(shard->epfd, EPOLL_CTL_ADD, client->pipe_in, &ev);
 
     /* close the client side of the pipes */
     close(pipe_out_fd[0]);
@@ -371,7 +662,7 @@ fork_client(struct client_data *client, int epfd)
  * sockets.
  */
 static void
-server_socket_event(int server_fd, int epfd)
+server_socket_event(int server_fd)
 {
     struct epoll_event ev;
     struct sockaddr_storage addr;
@@ -396,34 +687,94 @@ server_socket_event(int server_fd, int epfd)
         ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
         memset(&ev, 0, sizeof ev);
         ev.data.fd = newfd;
-        if (epoll_ctl(epfd, EPOLL_CTL_ADD, newfd, &ev) == -1) {
+        if (epoll_ctl(main_shard.epfd, EPOLL_CTL_ADD, newfd, &ev) == -1) {
             log_msg("Error in epoll_ctl for %s: %s", addr2str(&addr),
                     strerror(errno));
             close(newfd);
             return;
         }
-        map_fd_to_client(newfd, &new_connection_dummy);
+        map_fd_to_client(&main_shard, newfd, &new_connection_dummy);
         return;
     } else
-        handle_new_connection(newfd, epfd);
+        handle_new_connection(newfd);
+}
+
+
+/*
+ * Look through one shard's user index for a game of the given user in the
+ * given state (and with the given connection ID, if reconnect_id is nonzero).
+ * The caller must hold the shard's lock. Returns the matching client, or NULL
+ * if there is none.
+ */
+static struct client_data *
+find_in_user_index(struct relay_shard *shard, enum comm_status state,
+                   int userid, int reconnect_id)
+{
+    struct client_data *client;
+
+    for (client = shard->user_index[userid & (USER_INDEX_SIZE - 1)]; client;
+         client = client->index_next)
+        if (client->state == state && client->userid == userid &&
+            (!reconnect_id || reconnect_id == client->connid))
+            return client;
+
+    return NULL;
+}
+
+
+/*
+ * Find a running game of the given user that a new connection can be attached
+ * to. If there is one, the shard it belongs to is returned locked.
+ */
+static struct client_data *
+find_reconnect_target(int userid, int reconnect_id)
+{
+    struct client_data *client;
+    int i;
+
+    for (i = 0; i < shard_count; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        client = find_in_user_index(&shards[i], CLIENT_DISCONNECTED, userid,
+                                    reconnect_id);
+        if (client)
+            return client;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    if (!reconnect_id)
+        return NULL;
+
+    /* now search through the active connections. The client might have a new
+       IP address, which would leave the socket open and seemingly valid. */
+    for (i = 0; i < shard_count; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        client = find_in_user_index(&shards[i], CLIENT_CONNECTED, userid,
+                                    reconnect_id);
+        if (client)
+            return client;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    return NULL;
 }
 
 
 static void
-handle_new_connection(int newfd, int epfd)
+handle_new_connection(int newfd)
 {
     struct epoll_event ev;
     struct client_data *client;
+    struct relay_shard *shard;
     struct sockaddr_storage addr;
     socklen_t addrlen = sizeof (addr);
     char authbuf[AUTHBUFSIZE];
-    int pos, is_reg, reconnect_id, authlen, userid;
+    int pos, is_reg, reconnect_id, authlen, userid, compress;
     static int connection_id = 1;
 
-    if (fd_to_client_max > newfd &&
-        fd_to_client[newfd] == &new_connection_dummy) {
-        epoll_ctl(epfd, EPOLL_CTL_DEL, newfd, &ev);
-        fd_to_client[newfd] = NULL;
+    if (main_shard.fd_to_client_max > newfd &&
+        main_shard.fd_to_client[newfd] == &new_connection_dummy) {
+        epoll_ctl(main_shard.epfd, EPOLL_CTL_DEL, newfd, &ev);
+        main_shard.fd_to_client[newfd] = NULL;
     }
 
     /* it should be possible to read immediately due to the "defer" sockopt */
@@ -461,51 +812,68 @@ handle_new_connection(int newfd, int epfd)
     /*
      * ready to authenticate the user here
      */
-    userid = auth_user(authbuf, addr2str(&addr), &is_reg, &reconnect_id);
+    userid = auth_user(authbuf, addr2str(&addr), &is_reg, &reconnect_id,
+                       &compress);
     if (userid <= 0) {
         if (!userid)
-            auth_send_result(newfd, AUTH_FAILED_UNKNOWN_USER, is_reg, 0);
+            auth_send_result(newfd, AUTH_FAILED_UNKNOWN_USER, is_reg, 0,
+                             FALSE);
         else
-            auth_send_result(newfd, AUTH_FAILED_BAD_PASSWORD, is_reg, 0);
+            auth_send_result(newfd, AUTH_FAILED_BAD_PASSWORD, is_reg, 0,
+                             FALSE);
         log_msg("authentication failed for %s", addr2str(&addr));
         close(newfd);
         return;
     }
 
+    if (settings.disable_compression)
+        compress = FALSE;
+
     /* user ok, we'll keep this socket */
     memset(&ev, 0, sizeof ev);
     ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
     ev.data.fd = newfd;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, newfd, &ev) == -1) {
-        log_msg("Error in epoll_ctl for %s: %s", addr2str(&addr),
-                strerror(errno));
-        close(newfd);
-        return;
-    }
 
     /* is the client re-establishing a connection to an existing, disconnected
        game? */
-    for (client = disconnected_list_head.next; client; client = client->next)
-        if (client->userid == userid &&
-            (!reconnect_id || reconnect_id == client->connid))
-            break;
-    if (reconnect_id && !client) {
-        /* now search through the active connections. The client might have a
-           new IP address, which would leave the socket open and seemingly
-           valid. */
-        for (client = connected_list_head.next; client; client = client->next)
-            if (client->userid == userid && reconnect_id == client->connid)
-                break;
-    }
+    client = find_reconnect_target(userid, reconnect_id);
 
     if (client) {
         /* there is a running, disconnected game process for this user */
-        auth_send_result(newfd, AUTH_SUCCESS_RECONNECT, is_reg, client->connid);
+        shard = client->shard;
+
+        /* The game may still be attached to an old connection that hasn't
+           noticed it's gone yet. Nothing that belongs to that connection
+           carries over: not its socket, buffered output, cork or deflate
+           streams. */
+        detach_client_socket(client);
+
+        if (epoll_ctl(shard->epfd, EPOLL_CTL_ADD, newfd, &ev) == -1) {
+            log_msg("Error in epoll_ctl for %s: %s", addr2str(&addr),
+                    strerror(errno));
+            close(newfd);
+            pthread_mutex_unlock(&shard->lock);
+            return;
+        }
+
+        if (compress)
+            compress = start_compression(client);
+        if (compress == -1) {
+            /* the game carries on, and the user can try again later */
+            epoll_ctl(shard->epfd, EPOLL_CTL_DEL, newfd, NULL);
+            close(newfd);
+            pthread_mutex_unlock(&shard->lock);
+            return;
+        }
+        auth_send_result(newfd, AUTH_SUCCESS_RECONNECT, is_reg, client->connid,
+                         compress);
         client->sock = newfd;
-        map_fd_to_client(client->sock, client);
+        client->sock_blocked = FALSE;
+        client->last_input = monotonic_seconds();
+        map_fd_to_client(shard, client->sock, client);
         client->state = CLIENT_CONNECTED;
         unlink_client_data(client);
-        link_client_data(client, &connected_list_head);
+        link_client_data(client, &shard->connected_list_head);
 
         /* signal to reset the read buffer */
         if (write(client->pipe_out, "\033", 1) < 0)
@@ -514,21 +882,40 @@ handle_new_connection(int newfd, int epfd)
 
         log_msg("Connection to game at pid %d reestablished for user %d",
                 client->pid, client->userid);
+        pthread_mutex_unlock(&shard->lock);
         return;
     } else {
-        client = alloc_client_data(&connected_list_head);
+        shard = &shards[next_shard++ % shard_count];
+        pthread_mutex_lock(&shard->lock);
+        if (epoll_ctl(shard->epfd, EPOLL_CTL_ADD, newfd, &ev) == -1) {
+            log_msg("Error in epoll_ctl for %s: %s", addr2str(&addr),
+                    strerror(errno));
+            close(newfd);
+            pthread_mutex_unlock(&shard->lock);
+            return;
+        }
+
+        client = alloc_client_data(shard, userid);
         client->state = CLIENT_CONNECTED;
         client->sock = newfd;
-        map_fd_to_client(newfd, client);
+        map_fd_to_client(shard, newfd, client);
         client->connid = connection_id++;
-        client->userid = userid;
         /* there is no process yet */
-        if (fork_client(client, epfd))
-            auth_send_result(newfd, AUTH_SUCCESS_NEW, is_reg, client->connid);
+        if (fork_client(client)) {
+            if (compress)
+                compress = start_compression(client);
+            if (compress == -1)
+                /* treated like any other lost connection */
+                shutdown(newfd, SHUT_RDWR);
+            else
+                auth_send_result(newfd, AUTH_SUCCESS_NEW, is_reg,
+                                 client->connid, compress);
+        }
         /* else: client communication is shutdown if fork_client errors out */
+        pthread_mutex_unlock(&shard->lock);
     }
 
-    log_msg("There are now %d clients on the server", client_count);
+    log_msg("There are now %d clients on the server", get_client_count());
 }
 
 
@@ -536,40 +923,44 @@ handle_new_connection(int newfd, int epfd)
  * completely free a client_data struct and all its pointers
  */
 static void
-cleanup_game_process(struct client_data *client, int epfd)
+cleanup_game_process(struct client_data *client)
 {
+    struct relay_shard *shard = client->shard;
+
     /* if the client didn't get a signal yet, send it one now. */
     if (client->pid)
         kill(client->pid, SIGTERM);
 
     /* close all file descriptors and free data structures */
     if (client->sock != -1) {
-        epoll_ctl(epfd, EPOLL_CTL_DEL, client->sock, NULL);
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->sock, NULL);
         shutdown(client->sock, SHUT_RDWR);
         close(client->sock);
-        fd_to_client[client->sock] = NULL;
+        shard->fd_to_client[client->sock] = NULL;
     }
 
     if (client->pipe_out != -1) {
-        epoll_ctl(epfd, EPOLL_CTL_DEL, client->pipe_out, NULL);
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->pipe_out, NULL);
         close(client->pipe_out);
-        fd_to_client[client->pipe_out] = NULL;
+        shard->fd_to_client[client->pipe_out] = NULL;
     }
 
     if (client->pipe_in != -1) {
-        epoll_ctl(epfd, EPOLL_CTL_DEL, client->pipe_in, NULL);
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->pipe_in, NULL);
         close(client->pipe_in);
-        fd_to_client[client->pipe_in] = NULL;
+        shard->fd_to_client[client->pipe_in] = NULL;
     }
 
-    if (client->unsent_data)
-        free(client->unsent_data);
+    free(client->outbuf.data);
+    forget_cork(client);
+    end_compression(client);
 
     client->pipe_in = client->pipe_out = client->sock = -1;
+    idle_wheel_remove(client);
     unlink_client_data(client);
     free(client);
 
-    log_msg("There are now %d clients on the server", client_count);
+    log_msg("There are now %d clients on the server", get_client_count());
 }
 
 
@@ -581,19 +972,21 @@ cleanup_game_process(struct client_data *client, int epfd)
  * closed, too.
  */
 static void
-close_client_pipe(struct client_data *client, int epfd)
+close_client_pipe(struct client_data *client)
 {
+    struct relay_shard *shard = client->shard;
+
     if (client->pipe_in != -1) {
-        epoll_ctl(epfd, EPOLL_CTL_DEL, client->pipe_in, NULL);
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->pipe_in, NULL);
         close(client->pipe_in);
-        fd_to_client[client->pipe_in] = NULL;
+        shard->fd_to_client[client->pipe_in] = NULL;
         client->pipe_in = -1;
     }
 
     if (client->pipe_out != -1) {
-        epoll_ctl(epfd, EPOLL_CTL_DEL, client->pipe_out, NULL);
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->pipe_out, NULL);
         close(client->pipe_out);
-        fd_to_client[client->pipe_out] = NULL;
+        shard->fd_to_client[client->pipe_out] = NULL;
         client->pipe_out = -1;
     }
 
@@ -606,50 +999,478 @@ close_client_pipe(struct client_data *client, int epfd)
         /* don't try to send a signal in cleanup_game_process - the process may
            be gone already */
         client->pid = 0;
-        cleanup_game_process(client, epfd);
+        cleanup_game_process(client);
     }
 }
 
 
+/*
+ * Game output is relayed to the client through client->outbuf: we read as much
+ * from the pipe as fits into the free part of the ring buffer, and write as
+ * much of the buffered data to the socket as the socket accepts. Once the
+ * buffer is full, we stop reading from the pipe; the pipe fills up in turn,
+ * and the game process blocks until the client catches up. So the amount of
+ * memory used per client is bounded no matter how slow the client is.
+ */
 static int
-send_to_client(struct client_data *client, char *buffer, int sendlen)
+relay_pending_iov(struct client_data *client, struct iovec *iov)
 {
-    int sent, ret;
-    char *newbuf;
+    struct relay_buffer *rb = &client->outbuf;
+    int first = settings.relay_buffer_size - rb->start;
 
-    if (!buffer) {
-        buffer = client->unsent_data;
-        sendlen = client->unsent_data_size;
-        if (!buffer)
-            return 0;
+    if (first > rb->len)
+        first = rb->len;
+
+    iov[0].iov_base = rb->data + rb->start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = rb->data;
+    iov[1].iov_len = rb->len - first;
+
+    return iov[1].iov_len ? 2 : 1;
+}
+
+static int
+relay_free_iov(struct client_data *client, struct iovec *iov)
+{
+    struct relay_buffer *rb = &client->outbuf;
+    int end = rb->start + rb->len;
+
+    if (end >= settings.relay_buffer_size) {
+        end -= settings.relay_buffer_size;
+        iov[0].iov_base = rb->data + end;
+        iov[0].iov_len = rb->start - end;
+        return 1;
     }
 
-    sent = 0;
-    do {
-        ret = write(client->sock, &buffer[sent], sendlen - sent);
-        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            /* be careful, buffer == client->unsent_data is possible */
-            newbuf = malloc(sendlen - sent);
-            memcpy(newbuf, &buffer[sent], sendlen - sent);
-            if (client->unsent_data)
-                free(client->unsent_data);
-            client->unsent_data = newbuf;
-            client->unsent_data_size = sendlen - sent;
-            return sent;
-        } else if (ret == -1 && errno == EPIPE) {
-            shutdown(client->sock, SHUT_RDWR);
+    iov[0].iov_base = rb->data + end;
+    iov[0].iov_len = settings.relay_buffer_size - end;
+    iov[1].iov_base = rb->data;
+    iov[1].iov_len = rb->start;
+
+    return rb->start ? 2 : 1;
+}
+
+
+/*
+ * Corking. Client sockets have TCP_NODELAY set, so that each message goes out
+ * as soon as it is complete. But a message larger than the pipe reaches us in
+ * several pieces, and each piece would end in a partial packet of its own. So
+ * while the data we have relayed ends in the middle of a message, the socket
+ * is corked: the kernel then only sends full packets. It is uncorked once the
+ * message is complete, or after relay_flush_deadline milliseconds at the
+ * latest, if the game is slow to finish it.
+ */
+static void
+scan_game_output(struct client_data *client, const char *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (client->msg_in_string) {
+            if (client->msg_escaped)
+                client->msg_escaped = FALSE;
+            else if (data[i] == '\\')
+                client->msg_escaped = TRUE;
+            else if (data[i] == '"')
+                client->msg_in_string = FALSE;
+        } else if (data[i] == '"')
+            client->msg_in_string = TRUE;
+        else if (data[i] == '{' || data[i] == '[')
+            client->msg_depth++;
+        else if ((data[i] == '}' || data[i] == ']') && client->msg_depth > 0)
+            client->msg_depth--;
+    }
+}
+
+static void
+reset_game_output_scan(struct client_data *client)
+{
+    client->msg_depth = 0;
+    client->msg_in_string = client->msg_escaped = FALSE;
+}
+
+static int
+at_message_boundary(struct client_data *client)
+{
+    return client->msg_depth == 0 && !client->msg_in_string;
+}
+
+static void
+set_cork(struct client_data *client, int corked)
+{
+    if (client->corked == corked || !settings.relay_flush_deadline ||
+        client->sock == -1)
+        return;
+
+    /* no need to complain if this fails; TCP_CORK doesn't exist for AF_UNIX
+       sockets */
+    setsockopt(client->sock, IPPROTO_TCP, TCP_CORK, &corked, sizeof (int));
+    client->corked = corked;
+    if (corked) {
+        client->cork_deadline = monotonic_ms() + settings.relay_flush_deadline;
+        client->shard->corked_count++;
+    } else
+        client->shard->corked_count--;
+}
+
+/* The socket is being closed, so there's no point in uncorking it. */
+static void
+forget_cork(struct client_data *client)
+{
+    if (client->corked)
+        client->shard->corked_count--;
+    client->corked = FALSE;
+}
+
+static void
+run_cork_deadlines(struct relay_shard *shard)
+{
+    struct client_data *client;
+    long now;
+
+    if (!shard->corked_count)
+        return;
+
+    now = monotonic_ms();
+    for (client = shard->connected_list_head.next; client;
+         client = client->next)
+        if (client->corked && client->cork_deadline <= now)
+            set_cork(client, FALSE);
+}
+
+
+/* epoll_wait timeout for a shard's event loop */
+static int
+shard_timeout(struct relay_shard *shard)
+{
+    if (shard->corked_count)
+        return settings.relay_flush_deadline;
+    return shard->idle_count ? 1000 : -1;
+}
+
+static void
+run_shard_timers(struct relay_shard *shard)
+{
+    run_cork_deadlines(shard);
+    run_idle_wheel(shard);
+}
+
+
+static void
+discard_relay_buffer(struct client_data *client)
+{
+    free(client->outbuf.data);
+    client->outbuf.data = NULL;
+    client->outbuf.start = client->outbuf.len = 0;
+}
+
+
+/*
+ * Close the client's socket, if it still has one, and forget all the state
+ * that belongs to that connection rather than to the game. The game process
+ * itself stays alive on the disconnected list, ready for the user to
+ * reconnect.
+ */
+static void
+detach_client_socket(struct client_data *client)
+{
+    struct relay_shard *shard = client->shard;
+
+    if (client->state == CLIENT_CONNECTED) {
+        client->state = CLIENT_DISCONNECTED;
+        unlink_client_data(client);
+        link_client_data(client, &shard->disconnected_list_head);
+    }
+
+    if (client->sock != -1) {
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->sock, NULL);
+        shutdown(client->sock, SHUT_RDWR);
+        close(client->sock);
+        shard->fd_to_client[client->sock] = NULL;
+        client->sock = -1;
+    }
+
+    /* Maybe the destination vanished before sending completed... the
+       buffered output is likely to be an incomplete JSON object; deleting it
+       is the only sane option. */
+    discard_relay_buffer(client);
+    client->sock_blocked = FALSE;
+    forget_cork(client);
+    reset_game_output_scan(client);
+    end_compression(client);
+}
+
+
+/*
+ * Compression. A client may ask for it with "compress": "deflate" in its auth or
+ * register command; if the response confirms it, everything after the response
+ * is a raw deflate stream in both directions. The streams last as long as the
+ * connection, so each message is compressed against all earlier ones, and are
+ * sync-flushed at the end of each message. This happens here rather than in the
+ * game process because it's a property of the connection: a client may choose
+ * differently when it reconnects.
+ *
+ * Returns TRUE if the streams were set up, FALSE if the client has to do
+ * without compression, or -1 if we ran out of memory; the caller then drops the
+ * connection.
+ */
+static int
+start_compression(struct client_data *client)
+{
+    client->zout = calloc(1, sizeof (z_stream));
+    client->zin = calloc(1, sizeof (z_stream));
+    client->zbuf.data = malloc(ZBUF_SIZE);
+
+    if (!client->zout || !client->zin || !client->zbuf.data) {
+        log_msg("Out of memory for the compression state of user %d; "
+                "dropping the connection", client->userid);
+        free(client->zout);
+        free(client->zin);
+        free(client->zbuf.data);
+        client->zout = client->zin = NULL;
+        client->zbuf.data = NULL;
+        return -1;
+    }
+
+    if (deflateInit2(client->zout, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        log_msg("deflateInit2 failed for user %d", client->userid);
+        free(client->zout);
+        client->zout = NULL;
+        end_compression(client);
+        return FALSE;
+    }
+    if (inflateInit2(client->zin, -15) != Z_OK) {
+        log_msg("inflateInit2 failed for user %d", client->userid);
+        free(client->zin);
+        client->zin = NULL;
+        end_compression(client);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void
+end_compression(struct client_data *client)
+{
+    if (client->zout) {
+        deflateEnd(client->zout);
+        free(client->zout);
+    }
+    if (client->zin) {
+        inflateEnd(client->zin);
+        free(client->zin);
+    }
+    free(client->zbuf.data);
+
+    client->zout = client->zin = NULL;
+    client->zbuf.data = NULL;
+    client->zbuf.start = client->zbuf.len = 0;
+    client->zflush_pending = FALSE;
+}
+
+
+/* The compressed counterpart of flush_relay_buffer: data moves from the ring
+   buffer through zout into zbuf, and from there to the socket. zbuf is only
+   refilled once it is empty, so the ring buffer still provides backpressure. */
+static int
+flush_compressed_output(struct client_data *client)
+{
+    struct relay_buffer *rb = &client->outbuf, *zb = &client->zbuf;
+    z_stream *zs = client->zout;
+    struct iovec iov[2];
+    int ret, flush;
+
+    while (!client->sock_blocked) {
+        if (zb->len) {
+            ret = write(client->sock, zb->data + zb->start, zb->len);
+            if (ret == -1 && errno == EINTR)
+                continue;
+            else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                client->sock_blocked = TRUE;
+            else if (ret == -1) {
+                if (errno == EPIPE)
+                    shutdown(client->sock, SHUT_RDWR);
+                return -1;
+            } else {
+                zb->start += ret;
+                zb->len -= ret;
+            }
+            continue;
+        }
+
+        if (!rb->len && !client->zflush_pending)
+            break;
+
+        /* Only flush once the end of a message has gone into the stream. */
+        if (relay_pending_iov(client, iov) == 1 && at_message_boundary(client))
+            flush = Z_SYNC_FLUSH;
+        else
+            flush = Z_NO_FLUSH;
+
+        zs->next_in = iov[0].iov_base;
+        zs->avail_in = iov[0].iov_len;
+        zs->next_out = (unsigned char *)zb->data;
+        zs->avail_out = ZBUF_SIZE;
+        if (deflate(zs, flush) == Z_STREAM_ERROR) {
+            errno = EPROTO;
             return -1;
-        } else if (ret == -1 && errno != EINTR)
+        }
+
+        ret = iov[0].iov_len - zs->avail_in;
+        rb->start = (rb->start + ret) % settings.relay_buffer_size;
+        rb->len -= ret;
+        zb->start = 0;
+        zb->len = ZBUF_SIZE - zs->avail_out;
+        client->zflush_pending = flush == Z_SYNC_FLUSH && !zs->avail_out;
+    }
+
+    if (!rb->len)
+        rb->start = 0;
+
+    return 0;
+}
+
+
+static int
+flush_relay_buffer(struct client_data *client)
+{
+    struct relay_buffer *rb = &client->outbuf;
+    struct iovec iov[2];
+    int ret;
+
+    if (client->zout)
+        return flush_compressed_output(client);
+
+    while (rb->len && !client->sock_blocked) {
+        ret = writev(client->sock, iov, relay_pending_iov(client, iov));
+        if (ret == -1 && errno == EINTR)
+            continue;
+        else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            client->sock_blocked = TRUE;
+        else if (ret == -1) {
+            if (errno == EPIPE)
+                shutdown(client->sock, SHUT_RDWR);
             return -1;
-        sent += ret;
-    } while (sent < sendlen);
+        } else {
+            rb->start = (rb->start + ret) % settings.relay_buffer_size;
+            rb->len -= ret;
+        }
+    }
 
-    if (client->unsent_data)
-        free(client->unsent_data);
-    client->unsent_data = NULL;
-    client->unsent_data_size = 0;
+    /* keep the free space contiguous while we can */
+    if (!rb->len)
+        rb->start = 0;
 
-    return sent;
+    return 0;
+}
+
+
+/*
+ * Move as much data as possible from the game process to the client without
+ * blocking. This is called whenever the pipe becomes readable or the socket
+ * becomes writable.
+ */
+static int
+relay_game_output(struct client_data *client)
+{
+    struct relay_buffer *rb = &client->outbuf;
+    struct iovec iov[2];
+    int ret;
+
+    if (!rb->data) {
+        rb->data = malloc(settings.relay_buffer_size);
+        if (!rb->data) {
+            /* handled like any other lost connection; the game is kept */
+            log_msg("Out of memory for the relay buffer of game at pid %d, "
+                    "user %d; dropping the connection", client->pid,
+                    client->userid);
+            if (client->sock != -1)
+                shutdown(client->sock, SHUT_RDWR);
+            return -1;
+        }
+    }
+
+    while (1) {
+        if (flush_relay_buffer(client) == -1) {
+            log_msg("error while sending: %s", strerror(errno));
+            return -1;
+        }
+        if (!rb->len && !client->zbuf.len && !client->zflush_pending &&
+            at_message_boundary(client))
+            set_cork(client, FALSE);
+
+        if (rb->len == settings.relay_buffer_size)
+            return 0;   /* the game has to wait for the client */
+
+        ret = readv(client->pipe_in, iov, relay_free_iov(client, iov));
+        if (ret == -1 && errno == EINTR)
+            continue;
+        else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;   /* pipe drained */
+        else if (ret == -1) {
+            log_msg("error while reading from pipe: %s", strerror(errno));
+            return -1;
+        } else if (ret == 0)
+            return 0;   /* EOF; handled via EPOLLHUP */
+
+        rb->len += ret;
+        if (ret > (int)iov[0].iov_len) {
+            scan_game_output(client, iov[0].iov_base, iov[0].iov_len);
+            scan_game_output(client, iov[1].iov_base,
+                             ret - (int)iov[0].iov_len);
+        } else
+            scan_game_output(client, iov[0].iov_base, ret);
+        if (!at_message_boundary(client))
+            set_cork(client, TRUE);
+    }
+}
+
+
+static int
+write_to_game(struct client_data *client, const char *buf, int len)
+{
+    int ret, written = 0;
+
+    while (written < len) {
+        ret = write(client->pipe_out, &buf[written], len - written);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        else if (ret == -1)
+            return -1;
+        written += ret;
+    }
+
+    return 0;
+}
+
+
+static int
+inflate_to_game(struct client_data *client, char *buf, int len)
+{
+    z_stream *zs = client->zin;
+    char out[ZBUF_SIZE];
+    int ret;
+
+    zs->next_in = (unsigned char *)buf;
+    zs->avail_in = len;
+    do {
+        zs->next_out = (unsigned char *)out;
+        zs->avail_out = sizeof (out);
+        ret = inflate(zs, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            log_msg("Broken compressed data from user %d: %s", client->userid,
+                    zs->msg ? zs->msg : "unexpected end of stream");
+            errno = EPROTO;
+            return -1;
+        }
+        if (write_to_game(client, out, sizeof (out) - zs->avail_out) == -1)
+            return -1;
+    } while (zs->avail_in || !zs->avail_out);
+
+    return 0;
 }
 
 
@@ -661,11 +1482,10 @@ send_to_client(struct client_data *client, char *buffer, int sendlen)
  * data around accordingly.
  */
 static void
-handle_communication(int fd, int epfd, unsigned int event_mask)
+handle_communication(struct relay_shard *shard, int fd, unsigned int event_mask)
 {
-    int ret, closed, write_count, errno_orig, read_ret, write_ret;
-    struct client_data *client = fd_to_client[fd];
-    struct epoll_event ev;
+    int closed, read_ret, write_ret;
+    struct client_data *client = shard->fd_to_client[fd];
     char buf[16384];
 
     if (event_mask & EPOLLERR ||        /* fd error */
@@ -677,30 +1497,21 @@ handle_communication(int fd, int epfd, unsigned int event_mask)
 
     if (fd == client->sock) {
         if (closed) {   /* peer gone. goodbye. */
-            epoll_ctl(epfd, EPOLL_CTL_DEL, client->sock, NULL);
+            epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->sock, NULL);
             close(client->sock);
-            fd_to_client[client->sock] = NULL;
+            shard->fd_to_client[client->sock] = NULL;
             client->sock = -1;
             if (client->pipe_in != -1 && client->pipe_out != -1) {
                 log_msg("User %d has disconnected from a game", client->userid);
-                client->state = CLIENT_DISCONNECTED;
-                unlink_client_data(client);
-                link_client_data(client, &disconnected_list_head);
-
-                /* Maybe the destination vanished before sending completed...
-                   unsent_data is likely to be an incomplete JSON object;
-                   deleting it is the only sane option. */
-                if (client->unsent_data)
-                    free(client->unsent_data);
-                client->unsent_data = NULL;
-                client->unsent_data_size = 0;
+                detach_client_socket(client);
             } else {
                 log_msg("Shutdown completed for game at pid %d", client->pid);
                 client->pid = 0;
-                cleanup_game_process(client, epfd);
+                cleanup_game_process(client);
             }
         } else {        /* it is possible to receive or send data */
             if (event_mask & EPOLLIN) {
+                client->last_input = monotonic_seconds();
                 do {
                     write_ret = -2;
                     read_ret = read(client->sock, buf, sizeof (buf));
@@ -708,79 +1519,37 @@ handle_communication(int fd, int epfd, unsigned int event_mask)
                         continue;
                     else if (read_ret <= 0)
                         break;
-                    write_count = 0;
-                    do {
-                        write_ret =
-                            write(client->pipe_out, &buf[write_count],
-                                  read_ret - write_count);
-                        if (write_ret == -1 && errno == EINTR)
-                            continue;
-                        else if (write_ret == -1)
-                            break;
-                        write_count += write_ret;
-                    } while (write_count < read_ret);
+                    if (client->zin)
+                        write_ret = inflate_to_game(client, buf, read_ret);
+                    else
+                        write_ret = write_to_game(client, buf, read_ret);
                 } while (read_ret == sizeof (buf) && write_ret != -1);
                 if (read_ret <= 0 || write_ret == -1) {
                     log_msg("data transfer error for game process %d (read = "
                             "%d, write = %d): %s", client->pid, read_ret,
                             write_ret, strerror(errno));
-                    cleanup_game_process(client, epfd);
+                    cleanup_game_process(client);
+                    return;
                 }
             }
-            if ((event_mask & EPOLLOUT) && client->unsent_data) {
-                write_count = send_to_client(client, NULL, 0);
-                if (write_count == -1)
-                    log_msg("error while sending: %s", strerror(errno));
-
-                /* re-arm pipe_in notification: there may be more data to send
-                   in the pipe for which an event was already received but not
-                   acted upon */
-                memset(&ev, 0, sizeof ev);
-                ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
-                ev.data.fd = client->pipe_in;
-                epoll_ctl(epfd, EPOLL_CTL_MOD, client->pipe_in, &ev);
+            if (event_mask & EPOLLOUT) {
+                /* the socket has room again; send whatever the game process
+                   produced in the meantime */
+                client->sock_blocked = FALSE;
+                relay_game_output(client);
             }
         }
 
     } else if (fd == client->pipe_in) {
         if (closed)
-            close_client_pipe(client, epfd);
-
-        else {  /* there is data to send */
-            if (client->unsent_data)
-                return; /* socket isn't ready for sending */
+            close_client_pipe(client);
 
-            /* oddity alert: this code originally used splice for sending. That
-               would match the receive case above and no buffer would be
-               required. Unfortunately sending that way is significantly
-               slower. splice: 200ms - read+write: 0.2ms! Ouch! */
-            do {
-                /* read from the pipe */
-            redo:
-                ret = read(client->pipe_in, buf, sizeof (buf));
-                errno_orig = errno;
-                if (ret == -1 && errno == EINTR)
-                    goto redo;  /* not "continue", we don't want to check the
-                                   loop condition */
-                else if (ret > 0) {
-                    /* write to the socket; be careful to write all of it... */
-                    write_count = send_to_client(client, buf, ret);
-                    /* write_count != ret if no more data could be sent and the
-                       remainder buf was copied to client->unsent_data for later
-                       sending */
-                } else
-                    write_count = ret;
-            } while (ret == write_count && ret == sizeof (buf));
-            if (ret == -1)
-                log_msg("error while reading from pipe: %s",
-                        strerror(errno_orig));
-            if (write_count == -1)
-                log_msg("error while sending: %s", strerror(errno));
-        }
+        else    /* there is data to send */
+            relay_game_output(client);
 
     } else if (fd == client->pipe_out) {
         if (closed)
-            close_client_pipe(client, epfd);
+            close_client_pipe(client);
 
         else
             /* closed == FALSE doesn't happen for this fd: it's the write side,
@@ -852,7 +1621,8 @@ trigger_server_shutdown(struct timeval *tv, int *ipv4fd, int *ipv6fd,
     termination_flag = 2;
 
     gettimeofday(tv, NULL);
-    log_msg("Shutdown request received; %d clients active.", client_count);
+    log_msg("Shutdown request received; %d clients active.",
+            get_client_count());
     if (*ipv4fd != -1) {
         close(*ipv4fd);
         *ipv4fd = -1;
@@ -865,7 +1635,7 @@ trigger_server_shutdown(struct timeval *tv, int *ipv4fd, int *ipv6fd,
         close(*unixfd);
         *unixfd = -1;
     }
-    if (client_count) {
+    if (get_client_count()) {
         log_msg("Server sockets closed, will wait 5 seconds "
                 "for clients to shut down.");
         /* because termination_flag is now set, the epoll_wait timeout * will
@@ -876,6 +1646,213 @@ trigger_server_shutdown(struct timeval *tv, int *ipv4fd, int *ipv6fd,
 }
 
 
+/*
+ * Handle an event on one of a shard's file descriptors (other than the
+ * listening sockets, which only the main event loop has).
+ */
+static void
+handle_shard_event(struct relay_shard *shard, struct epoll_event *event)
+{
+    int fd = event->data.fd;
+    struct client_data *client = shard->fd_to_client[fd];
+
+    /* was this fd closed while handling a prior event? */
+    if (!client)
+        return;
+
+    switch (client->state) {
+    case NEW_CONNECTION:
+        if (event->events & EPOLLERR ||        /* error */
+            event->events & EPOLLHUP ||        /* connection closed */
+            event->events & EPOLLRDHUP)        /* connection closed */
+            close(fd);
+        else if (event->events & EPOLLIN)
+            handle_new_connection(fd);
+        break;
+
+    case CLIENT_DISCONNECTED:
+        /* When the client is disconnected, activity usually only happens on
+           the pipes: either the game process is closing them because the idle
+           timeout expired or shutdown was requested via a signal. */
+        if (event->events & EPOLLERR ||        /* error */
+            event->events & EPOLLHUP ||        /* connection closed */
+            event->events & EPOLLRDHUP)        /* connection closed */
+            cleanup_game_process(client);
+        else if (event->events & EPOLLIN) {
+            /* Perhaps the game process was just writing data to the pipe when
+               the client disconnected. There is nothing we can do with this
+               data here, but we don't want to kill the game either, so just
+               read and discard the data. */
+            char buf[2048];
+            int ret;
+
+            do {
+                ret = read(fd, buf, 2048);
+            } while (ret == 2048);
+        }
+        break;
+
+    case CLIENT_CONNECTED:
+        handle_communication(shard, fd, event->events);
+        break;
+    }
+}
+
+
+/*
+ * The event loop of a relay thread. It runs until the main thread sets
+ * shard->stop and pokes shard->wakefd.
+ */
+static void *
+relay_thread_main(void *arg)
+{
+    struct relay_shard *shard = arg;
+    struct epoll_event events[MAX_EVENTS];
+    int i, nfds, timeout, stop = FALSE;
+
+    while (!stop) {
+        pthread_mutex_lock(&shard->lock);
+        timeout = shard_timeout(shard);
+        pthread_mutex_unlock(&shard->lock);
+
+        nfds = epoll_wait(shard->epfd, events, MAX_EVENTS, timeout);
+        if (nfds == -1) {
+            if (errno == EINTR)
+                continue;
+            log_msg("Error from epoll_wait in relay thread: %s",
+                    strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&shard->lock);
+        for (i = 0; i < nfds; i++)
+            if (events[i].data.fd != shard->wakefd)
+                handle_shard_event(shard, &events[i]);
+        run_shard_timers(shard);
+        stop = shard->stop;
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return NULL;
+}
+
+
+static int
+start_relay_threads(void)
+{
+    struct epoll_event ev;
+    sigset_t allsigs, oldsigs;
+    int i;
+
+    shards = calloc(settings.relay_threads, sizeof (struct relay_shard));
+
+    /* Signals should go to the main thread, so that they interrupt its
+       epoll_wait. The new threads inherit this mask. */
+    sigfillset(&allsigs);
+    pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+
+    for (shard_count = 0; shard_count < settings.relay_threads;
+         shard_count++) {
+        struct relay_shard *shard = &shards[shard_count];
+
+        if (!init_shard(shard))
+            break;
+
+        shard->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        memset(&ev, 0, sizeof ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = shard->wakefd;
+        if (shard->wakefd == -1 ||
+            epoll_ctl(shard->epfd, EPOLL_CTL_ADD, shard->wakefd, &ev) == -1 ||
+            pthread_create(&shard->thread, NULL, relay_thread_main, shard)) {
+            log_msg("Failed to start relay thread %d", shard_count);
+            free_shard(shard);
+            break;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    if (shard_count < settings.relay_threads) {
+        for (i = 0; i < shard_count; i++) {
+            pthread_mutex_lock(&shards[i].lock);
+            shards[i].stop = TRUE;
+            pthread_mutex_unlock(&shards[i].lock);
+            eventfd_write(shards[i].wakefd, 1);
+            pthread_join(shards[i].thread, NULL);
+            free_shard(&shards[i]);
+        }
+        free(shards);
+        return FALSE;
+    }
+
+    log_msg("Started %d relay threads", shard_count);
+    return TRUE;
+}
+
+
+static void
+stop_relay_threads(void)
+{
+    int i;
+
+    for (i = 0; i < shard_count; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        shards[i].stop = TRUE;
+        pthread_mutex_unlock(&shards[i].lock);
+        eventfd_write(shards[i].wakefd, 1);
+    }
+
+    for (i = 0; i < shard_count; i++)
+        pthread_join(shards[i].thread, NULL);
+}
+
+
+/*
+ * Reap every game process that has exited. Several may have done so since the
+ * last wakeup, but they only leave one pending SIGCHLD between them.
+ */
+static void
+reap_children(void)
+{
+    struct signalfd_siginfo si;
+    int childstatus;
+
+    if (sigchld_fd != -1)
+        while (read(sigchld_fd, &si, sizeof si) == sizeof si)
+            ;
+
+    while (waitpid(-1, &childstatus, WNOHANG) > 0)
+        ;
+}
+
+
+static void
+setup_sigchld_fd(void)
+{
+    struct epoll_event ev;
+
+    sigemptyset(&sigchld_set);
+    sigaddset(&sigchld_set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld_set, NULL);
+
+    sigchld_fd = signalfd(-1, &sigchld_set, SFD_NONBLOCK | SFD_CLOEXEC);
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = sigchld_fd;
+    if (sigchld_fd == -1 ||
+        epoll_ctl(main_shard.epfd, EPOLL_CTL_ADD, sigchld_fd, &ev) == -1) {
+        /* exited games are then only reaped when something else happens */
+        log_msg("Failed to set up a signalfd for SIGCHLD: %s",
+                strerror(errno));
+        if (sigchld_fd != -1)
+            close(sigchld_fd);
+        sigchld_fd = -1;
+        sigprocmask(SIG_UNBLOCK, &sigchld_set, NULL);
+    }
+}
+
+
 /*
  * The server's core. Creates the configured listening sockets and then
  * enters the server event loop from which all clients are served.
@@ -883,22 +1860,23 @@ trigger_server_shutdown(struct timeval *tv, int *ipv4fd, int *ipv6fd,
 int
 runserver(void)
 {
-    int i, ipv4fd, ipv6fd, unixfd, epfd, nfds, timeout, fd, childstatus;
+    int i, ipv4fd, ipv6fd, unixfd, nfds, timeout, fd;
     struct epoll_event events[MAX_EVENTS];
-    struct client_data *client;
     struct timeval sigtime, curtime, tmp;
+    time_t last_event = monotonic_seconds();
 
-    fd_to_client_max = 64;      /* will be doubled every time it becomes too
-                                   small */
-    fd_to_client = calloc(fd_to_client_max, sizeof (struct client_data *));
+    if (!init_shard(&main_shard))
+        return FALSE;
 
-    epfd = epoll_create1(EPOLL_CLOEXEC);
-    if (epfd == -1) {
-        log_msg("Error in epoll_create1");
+    if (!setup_server_sockets(&ipv4fd, &ipv6fd, &unixfd, main_shard.epfd))
         return FALSE;
-    }
 
-    if (!setup_server_sockets(&ipv4fd, &ipv6fd, &unixfd, epfd))
+    setup_sigchld_fd();
+
+    if (!settings.relay_threads) {
+        shards = &main_shard;
+        shard_count = 1;
+    } else if (!start_relay_threads())
         return FALSE;
 
     /*
@@ -913,14 +1891,20 @@ runserver(void)
             /* calculate the elapsed time since the quit request */
             timersub(&curtime, &sigtime, &tmp);
             timeout = 5000 - (1000 * tmp.tv_sec) - (tmp.tv_usec / 1000);
-            if (timeout < 0)
-                timeout = 0;
+            if (timeout <= 0 || get_client_count() == 0)
+                goto finally;
+            /* games ending in a relay thread don't wake this loop up */
+            if (settings.relay_threads && timeout > 100)
+                timeout = 100;
         }
+        if (shard_timeout(&main_shard) != -1 &&
+            timeout > shard_timeout(&main_shard))
+            timeout = shard_timeout(&main_shard);
 
         /* make sure child processes are cleaned up */
-        waitpid(-1, &childstatus, WNOHANG);
+        reap_children();
 
-        nfds = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        nfds = epoll_wait(main_shard.epfd, events, MAX_EVENTS, timeout);
         if (nfds == -1) {
             if (errno != EINTR) {       /* serious problem */
                 log_msg("Error from epoll_wait in main event loop: %s",
@@ -938,84 +1922,68 @@ runserver(void)
             else
                 goto finally;
         } else if (nfds == 0) { /* timeout */
-            if (!termination_flag)
+            run_shard_timers(&main_shard);
+            if (!termination_flag &&
+                monotonic_seconds() - last_event >= 10 * 60) {
                 log_msg(" -- mark (no activity for 10 minutes) --");
-            else        /* shutdown timer has run out */
-                goto finally;
+                last_event = monotonic_seconds();
+            }
+            /* the shutdown timer is checked at the top of the loop */
             continue;
         }
+        last_event = monotonic_seconds();
 
         for (i = 0; i < nfds; i++) {
             fd = events[i].data.fd;
 
             if (fd == ipv4fd || fd == ipv6fd || fd == unixfd) {
                 /* server socket ready for accept */
-                server_socket_event(fd, epfd);
+                server_socket_event(fd);
                 continue;
             }
 
-            /* activity on a client socket or pipe */
-            client = fd_to_client[fd];
-            /* was this fd closed while handling a prior event? */
-            if (!client)
+            if (fd == sigchld_fd) {
+                reap_children();
                 continue;
+            }
 
-            switch (client->state) {
-            case NEW_CONNECTION:
-                if (events[i].events & EPOLLERR ||      /* error */
-                    events[i].events & EPOLLHUP ||      /* connection closed */
-                    events[i].events & EPOLLRDHUP)      /* connection closed */
-                    close(fd);
-                else if (events[i].events & EPOLLIN)
-                    handle_new_connection(fd, epfd);
-                break;
-
-            case CLIENT_DISCONNECTED:
-                /* When the client is disconnected, activity usually only
-                   happens on the pipes: either the game process is closing
-                   them because the idle timeout expired or shutdown was
-                   requested via a signal. */
-                if (events[i].events & EPOLLERR ||      /* error */
-                    events[i].events & EPOLLHUP ||      /* connection closed */
-                    events[i].events & EPOLLRDHUP)      /* connection closed */
-                    cleanup_game_process(client, epfd);
-                else if (events[i].events & EPOLLIN) {
-                    /* Perhaps the game process was just writing data to the
-                       pipe when the client disconnected. There is nothing we
-                       can do with this data here, but we don't want to kill
-                       the game either, so just read and discard the data. */
-                    char buf[2048];
-                    int ret;
-
-                    do {
-                        ret = read(fd, buf, 2048);
-                    } while (ret == 2048);
-                }
-                break;
+            /* activity on a client socket or pipe */
+            handle_shard_event(&main_shard, &events[i]);
 
-            case CLIENT_CONNECTED:
-                handle_communication(fd, epfd, events[i].events);
-                break;
-            }
-            if (termination_flag && client_count == 0)
+            if (termination_flag && get_client_count() == 0)
                 goto finally;
         }       /* for */
+
+        run_shard_timers(&main_shard);
     }   /* while(1) */
 
 finally:
-    while (disconnected_list_head.next)
-        cleanup_game_process(disconnected_list_head.next, epfd);
-    while (connected_list_head.next)
-        cleanup_game_process(connected_list_head.next, epfd);
+    if (settings.relay_threads)
+        stop_relay_threads();
+
+    for (i = 0; i < shard_count; i++) {
+        while (shards[i].disconnected_list_head.next)
+            cleanup_game_process(shards[i].disconnected_list_head.next);
+        while (shards[i].connected_list_head.next)
+            cleanup_game_process(shards[i].connected_list_head.next);
+        if (&shards[i] != &main_shard)
+            free_shard(&shards[i]);
+    }
+    if (shards != &main_shard)
+        free(shards);
 
-    close(epfd);
     if (ipv4fd != -1)
         close(ipv4fd);
     if (ipv6fd != -1)
         close(ipv6fd);
     if (unixfd != -1)
         close(unixfd);
-    free(fd_to_client);
+    if (sigchld_fd != -1) {
+        close(sigchld_fd);
+        sigchld_fd = -1;
+        sigprocmask(SIG_UNBLOCK, &sigchld_set, NULL);
+    }
+    free_shard(&main_shard);
 
     return TRUE;
 }
@@ -8,6 +8,7 @@
 
 #include "nhserver.h"
 #include "menulist.h"
+#include "player_info.h"
 
 static void srv_raw_print(const char *str);
 static void srv_pause(enum nh_pause_reason r);
@@ -45,10 +46,45 @@ static void srv_getline(const char *query, void *callbackarg,
 
 struct nh_player_info player_info;
 static struct nh_dbuf_entry prev_dbuf[ROWNO][COLNO];
-static int prev_invent_icount, prev_floor_icount;
-static struct nh_objitem *prev_invent;
+
+/* The floor and inventory lists, as last sent to the client and as last given
+   to list_items. Lists are only sent at the end of a frame, and then as a diff
+   against the list the client already has where that is shorter. */
+struct item_list {
+    struct nh_objitem *sent, *latest;
+    int sent_icount, latest_icount;
+    int sent_size, latest_size;         /* allocated lengths */
+    int *matches;                       /* latest item -> sent item, or -1 */
+    nh_bool have_sent, pending;
+};
+static struct item_list item_lists[2];  /* indexed by invent */
 static const struct nh_dbuf_entry zero_dbuf;    /* an entry of all zeroes */
-static json_t *display_data, *jinvent_items, *jfloor_items;
+
+/* The frequent and bulky display data (map, status, item lists, menus) is
+   written directly as JSON text with a json_writer_t, rather than built as a
+   tree of json_t first. The text is exactly what json_dumps would make of the
+   tree. The writers are reused, so once they have grown to size, sending this
+   data doesn't allocate anything. */
+static json_writer_t *display_writer;   /* the display list: a JSON array */
+static int display_items;               /* entries in display_writer */
+static json_writer_t *payload_writer;   /* menus and object lists */
+
+/* Display data is sent in frames: a frame ends at anything the client might
+   stop and show to the user (a delay, a message, a menu, ...). Within a frame,
+   only the final state of the map, status and item lists matters, so they are
+   held back until the frame ends; they still reach the client in the same
+   order relative to messages and other events as the calls that made them.
+   The status is then sent as the difference to what it was at the start of
+   the frame. */
+static struct nh_dbuf_entry pending_dbuf[ROWNO][COLNO];
+static int pending_ux, pending_uy, screen_pending;
+static struct nh_player_info frame_player_info;
+static int status_pending;
+
+static void flush_pending_screen(void);
+static void flush_pending_status(void);
+static void flush_item_list(struct item_list *list, nh_bool invent);
+static void flush_list_items(void);
 
 struct nh_window_procs server_windowprocs = {
     srv_pause,
@@ -74,18 +110,23 @@ struct nh_window_procs server_windowprocs = {
 
 /*---------------------------------------------------------------------------*/
 
+/* Responses are parsed into an arena that is reused for every response: the
+   callers below are done with a response before they make the next request. */
+static json_arena_t *response_arena;
+
+/* Read the client's response to a request. */
 static json_t *
-client_request(const char *funcname, json_t * request_msg)
+client_response(const char *funcname)
 {
     json_t *jret, *jobj;
     void *iter;
     const char *key;
     int i;
 
-    client_msg(funcname, request_msg);
+    if (!response_arena && !(response_arena = json_arena_new()))
+        exit_client("Out of memory");
 
-    /* client response */
-    jret = read_input();
+    jret = read_input(response_arena);
     if (!jret)
         exit_client("Incorrect or damaged response");
 
@@ -113,7 +154,7 @@ client_request(const char *funcname, json_t * request_msg)
             break;
         }
         json_decref(jret);
-        jret = read_input();
+        jret = read_input(response_arena);
         jobj = json_object_get(jret, funcname);
     }
 
@@ -125,36 +166,115 @@ client_request(const char *funcname, json_t * request_msg)
 }
 
 
+
+static json_t *
+client_request(const char *funcname, json_t * request_msg)
+{
+    client_msg(funcname, request_msg);
+    return client_response(funcname);
+}
+
+
+static json_t *
+client_request_raw(const char *funcname, const json_writer_t *request_msg)
+{
+    client_msg_raw(funcname, request_msg);
+    return client_response(funcname);
+}
+
+
+/* Get an empty writer, reusing *writer if it exists. */
+static json_writer_t *
+start_writer(json_writer_t **writer)
+{
+    if (!*writer)
+        *writer = json_writer_new(0);
+    else
+        json_writer_clear(*writer);
+
+    return *writer;
+}
+
+
+static void
+end_display_frame(void)
+{
+    flush_pending_status();
+    flush_pending_screen();
+    flush_list_items();
+}
+
+
+/* Start an entry of the display list; the caller writes the value for key,
+   then calls end_display_item. */
+static json_writer_t *
+begin_display_item(const char *key)
+{
+    if (strcmp(key, "update_screen") && strcmp(key, "update_status") &&
+        strcmp(key, "list_items"))
+        end_display_frame();
+
+    if (!display_items++) {
+        start_writer(&display_writer);
+        json_writer_array_begin(display_writer);
+    }
+
+    json_writer_object_begin(display_writer);
+    json_writer_key(display_writer, key);
+    return display_writer;
+}
+
+
+static void
+end_display_item(void)
+{
+    json_writer_object_end(display_writer);
+}
+
+
 static void
 add_display_data(const char *key, json_t * data)
 {
-    json_t *tmpobj;
+    json_writer_value(begin_display_item(key), data);
+    json_decref(data);
+    end_display_item();
+}
 
-    if (!display_data)
-        display_data = json_array();
 
-    tmpobj = json_object();
-    json_object_set_new(tmpobj, key, data);
-    json_array_append_new(display_data, tmpobj);
+static void
+add_display_raw(const char *key, const json_writer_t *data)
+{
+    json_writer_raw(begin_display_item(key), json_writer_text(data),
+                    json_writer_length(data));
+    end_display_item();
 }
 
 
-json_t *
-get_display_data(void)
+/* Send the item lists that changed during the frame, floor first. */
+static void
+flush_list_items(void)
 {
-    json_t *dd;
+    int invent;
 
-    if (jfloor_items) {
-        add_display_data("list_items", jfloor_items);
-        jfloor_items = NULL;
-    }
-    if (jinvent_items) {
-        add_display_data("list_items", jinvent_items);
-        jinvent_items = NULL;
-    }
-    dd = display_data;
-    display_data = NULL;
-    return dd;
+    for (invent = 0; invent <= 1; invent++)
+        flush_item_list(&item_lists[invent], invent);
+}
+
+
+/* Returns the display list as JSON text, or NULL if it is empty. The text is
+   valid until the next display data is added. */
+const char *
+get_display_data(size_t *len)
+{
+    end_display_frame();
+
+    if (!display_items)
+        return NULL;
+
+    json_writer_array_end(display_writer);
+    display_items = 0;
+    *len = json_writer_length(display_writer);
+    return json_writer_text(display_writer);
 }
 
 
@@ -176,9 +296,8 @@ srv_pause(enum nh_pause_reason r)
     json_t *jobj = json_integer(r);
 
     /* since the display may stop here, the sidebar info should be up-to-date
-       sidebar data is added to the output as a side-effect of
-       get_display_data() */
-    display_data = get_display_data();
+       */
+    end_display_frame();
     add_display_data("pause", jobj);
 }
 
@@ -195,84 +314,87 @@ srv_display_buffer(const char *buf, nh_bool trymove)
 static void
 srv_update_status(struct nh_player_info *pi)
 {
-    json_t *jobj, *jarr;
-    struct nh_player_info *oi = &player_info;
+    if (!memcmp(&player_info, pi, sizeof (struct nh_player_info)))
+        return;
+
+    if (!status_pending) {
+        frame_player_info = player_info;
+        status_pending = TRUE;
+    }
+    player_info = *pi;
+}
+
+
+static void
+write_string_member(json_writer_t *w, const char *key, const char *value)
+{
+    json_writer_key(w, key);
+    json_writer_string(w, value);
+}
+
+static void
+write_int_member(json_writer_t *w, const char *key, int value)
+{
+    json_writer_key(w, key);
+    json_writer_integer(w, value);
+}
+
+
+/* Send the status fields that changed during the current frame. */
+static void
+flush_pending_status(void)
+{
+    json_writer_t *w;
+    const struct player_info_field *f;
+    const struct nh_player_info *pi = &player_info, *oi = &frame_player_info;
+    const char *new, *old;
     int i, all;
 
-    if (!memcmp(&player_info, pi, sizeof (struct nh_player_info)))
+    if (!status_pending)
+        return;
+    status_pending = FALSE;
+
+    if (!memcmp(pi, oi, sizeof (struct nh_player_info)))
         return;
 
-    all = !player_info.plname[0];
+    all = !oi->plname[0];
 
     /* only send fields that have changed since the last transmission */
-    jobj = json_object();
-    if (all) {
-        json_object_set_new(jobj, "plname", json_string(pi->plname));
-        json_object_set_new(jobj, "coinsym", json_integer(pi->coinsym));
-        json_object_set_new(jobj, "max_rank_sz", json_integer(pi->max_rank_sz));
-    }
-    if (all || strcmp(pi->rank, oi->rank))
-        json_object_set_new(jobj, "rank", json_string(pi->rank));
-    if (all || strcmp(pi->level_desc, oi->level_desc))
-        json_object_set_new(jobj, "level_desc", json_string(pi->level_desc));
-    if (all || pi->x != oi->x)
-        json_object_set_new(jobj, "x", json_integer(pi->x));
-    if (all || pi->y != oi->y)
-        json_object_set_new(jobj, "y", json_integer(pi->y));
-    if (all || pi->z != oi->z)
-        json_object_set_new(jobj, "z", json_integer(pi->z));
-    if (all || pi->score != oi->score)
-        json_object_set_new(jobj, "score", json_integer(pi->score));
-    if (all || pi->xp != oi->xp)
-        json_object_set_new(jobj, "xp", json_integer(pi->xp));
-    if (all || pi->gold != oi->gold)
-        json_object_set_new(jobj, "gold", json_integer(pi->gold));
-    if (all || pi->moves != oi->moves)
-        json_object_set_new(jobj, "moves", json_integer(pi->moves));
-    if (all || pi->st != oi->st)
-        json_object_set_new(jobj, "st", json_integer(pi->st));
-    if (all || pi->st_extra != oi->st_extra)
-        json_object_set_new(jobj, "st_extra", json_integer(pi->st_extra));
-    if (all || pi->dx != oi->dx)
-        json_object_set_new(jobj, "dx", json_integer(pi->dx));
-    if (all || pi->co != oi->co)
-        json_object_set_new(jobj, "co", json_integer(pi->co));
-    if (all || pi->in != oi->in)
-        json_object_set_new(jobj, "in", json_integer(pi->in));
-    if (all || pi->wi != oi->wi)
-        json_object_set_new(jobj, "wi", json_integer(pi->wi));
-    if (all || pi->ch != oi->ch)
-        json_object_set_new(jobj, "ch", json_integer(pi->ch));
-    if (all || pi->align != oi->align)
-        json_object_set_new(jobj, "align", json_integer(pi->align));
-    if (all || pi->hp != oi->hp)
-        json_object_set_new(jobj, "hp", json_integer(pi->hp));
-    if (all || pi->hpmax != oi->hpmax)
-        json_object_set_new(jobj, "hpmax", json_integer(pi->hpmax));
-    if (all || pi->en != oi->en)
-        json_object_set_new(jobj, "en", json_integer(pi->en));
-    if (all || pi->enmax != oi->enmax)
-        json_object_set_new(jobj, "enmax", json_integer(pi->enmax));
-    if (all || pi->ac != oi->ac)
-        json_object_set_new(jobj, "ac", json_integer(pi->ac));
-    if (all || pi->level != oi->level)
-        json_object_set_new(jobj, "level", json_integer(pi->level));
-    if (all || pi->monnum != oi->monnum)
-        json_object_set_new(jobj, "monnum", json_integer(pi->monnum));
-    if (all || pi->cur_monnum != oi->cur_monnum)
-        json_object_set_new(jobj, "cur_monnum", json_integer(pi->cur_monnum));
-    if (all || pi->can_enhance != oi->can_enhance)
-        json_object_set_new(jobj, "can_enhance", json_integer(pi->can_enhance));
-    if (all ||
-        memcmp(pi->statusitems, oi->statusitems, sizeof (pi->statusitems))) {
-        jarr = json_array();
-        for (i = 0; i < pi->nr_items; i++)
-            json_array_append_new(jarr, json_string(pi->statusitems[i]));
-        json_object_set_new(jobj, "statusitems", jarr);
+    w = begin_display_item("update_status");
+    json_writer_object_begin(w);
+    for (f = player_info_fields; f->name; f++) {
+        new = (const char *)pi + f->offset;
+        old = (const char *)oi + f->offset;
+
+        if (!all && (f->flags & PIF_INITIAL_ONLY ||
+                     (f->type == PIF_STRING ? !strcmp(new, old) :
+                      !memcmp(new, old, f->size))))
+            continue;
+
+        json_writer_key(w, f->name);
+        switch (f->type) {
+        case PIF_STRING:
+            json_writer_string(w, new);
+            break;
+        case PIF_INT:
+            json_writer_integer(w, *(const int *)new);
+            break;
+        case PIF_CHAR:
+            json_writer_integer(w, *(const char *)new);
+            break;
+        case PIF_BOOL:
+            json_writer_integer(w, *(const nh_bool *)new);
+            break;
+        case PIF_STATUSITEMS:
+            json_writer_array_begin(w);
+            for (i = 0; i < pi->nr_items; i++)
+                json_writer_string(w, pi->statusitems[i]);
+            json_writer_array_end(w);
+            break;
+        }
     }
-    player_info = *pi;
-
-    add_display_data("update_status", jobj);
+    json_writer_object_end(w);
+    end_display_item();
 }
 
 
@@ -295,73 +417,100 @@ srv_print_message_nonblocking(int turn, const char *msg)
 static void
 srv_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
 {
-    int i, x, y, samedbe, samecols, zerodbe, zerocols, is_same, is_zero;
-    json_t *jmsg, *jdbuf, *dbufcol, *dbufent;
+    memcpy(pending_dbuf, dbuf, sizeof (pending_dbuf));
+    pending_ux = ux;
+    pending_uy = uy;
+    screen_pending = TRUE;
+}
+
+/* Send the map as of the end of the current frame. */
+static void
+flush_pending_screen(void)
+{
+    int i, x, y, samecols, zerocols;
+    int zerodbe[COLNO], samedbe[COLNO];
+    char is_zero[ROWNO][COLNO], is_same[ROWNO][COLNO];
+    struct nh_dbuf_entry (*dbuf)[COLNO] = pending_dbuf;
+    struct nh_dbuf_entry *dbe;
+    json_writer_t *w;
+
+    if (!screen_pending)
+        return;
+    screen_pending = FALSE;
 
+    /* Find out what changed first: whether a column is sent at all depends on
+       all of its entries. An entry may be both the same as before and zero.
+       Check for both so that both conditions can be counted. */
     samecols = 0;
     zerocols = 0;
-    jdbuf = json_array();
     for (x = 0; x < COLNO; x++) {
-        samedbe = 0;
-        zerodbe = 0;
-        dbufcol = json_array();
+        samedbe[x] = 0;
+        zerodbe[x] = 0;
         for (y = 0; y < ROWNO; y++) {
-            /* an entry may be both the same as before and zero. Check for both
-               so that both conditions can be counted */
-            is_zero = is_same = FALSE;
-            if (!memcmp(&dbuf[y][x], &zero_dbuf, sizeof (dbuf[y][x]))) {
-                zerodbe++;
-                is_zero = TRUE;
-                json_array_append_new(dbufcol, json_integer(0));
-            }
-            if (!memcmp(&dbuf[y][x], &prev_dbuf[y][x], sizeof (dbuf[y][x]))) {
-                samedbe++;
-                is_same = TRUE;
-                if (!is_zero)
-                    json_array_append_new(dbufcol, json_integer(1));
-            }
-            if (!is_same && !is_zero) {
-                /* It pains me to make this an array rather than a struct, but
-                   it does cause much less data to be sent. */
-                dbufent =
-                    json_pack("[i,i,i,i,i,i,i,i,i,i]", dbuf[y][x].effect,
-                              dbuf[y][x].bg, dbuf[y][x].trap, dbuf[y][x].obj,
-                              dbuf[y][x].obj_mn, dbuf[y][x].mon,
-                              dbuf[y][x].monflags, dbuf[y][x].branding,
-                              dbuf[y][x].invis, dbuf[y][x].visible);
-                json_array_append_new(dbufcol, dbufent);
-            }
+            is_zero[y][x] = !memcmp(&dbuf[y][x], &zero_dbuf,
+                                    sizeof (dbuf[y][x]));
+            is_same[y][x] = !memcmp(&dbuf[y][x], &prev_dbuf[y][x],
+                                    sizeof (dbuf[y][x]));
+            zerodbe[x] += is_zero[y][x];
+            samedbe[x] += is_same[y][x];
         }
-
-        is_zero = is_same = FALSE;
-        if (zerodbe == ROWNO) { /* entire column is zero */
+        if (zerodbe[x] == ROWNO)        /* entire column is zero */
             zerocols++;
-            is_zero = TRUE;
-            json_array_append_new(jdbuf, json_integer(0));
-        }
-        if (samedbe == ROWNO) { /* entire column is unchanged */
+        if (samedbe[x] == ROWNO)        /* entire column is unchanged */
             samecols++;
-            is_same = TRUE;
-            if (!is_zero)
-                json_array_append_new(jdbuf, json_integer(1));
-        }
-        if (!is_same && !is_zero)
-            json_array_append(jdbuf, dbufcol);
-        json_decref(dbufcol);
     }
 
-    if (samecols == COLNO) {
-        json_decref(jdbuf);
+    if (samecols == COLNO)
         return; /* no point in sending out a message that nothing changed */
-    } else if (zerocols == COLNO) {
-        json_decref(jdbuf);
-        jmsg =
-            json_pack("{si,si,so}", "ux", ux, "uy", uy, "dbuf",
-                      json_integer(0));
-    } else
-        jmsg = json_pack("{si,si,so}", "ux", ux, "uy", uy, "dbuf", jdbuf);
 
-    add_display_data("update_screen", jmsg);
+    w = begin_display_item("update_screen");
+    json_writer_object_begin(w);
+    write_int_member(w, "ux", pending_ux);
+    write_int_member(w, "uy", pending_uy);
+    json_writer_key(w, "dbuf");
+    if (zerocols == COLNO)
+        json_writer_integer(w, 0);
+    else {
+        json_writer_array_begin(w);
+        for (x = 0; x < COLNO; x++) {
+            if (zerodbe[x] == ROWNO) {
+                json_writer_integer(w, 0);
+                continue;
+            } else if (samedbe[x] == ROWNO) {
+                json_writer_integer(w, 1);
+                continue;
+            }
+
+            json_writer_array_begin(w);
+            for (y = 0; y < ROWNO; y++) {
+                if (is_zero[y][x])
+                    json_writer_integer(w, 0);
+                else if (is_same[y][x])
+                    json_writer_integer(w, 1);
+                else {
+                    /* It pains me to make this an array rather than a
+                       struct, but it does cause much less data to be sent. */
+                    dbe = &dbuf[y][x];
+                    json_writer_array_begin(w);
+                    json_writer_integer(w, dbe->effect);
+                    json_writer_integer(w, dbe->bg);
+                    json_writer_integer(w, dbe->trap);
+                    json_writer_integer(w, dbe->obj);
+                    json_writer_integer(w, dbe->obj_mn);
+                    json_writer_integer(w, dbe->mon);
+                    json_writer_integer(w, dbe->monflags);
+                    json_writer_integer(w, dbe->branding);
+                    json_writer_integer(w, dbe->invis);
+                    json_writer_integer(w, dbe->visible);
+                    json_writer_array_end(w);
+                }
+            }
+            json_writer_array_end(w);
+        }
+        json_writer_array_end(w);
+    }
+    json_writer_object_end(w);
+    end_display_item();
 
     for (i = 0; i < ROWNO; i++)
         memcpy(&prev_dbuf[i], &dbuf[i], sizeof (dbuf[i]));
@@ -382,36 +531,53 @@ srv_level_changed(int displaymode)
 }
 
 
-static json_t *
-json_menuitem(struct nh_menuitem *mi)
+static void
+write_menuitem(json_writer_t *w, struct nh_menuitem *mi)
 {
-    json_t *jobj = json_pack("{ss,si,si,si,si,si}", "caption", mi->caption,
-                             "id", mi->id, "role", mi->role, "accel", mi->accel,
-                             "group_accel", mi->group_accel, "selected",
-                             mi->selected);
-
-    return jobj;
+    json_writer_object_begin(w);
+    write_string_member(w, "caption", mi->caption);
+    write_int_member(w, "id", mi->id);
+    write_int_member(w, "role", mi->role);
+    write_int_member(w, "accel", mi->accel);
+    write_int_member(w, "group_accel", mi->group_accel);
+    write_int_member(w, "selected", mi->selected);
+    json_writer_object_end(w);
 }
 
 
 static void
-srv_outrip(struct nh_menulist *ml, nh_bool tombstone, const char *name,
-           int gold, const char *killbuf, int end_how, int year)
+write_menuitems(json_writer_t *w, struct nh_menulist *ml)
 {
     int i;
-    json_t *jobj, *jarr;
 
-    jarr = json_array();
+    json_writer_key(w, "items");
+    json_writer_array_begin(w);
     for (i = 0; i < ml->icount; i++)
-        json_array_append_new(jarr, json_menuitem(ml->items + i));
-    jobj = json_pack("{so,si,si,si,si,si,ss,ss}", "items", jarr,
-                     "icount", ml->icount, "tombstone", tombstone, "gold", gold,
-                     "year", year, "how", end_how, "name", name,
-                     "killbuf", killbuf);
+        write_menuitem(w, ml->items + i);
+    json_writer_array_end(w);
+    write_int_member(w, "icount", ml->icount);
+}
+
+
+static void
+srv_outrip(struct nh_menulist *ml, nh_bool tombstone, const char *name,
+           int gold, const char *killbuf, int end_how, int year)
+{
+    json_writer_t *w = start_writer(&payload_writer);
+
+    json_writer_object_begin(w);
+    write_menuitems(w, ml);
+    write_int_member(w, "tombstone", tombstone);
+    write_int_member(w, "gold", gold);
+    write_int_member(w, "year", year);
+    write_int_member(w, "how", end_how);
+    write_string_member(w, "name", name);
+    write_string_member(w, "killbuf", killbuf);
+    json_writer_object_end(w);
 
     dealloc_menulist(ml);
 
-    add_display_data("outrip", jobj);
+    add_display_raw("outrip", w);
 }
 
 
@@ -470,24 +636,24 @@ srv_display_menu(struct nh_menulist *ml, const char *title, int how,
 {
     int i, ret;
     json_t *jobj, *jarr;
+    json_writer_t *w = start_writer(&payload_writer);
 
-    jarr = json_array();
-    for (i = 0; i < ml->icount; i++)
-        json_array_append_new(jarr, json_menuitem(ml->items + i));
-    jobj =
-        json_pack("{so,si,si,ss,si}", "items", jarr, "icount", ml->icount,
-                  "how", how, "title", title ? title : "",
-                  "plhint", placement_hint);
+    json_writer_object_begin(w);
+    write_menuitems(w, ml);
+    write_int_member(w, "how", how);
+    write_string_member(w, "title", title ? title : "");
+    write_int_member(w, "plhint", placement_hint);
+    json_writer_object_end(w);
 
     dealloc_menulist(ml);
 
     if (how == PICK_NONE) {
-        add_display_data("display_menu", jobj);
+        add_display_raw("display_menu", w);
         callback(NULL, 0, callbackarg);
         return;
     }
 
-    jobj = client_request("display_menu", jobj);
+    jobj = client_request_raw("display_menu", w);
     if (json_unpack(jobj, "{si,so!}", "howclosed", &ret, "results", &jarr) == -1
         || !json_is_array(jarr))
         exit_client("Bad parameter for display_menu");
@@ -504,18 +670,38 @@ srv_display_menu(struct nh_menulist *ml, const char *title, int how,
 }
 
 
-static json_t *
-json_objitem(struct nh_objitem *oi)
+static void
+write_objitem(json_writer_t *w, struct nh_objitem *oi)
 {
-    json_t *jobj;
-
     /* This array should have been an object, but transmission size prevents
        that. */
-    jobj =
-        json_pack("[s,i,i,i,i,i,i,i,i,i,i]", oi->caption, oi->id, oi->role,
-                  oi->count, oi->otype, oi->oclass, oi->weight, oi->buc,
-                  oi->accel, oi->group_accel, oi->worn);
-    return jobj;
+    json_writer_array_begin(w);
+    json_writer_string(w, oi->caption);
+    json_writer_integer(w, oi->id);
+    json_writer_integer(w, oi->role);
+    json_writer_integer(w, oi->count);
+    json_writer_integer(w, oi->otype);
+    json_writer_integer(w, oi->oclass);
+    json_writer_integer(w, oi->weight);
+    json_writer_integer(w, oi->buc);
+    json_writer_integer(w, oi->accel);
+    json_writer_integer(w, oi->group_accel);
+    json_writer_integer(w, oi->worn);
+    json_writer_array_end(w);
+}
+
+
+static void
+write_objitems(json_writer_t *w, struct nh_objlist *objlist)
+{
+    int i;
+
+    json_writer_key(w, "items");
+    json_writer_array_begin(w);
+    for (i = 0; i < objlist->icount; i++)
+        write_objitem(w, objlist->items + i);
+    json_writer_array_end(w);
+    write_int_member(w, "icount", objlist->icount);
 }
 
 
@@ -526,24 +712,24 @@ srv_display_objects(struct nh_objlist *objlist, const char *title,
 {
     int i, ret;
     json_t *jobj, *jarr, *jobj2;
+    json_writer_t *w = start_writer(&payload_writer);
 
-    jarr = json_array();
-    for (i = 0; i < objlist->icount; i++)
-        json_array_append_new(jarr, json_objitem(objlist->items + i));
-    jobj =
-        json_pack("{so,si,si,ss,si}", "items", jarr, "icount",
-                  objlist->icount, "how", how, "title", title ? title : "",
-                  "plhint", placement_hint);
+    json_writer_object_begin(w);
+    write_objitems(w, objlist);
+    write_int_member(w, "how", how);
+    write_string_member(w, "title", title ? title : "");
+    write_int_member(w, "plhint", placement_hint);
+    json_writer_object_end(w);
 
     dealloc_objmenulist(objlist);
 
     if (how == PICK_NONE) {
-        add_display_data("display_objects", jobj);
+        add_display_raw("display_objects", w);
         callback(NULL, 0, callbackarg);
         return;
     }
 
-    jobj = client_request("display_objects", jobj);
+    jobj = client_request_raw("display_objects", w);
     if (json_unpack(jobj, "{si,so!}", "howclosed", &ret, "pick_list", &jarr)
         == -1 || !json_is_array(jarr))
         exit_client("Bad parameter for display_objects");
@@ -566,53 +752,140 @@ srv_display_objects(struct nh_objlist *objlist, const char *title,
 
 
 static nh_bool
-srv_list_items(struct nh_objlist *objlist, nh_bool invent)
+same_objitem(const struct nh_objitem *a, const struct nh_objitem *b)
+{
+    return a->id == b->id && a->role == b->role && a->count == b->count &&
+        a->otype == b->otype && a->oclass == b->oclass &&
+        a->weight == b->weight && a->buc == b->buc && a->accel == b->accel &&
+        a->group_accel == b->group_accel && a->worn == b->worn &&
+        !strcmp(a->caption, b->caption);
+}
+
+
+static nh_bool
+same_items(const struct nh_objitem *a, int acount,
+           const struct nh_objitem *b, int bcount)
 {
     int i;
-    json_t *jobj, *jarr;
 
-    if (invent && prev_invent && objlist->icount == prev_invent_icount &&
-        !memcmp(objlist->items, prev_invent,
-                sizeof (struct nh_objitem) * objlist->icount)) {
-        dealloc_objmenulist(objlist);
-        return TRUE;
-    }
+    if (acount != bcount)
+        return FALSE;
+    for (i = 0; i < acount; i++)
+        if (!same_objitem(a + i, b + i))
+            return FALSE;
+    return TRUE;
+}
 
-    if (!invent && objlist->icount == 0 && prev_floor_icount == 0) {
-        dealloc_objmenulist(objlist);
-        return TRUE;
+
+/* Find each of the latest items in the sent list. Items are usually in the
+   same order as before, so the search starts after the previous match. Returns
+   the number of items that were found. */
+static int
+match_sent_items(struct item_list *list)
+{
+    int i, j, k, found = 0, next = 0;
+
+    for (i = 0; i < list->latest_icount; i++) {
+        list->matches[i] = -1;
+        for (k = 0; k < list->sent_icount; k++) {
+            j = (next + k) % list->sent_icount;
+            if (same_objitem(list->latest + i, list->sent + j)) {
+                list->matches[i] = j;
+                next = j + 1;
+                found++;
+                break;
+            }
+        }
     }
+    return found;
+}
 
-    if (invent) {
-        prev_invent_icount = objlist->icount;
-        free(prev_invent);
-        prev_invent = malloc(sizeof (struct nh_objitem) * objlist->icount);
-        memcpy(prev_invent, objlist->items,
-               sizeof (struct nh_objitem) * objlist->icount);
-    } else
-        prev_floor_icount = objlist->icount;
 
-    jarr = json_array();
-    for (i = 0; i < objlist->icount; i++)
-        json_array_append_new(jarr, json_objitem(objlist->items + i));
-    jobj =
-        json_pack("{so,si,si}", "items", jarr, "icount",
-                  objlist->icount, "invent", invent);
+static void
+flush_item_list(struct item_list *list, nh_bool invent)
+{
+    json_writer_t *w;
+    struct nh_objitem *items;
+    int i, size;
 
-    dealloc_objmenulist(objlist);
+    if (!list->pending)
+        return;
+    list->pending = FALSE;
+
+    if (list->have_sent && same_items(list->latest, list->latest_icount,
+                                      list->sent, list->sent_icount))
+        return;
+
+    w = begin_display_item("list_items");
+    json_writer_object_begin(w);
+    if (list->have_sent && match_sent_items(list)) {
+        /* Items the client already has are sent as their index in the
+           previous list; only new and changed items are sent in full. */
+        json_writer_key(w, "diff");
+        json_writer_array_begin(w);
+        for (i = 0; i < list->latest_icount; i++) {
+            if (list->matches[i] >= 0)
+                json_writer_integer(w, list->matches[i]);
+            else
+                write_objitem(w, list->latest + i);
+        }
+        json_writer_array_end(w);
+        write_int_member(w, "icount", list->latest_icount);
+    } else {
+        struct nh_objlist objlist = { list->latest, 0, list->latest_icount };
+
+        write_objitems(w, &objlist);
+    }
+    write_int_member(w, "invent", invent);
+    json_writer_object_end(w);
+    end_display_item();
+
+    /* the latest list is now the one the client has */
+    items = list->sent;
+    size = list->sent_size;
+    list->sent = list->latest;
+    list->sent_size = list->latest_size;
+    list->sent_icount = list->latest_icount;
+    list->latest = items;
+    list->latest_size = size;
+    list->have_sent = TRUE;
+}
+
+
+static nh_bool
+srv_list_items(struct nh_objlist *objlist, nh_bool invent)
+{
+    struct item_list *list = &item_lists[invent ? 1 : 0];
+    const struct nh_objitem *known;
+    int known_icount;
+
+    /* compare against what the client will have at the end of the frame */
+    if (list->pending || list->have_sent) {
+        known = list->pending ? list->latest : list->sent;
+        known_icount = list->pending ? list->latest_icount : list->sent_icount;
+        if (same_items(objlist->items, objlist->icount, known, known_icount)) {
+            dealloc_objmenulist(objlist);
+            return TRUE;
+        }
+    }
 
     /* there could be lots of list_item calls after each other if the player is
        picking up or dropping large numbers of items. We only care about the
-       last state. */
-    if (invent) {
-        if (jinvent_items)
-            json_decref(jinvent_items);
-        jinvent_items = jobj;
-    } else {
-        if (jfloor_items)
-            json_decref(jfloor_items);
-        jfloor_items = jobj;
+       last state, so this replaces any list that wasn't sent yet. */
+    if (objlist->icount > list->latest_size) {
+        list->latest_size = objlist->icount;
+        list->latest = realloc(list->latest,
+                               list->latest_size * sizeof (struct nh_objitem));
+        list->matches = realloc(list->matches,
+                                list->latest_size * sizeof (int));
     }
+    if (objlist->icount)
+        memcpy(list->latest, objlist->items,
+               objlist->icount * sizeof (struct nh_objitem));
+    list->latest_icount = objlist->icount;
+    list->pending = TRUE;
+
+    dealloc_objmenulist(objlist);
 
     /* If list_items returns TRUE, the dialog "Things that are here" is not
        shown. The return value doesn't matter at all if the list doesn't
@@ -714,21 +987,34 @@ srv_getline(const char *query, void *callbackarg,
 
 /*---------------------------------------------------------------------------*/
 
+/* Forget which item lists the client has, so that the next ones are sent in
+   full. This is needed when messages to the client may have been lost. */
+void
+reset_item_lists(void)
+{
+    item_lists[0].have_sent = item_lists[1].have_sent = FALSE;
+}
+
+
 void
 reset_cached_diplaydata(void)
 {
-    if (display_data)
-        json_decref(display_data);
-    if (jinvent_items)
-        json_decref(jinvent_items);
-    if (jfloor_items)
-        json_decref(jfloor_items);
-    display_data = jinvent_items = jfloor_items = NULL;
-
-    if (prev_invent)
-        free(prev_invent);
-    prev_invent = NULL;
-    prev_invent_icount = prev_floor_icount = 0;
+    int i;
+
+    json_writer_free(display_writer);
+    json_writer_free(payload_writer);
+    display_writer = payload_writer = NULL;
+    display_items = 0;
+    status_pending = screen_pending = FALSE;
+
+    for (i = 0; i <= 1; i++) {
+        free(item_lists[i].sent);
+        free(item_lists[i].latest);
+        free(item_lists[i].matches);
+    }
+    memset(item_lists, 0, sizeof (item_lists));
+    /* a new game starts out with an empty floor list, but no inventory */
+    item_lists[0].have_sent = TRUE;
 
     memset(&player_info, 0, sizeof (player_info));
     memset(&prev_dbuf, 0, sizeof (prev_dbuf));